@@ -3,27 +3,153 @@
 #include "file_write.hpp"
 
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
+#include <cerrno>
+#include <condition_variable>
 #include <cstring>
+#include <deque>
 #include <iostream>
+#include <mutex>
+#include <thread>
+
+#include "hif_codec.hpp"
+#include "hif_crc.hpp"
+
+// Pool of buffers. drain() queues the full buffer and continues with a free one, the
+// thread writes the queued buffers in order and returns them to the pool.
+struct File_write::Async_writer {
+  std::thread                             thread;
+  std::mutex                              mtx;
+  std::condition_variable                 cv;
+  std::deque<std::pair<uint8_t *, size_t>> full;
+  std::vector<uint8_t *>                  free;
+  std::vector<std::unique_ptr<uint8_t[]>> storage;
+  bool                                    done = false;
+
+  uint8_t *swap(uint8_t *buf, size_t sz) {
+    std::unique_lock<std::mutex> lock(mtx);
+    full.emplace_back(buf, sz);
+    cv.notify_all();
+    cv.wait(lock, [this]() { return !free.empty(); });
+    auto *next = free.back();
+    free.pop_back();
+    return next;
+  }
+
+  void run(File_write *fw) {
+    std::vector<uint8_t> scratch;
+
+    std::unique_lock<std::mutex> lock(mtx);
+    while (true) {
+      cv.wait(lock, [this]() { return done || !full.empty(); });
+      if (full.empty())
+        return;  // done
+
+      auto [buf, sz] = full.front();
+      full.pop_front();
+      lock.unlock();
+
+      fw->write_block(buf, sz, scratch);
+
+      lock.lock();
+      free.emplace_back(buf);
+      cv.notify_all();
+    }
+  }
+};
 
 std::shared_ptr<File_write> File_write::create(std::string_view fname) {
+  return create(fname, Options());
+}
+
+std::shared_ptr<File_write> File_write::create(std::string_view fname,
+                                               const Options   &opt) {
   std::string name(fname.data(), fname.size());  // fname can be not zero terminated
 
-  int fd = ::open(name.data(), O_RDWR | O_CREAT, 0644);
+  int fd = ::open(name.data(), O_RDWR | O_CREAT | O_TRUNC, 0644);
   if (fd < 0) {
     std::cerr << "File_write::open could not open filename:" << fname << "\n";
     return nullptr;
   }
 
-  return std::make_shared<File_write>(fd);
+  return std::make_shared<File_write>(fd, opt);
 }
 
-File_write::File_write(int fd_) {
+std::shared_ptr<File_write> File_write::append(std::string_view fname,
+                                               const Options   &opt) {
+  std::string name(fname.data(), fname.size());
+
+  int fd = ::open(name.data(), O_RDWR | O_APPEND);  // read to seed the CRCs
+  if (fd < 0) {
+    std::cerr << "File_write::append could not open filename:" << fname << "\n";
+    return nullptr;
+  }
+
+  struct stat sb;
+  if (fstat(fd, &sb) == -1) {
+    close(fd);
+    return nullptr;
+  }
+
+  auto fopt  = opt;
+  fopt.codec = nullptr;  // blocks would need the header of the file
+
+  auto fw     = std::make_shared<File_write>(fd, fopt);
+  fw->written = sb.st_size;
+
+  if (fw->crc_block && sb.st_size) {  // CRCs continue from the existing bytes
+    auto ptr = mmap(0, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (ptr == MAP_FAILED) {
+      std::cerr << "File_write::append could not read filename:" << fname << "\n";
+      return nullptr;
+    }
+    fw->track_crc(static_cast<const uint8_t *>(ptr), sb.st_size);
+    munmap(ptr, sb.st_size);
+  }
+
+  return fw;
+}
+
+std::shared_ptr<File_write> File_write::create_memory() {
+  return std::make_shared<File_write>(-1);
+}
+
+File_write::File_write(int fd_) : File_write(fd_, Options()) {}
+
+File_write::File_write(int fd_, const Options &opt) {
   buffer_pos = 0;
+  written    = 0;
   fd         = fd_;
+  buffer_max = std::max<size_t>(opt.buffer_size, buffer_slack);
+  crc_block  = fd >= 0 ? opt.crc_block : 0;
+  codec      = fd >= 0 ? opt.codec : nullptr;
+
+  if (codec) {
+    uint8_t header[Hif_codec::header_size];
+    Hif_codec::write_header(codec, buffer_max, header);
+    write_all(header, sizeof(header));
+  }
+
+  if (opt.async && fd >= 0) {
+    async = std::make_unique<Async_writer>();
+    for (auto i = 0u; i < std::max(2u, opt.num_buffers); ++i) {
+      async->storage.emplace_back(new uint8_t[buffer_max + buffer_slack]);
+      async->free.emplace_back(async->storage.back().get());
+    }
+    buffer = async->free.back();
+    async->free.pop_back();
+
+    async->thread = std::thread([this]() { async->run(this); });
+    return;
+  }
+
+  buffer_storage.reset(new uint8_t[buffer_max + buffer_slack]);
+  buffer = buffer_storage.get();
 }
 
 void File_write::add8(uint8_t x) {
@@ -69,12 +195,17 @@ void File_write::add(std::string_view txt) {
     if (buffer_pos)
       drain();
 
-    size_t sz = ::write(fd, txt.data(), txt.size());
-    if (sz != buffer_pos) {
-      std::cerr << "File_write::add sv write error " << sz << "\n";
+    if (async || codec) {  // txt is not owned or must be split in blocks
+      while (txt.size() >= buffer_max) {
+        memcpy(buffer, txt.data(), buffer_max);
+        buffer_pos = buffer_max;
+        drain();
+        txt.remove_prefix(buffer_max);
+      }
+    } else {
+      write_fd(txt.data(), txt.size());
+      return;
     }
-
-    return;
   }
 
   if ((txt.size() + buffer_pos) > buffer_max) {
@@ -87,24 +218,134 @@ void File_write::add(std::string_view txt) {
   buffer_pos += txt.size();
 }
 
+void File_write::write_fd(const void *data, size_t sz) {
+  written += sz;
+
+  if (fd < 0) {
+    auto *ptr = static_cast<const uint8_t *>(data);
+    mem.insert(mem.end(), ptr, ptr + sz);
+    return;
+  }
+
+  write_all(data, sz);
+}
+
+void File_write::write_all(const void *data, size_t sz) {
+  if (write_failed)
+    return;  // reported once, the file is incomplete anyway
+
+  auto *ptr = static_cast<const uint8_t *>(data);
+  if (crc_block)
+    track_crc(ptr, sz);
+
+  while (sz) {  // pipes and sockets can take part of it
+    auto wsz = ::write(fd, ptr, sz);
+    if (wsz < 0 && errno == EINTR)
+      continue;
+    if (wsz <= 0) {
+      std::cerr << "File_write could not append, write error " << wsz << "\n";
+      write_failed = true;
+      return;
+    }
+    ptr += wsz;
+    sz -= wsz;
+  }
+}
+
+void File_write::write_block(const uint8_t *data, size_t sz,
+                             std::vector<uint8_t> &scratch) {
+  if (codec == nullptr) {
+    write_all(data, sz);
+    return;
+  }
+
+  scratch.clear();
+  Hif_codec::encode_block(codec, data, sz, scratch);
+  write_all(scratch.data(), scratch.size());
+}
+
 void File_write::drain() {
   assert(buffer_pos);
 
-  size_t sz = ::write(fd, buffer, buffer_pos);
-  if (sz != buffer_pos) {
-    std::cerr << "File_write::destructor could not append, write error " << sz << "\n";
+  if (async) {
+    written += buffer_pos;
+    buffer = async->swap(buffer, buffer_pos);
+  } else if (codec) {
+    written += buffer_pos;
+    write_block(buffer, buffer_pos, codec_buffer);
+  } else {
+    write_fd(buffer, buffer_pos);
   }
 
   buffer_pos = 0;
 }
 
-File_write::~File_write() {
-  assert(fd >= 0);
+void File_write::track_crc(const uint8_t *data, size_t sz) {
+  while (sz) {
+    auto off = crc_bytes % crc_block;
+    if (off == 0)
+      crcs.emplace_back(0);
+
+    auto n      = std::min<size_t>(sz, crc_block - off);
+    crcs.back() = Hif_crc::crc32c(data, n, crcs.back());
+
+    crc_bytes += n;
+    data += n;
+    sz -= n;
+  }
+}
+
+void File_write::flush() {
+  if (buffer_pos) {
+    drain();
+  }
+
+  if (async) {  // every buffer back in the pool but the current one
+    std::unique_lock<std::mutex> lock(async->mtx);
+    async->cv.wait(lock, [this]() {
+      return async->full.empty() && async->free.size() + 1 == async->storage.size();
+    });
+  }
+}
+
+bool File_write::flush_all() {
+  flush();
+
+  return !write_failed;
+}
+
+const std::vector<uint32_t> &File_write::get_crcs() {
+  flush();
+
+  return crcs;
+}
+
+std::vector<uint8_t> &File_write::get_memory() {
+  assert(fd < 0);
 
   if (buffer_pos) {
     drain();
   }
 
-  ::close(fd);
+  return mem;
+}
+
+File_write::~File_write() {
+  if (buffer_pos) {
+    drain();
+  }
+
+  if (async) {
+    {
+      std::lock_guard<std::mutex> lock(async->mtx);
+      async->done = true;
+    }
+    async->cv.notify_all();
+    async->thread.join();
+  }
+
+  if (fd >= 0) {
+    ::close(fd);
+  }
   fd = -1;
 }
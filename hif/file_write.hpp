@@ -8,12 +8,35 @@
 #include <string_view>
 #include <vector>
 
+class Hif_codec;
+
 class File_write {
 public:
+  struct Options {
+    size_t buffer_size = 8192;
+    // Full buffers go to a background writer thread, so the caller keeps encoding
+    // while the previous buffers reach the disk
+    bool     async       = false;
+    unsigned num_buffers = 4;  // async only
+
+    // Each buffer becomes an independent compressed block (see Hif_codec). Uses the
+    // async writer thread to compress when async is set.
+    const Hif_codec *codec = nullptr;
+
+    // CRC32C (Hif_crc) of every crc_block bytes written to the file, as stored
+    // (after the codec). 0 disables it.
+    uint32_t crc_block = 0;
+  };
+
   static std::shared_ptr<File_write> create(std::string_view fname);
+  static std::shared_ptr<File_write> create(std::string_view fname, const Options &opt);
   static std::shared_ptr<File_write> create(const std::string &fname) {
     return create(std::string_view(fname.data(), fname.size()));
   }
+  // Adds at the end of an existing file, get_pos starts at its size (no codec)
+  static std::shared_ptr<File_write> append(std::string_view fname, const Options &opt);
+  // Same API, but the bytes are kept in memory (see get_memory)
+  static std::shared_ptr<File_write> create_memory();
 
   void add(std::string_view txt);
   void add(const std::string &txt) { add(std::string_view(txt.data(), txt.size())); }
@@ -28,14 +51,50 @@ public:
     add(sv);
   }
 
+  // Bytes added so far (the file offset of the next add)
+  size_t get_pos() const { return written + buffer_pos; }
+
+  // Flushes the buffer and returns everything added to a memory File_write
+  std::vector<uint8_t> &get_memory();
+
+  // Flushes the buffer (and waits for the async writer) and returns the crc_block
+  // CRCs of the file so far. get_file_size is the bytes they cover.
+  const std::vector<uint32_t> &get_crcs();
+  uint64_t                     get_file_size() const { return crc_bytes; }
+
+  // Flushes the buffer (and waits for the async writer), false if a write failed
+  bool flush_all();
+
   File_write(int fd_);
+  File_write(int fd_, const Options &opt);
   ~File_write();
 
 private:
+  static constexpr size_t buffer_slack = 64;  // extra space to handle add8..add32 esily
+
   void drain();
+  void write_fd(const void *data, size_t sz);
+  void write_all(const void *data, size_t sz);
+  void write_block(const uint8_t *data, size_t sz, std::vector<uint8_t> &scratch);
+  void track_crc(const uint8_t *data, size_t sz);
+  void flush();
+
+  struct Async_writer;
+
+  int                           fd;  // -1 for memory File_write
+  std::vector<uint8_t>          mem;
+  size_t                        buffer_max;
+  uint8_t                      *buffer;  // current buffer (buffer_max + buffer_slack)
+  std::unique_ptr<uint8_t[]>    buffer_storage;
+  size_t                        buffer_pos;
+  size_t                        written;  // uncompressed bytes
+  const Hif_codec              *codec;
+  std::vector<uint8_t>          codec_buffer;
+  std::unique_ptr<Async_writer> async;
+
+  bool write_failed = false;  // set by the async writer before it returns the buffer
 
-  int                     fd;
-  static constexpr size_t buffer_max = 8192;
-  uint8_t                 buffer[buffer_max + 64];  // extra space to handle esily
-  size_t                  buffer_pos;
+  uint32_t              crc_block;
+  uint64_t              crc_bytes = 0;
+  std::vector<uint32_t> crcs;  // the last one is partial until crc_block bytes
 };
@@ -2,85 +2,141 @@
 
 #include "hif_base.hpp"
 
+#include <charconv>
 #include <iostream>
 
-void Hif_base::Statement::print_tuple_entries(const std::vector<Hif_base::Tuple_entry> tuple_entries, bool is_attr) const {
-  if (tuple_entries.empty())
-    return;
+static void append_int(std::string &out, int64_t v) {
+  char buf[24];
+  auto [p, ec] = std::to_chars(buf, buf + sizeof(buf), v);
+  out.append(buf, p - buf);
+}
+
+std::string_view Hif_base::cat_name(ID_cat cat) {
+  switch (cat) {
+    case Base3_cat: return "base3";
+    case Base4_cat: return "base4";
+    case Custom_cat: return "custom";
+    default: return "";
+  }
+}
+
+template <typename T>
+static void dump_entries(std::string &out, const std::vector<T> &entries, bool is_attr) {
+  static constexpr char digits[] = "0123456789abcdef";
 
   int idx = 0;
-  for (auto &te : tuple_entries) {
+  for (const auto &te : entries) {
     if (is_attr) {
-      std::cout << "    @." << idx++ << "(";
-    }
-    else {
-      std::cout << "    %" << idx++ << ".";
-      std::cout << (te.input ? "in  " : "out ") << "(";
+      out.append("    @.");
+      append_int(out, idx++);
+      out.append("(");
+    } else {
+      out.append("    %");
+      append_int(out, idx++);
+      out.append(te.input ? ".in  (" : ".out (");
     }
 
     if (te.is_lhs_string()) {
-      std::cout << "\"" << te.lhs << "\"";
-    }
-    else if (te.is_lhs_int64()) {
-      std::cout << te.get_lhs_int64() << ") :: i64";
+      out.push_back('"');
+      out.append(te.lhs);
+      out.push_back('"');
+    } else if (te.is_lhs_int64()) {
+      append_int(out, te.get_lhs_int64());
+      out.append(") :: i64");
     }
 
     if (!te.rhs.empty()) {
-      std::cout << " = ";
+      out.append(" = ");
       if (te.is_rhs_string()) {
-        std::cout << "\"" << te.rhs << "\"" << ") :: str";
-      }
-      else if (te.is_rhs_int64()) {
-        std::cout << te.get_rhs_int64() << ") :: i64";
-      }
-      else if (te.is_rhs_base2()) {
-        std::cout << "0x";
-        for (unsigned char c : te.get_rhs_string()) {
-          std::cout << std::hex << static_cast<int>(c);
+        out.push_back('"');
+        out.append(te.rhs);
+        out.append("\") :: str");
+      } else if (te.is_rhs_int64()) {
+        append_int(out, te.get_rhs_int64());
+        out.append(") :: i64");
+      } else {
+        out.append("0x");
+        for (auto c : te.rhs) {  // first byte first
+          auto b = static_cast<uint8_t>(c);
+          out.push_back(digits[b >> 4]);
+          out.push_back(digits[b & 0xF]);
         }
-        std :: cout << ") :: bytestream";
+        out.append(") :: ");
+        out.append(te.is_rhs_base2() ? "bytestream" : Hif_base::cat_name(te.rhs_cat));
       }
+    } else {
+      out.push_back(')');
     }
-    else {
-      std::cout << ")";
-    }
-    std::cout << "\n";
+    out.push_back('\n');
   }
-
 }
 
-void Hif_base::Statement::dump() const {
-  static const char *class2name[] = {
-      "node", "assign", "attr", "open_call", "closed_call",
-      "open_def", "closed_def", "end", "use"};
-
-  std::cout << "hif." << class2name[sclass];
+template <typename S>
+static void dump_stmt(std::string &out, const S &stmt) {
+  out.append("hif.");
+  out.append(Hif_base::class_names[stmt.sclass]);
 
-  if (!instance.empty())
-    std::cout << " \"" << instance << "\"";
+  if (!stmt.instance.empty()) {
+    out.append(" \"");
+    out.append(stmt.instance);
+    out.push_back('"');
+  }
 
-  if (type != 0)
-    std::cout << " type(" << type << ")";
+  if (stmt.type != 0) {
+    out.append(" type(");
+    append_int(out, stmt.type);
+    out.push_back(')');
+  }
 
-  // For leaf ops with no I/O or attrs, omit braces entirely and return
-  if (io.empty() && attr.empty()) {
-    std::cout << "\n";
+  // For leaf ops with no I/O or attrs, omit braces entirely
+  if (stmt.io.empty() && stmt.attr.empty()) {
+    out.push_back('\n');
     return;
   }
 
-  std::cout << " {\n";
-
-  if (!io.empty()) {
-    std::cout << "  io {\n";
-    print_tuple_entries(io);
-    std::cout << "  }\n";
+  out.append(" {\n");
+  if (!stmt.io.empty()) {
+    out.append("  io {\n");
+    dump_entries(out, stmt.io, false);
+    out.append("  }\n");
   }
-
-  if (!attr.empty()) {
-    std::cout << "  attributes {\n";
-    print_tuple_entries(attr, true);
-    std::cout << "  }\n";
+  if (!stmt.attr.empty()) {
+    out.append("  attributes {\n");
+    dump_entries(out, stmt.attr, true);
+    out.append("  }\n");
   }
+  out.append("}\n");
+}
+
+void Hif_base::format_dump(std::string &out, const Statement &stmt) {
+  dump_stmt(out, stmt);
+}
+
+void Hif_base::format_dump(std::string &out, const Statement_view &stmt) {
+  dump_stmt(out, stmt);
+}
 
-  std::cout << "}\n";
+void Hif_base::format_dump_entries(std::string                    &out,
+                                   const std::vector<Tuple_entry> &entries,
+                                   bool                            is_attr) {
+  dump_entries(out, entries, is_attr);
+}
+
+void Hif_base::format_dump_entries(std::string                   &out,
+                                   const std::vector<Tuple_view> &entries,
+                                   bool                           is_attr) {
+  dump_entries(out, entries, is_attr);
+}
+
+void Hif_base::Statement::print_tuple_entries(
+    const std::vector<Hif_base::Tuple_entry> &tuple_entries, bool is_attr) const {
+  std::string out;
+  format_dump_entries(out, tuple_entries, is_attr);
+  std::cout << out;
+}
+
+void Hif_base::Statement::dump() const {
+  std::string out;
+  format_dump(out, *this);
+  std::cout << out;
 }
@@ -22,6 +22,7 @@ public:
     Base4_cat  = 3,
     Custom_cat = 4
   };
+  static constexpr size_t max_id_size = (1 << 20) - 1;  // bytes, the .id size is 20 bits
 
   // statement class (cccc field)
   enum Statement_class : uint8_t {
@@ -35,6 +36,10 @@ public:
     End,
     Use
   };
+  static constexpr std::string_view class_names[] = {"node",        "assign",   "attr",
+                                                     "open_call",   "closed_call",
+                                                     "open_def",    "closed_def",
+                                                     "end",         "use"};
 
   struct Common_base {
     constexpr Common_base(const void *d, uint32_t s) : data(d), size(s) {}
@@ -53,9 +58,56 @@ public:
     Base2(const int64_t *r, uint32_t sz = sizeof(int64_t))
         : Common_base(static_cast<const void *>(r), sz) {}
   };
-  struct Base4 : public Common_base {};
+  // The width in bits (LEB128 varint), then packed planes of (width + 7) / 8 bytes,
+  // little endian: the 0/1 values, then the x mask (Base3), then the z mask (Base4).
+  // Hif_const builds them from Verilog literals.
+  struct Base3 : public Common_base {
+    Base3(std::string_view packed) : Common_base(packed.data(), packed.size()) {}
+  };
+  struct Base4 : public Common_base {
+    Base4(std::string_view packed) : Common_base(packed.data(), packed.size()) {}
+  };
   struct Custom : public Common_base {};
 
+  // Bits of a Base2 (all its bytes), Base3 or Base4 constant (the declared width). 0
+  // if packed is not one. planes (when not null) gets the offset of the first plane.
+  static size_t const_bits(ID_cat cat, std::string_view packed,
+                           size_t *planes = nullptr) {
+    size_t off  = 0;
+    size_t bits = 0;
+    if (cat == Base2_cat) {
+      bits = packed.size() * 8;
+    } else if (cat == Base3_cat || cat == Base4_cat) {
+      for (int shift = 0;; shift += 7) {
+        if (off == packed.size() || shift > 28)
+          return 0;
+        auto b = static_cast<uint8_t>(packed[off++]);
+        bits |= static_cast<size_t>(b & 0x7F) << shift;
+        if ((b & 0x80) == 0)
+          break;
+      }
+      size_t n = cat == Base4_cat ? 3 : 2;
+      if (bits == 0 || packed.size() - off != n * ((bits + 7) / 8))
+        return 0;
+    }
+    if (planes)
+      *planes = off;
+    return bits;
+  }
+  // Bit i as '0', '1', 'x' or 'z', decoded from the planes in place
+  static char const_bit(ID_cat cat, std::string_view packed, size_t i) {
+    size_t off    = 0;
+    auto   nbytes = (const_bits(cat, packed, &off) + 7) / 8;
+    auto   bit    = [&](size_t plane) {
+      return (static_cast<uint8_t>(packed[off + plane * nbytes + i / 8]) >> (i & 7)) & 1;
+    };
+    if (cat == Base4_cat && bit(2))
+      return 'z';
+    if ((cat == Base3_cat || cat == Base4_cat) && bit(1))
+      return 'x';
+    return bit(0) ? '1' : '0';
+  }
+
   struct Tuple_entry {
     Tuple_entry(bool i, std::string_view l, std::string_view r, ID_cat lc, ID_cat rc)
         : input(i), lhs(l), rhs(r), lhs_cat(lc), rhs_cat(rc) {}
@@ -94,6 +146,21 @@ public:
     bool is_rhs_int64() const {
       return rhs_cat == ID_cat::Base2_cat && rhs.size() == sizeof(int64_t);
     }
+    bool is_rhs_base3() const { return rhs_cat == ID_cat::Base3_cat; }
+    bool is_rhs_base4() const { return rhs_cat == ID_cat::Base4_cat; }
+    // Packed constant, get_rhs_bit decodes it from the ID bytes (see const_bit)
+    bool is_rhs_const() const {
+      return rhs_cat == ID_cat::Base2_cat || rhs_cat == ID_cat::Base3_cat
+             || rhs_cat == ID_cat::Base4_cat;
+    }
+    size_t get_rhs_bits() const {
+      assert(is_rhs_const());
+      return const_bits(rhs_cat, rhs);
+    }
+    char get_rhs_bit(size_t i) const {
+      assert(is_rhs_const() && i < get_rhs_bits());
+      return const_bit(rhs_cat, rhs, i);
+    }
     std::string get_rhs_string() const {
       assert(is_rhs_string());
       return rhs;
@@ -107,6 +174,80 @@ public:
     }
   };
 
+  // Non-owning Tuple_entry. lhs/rhs point to the ID data of the reader, and they are
+  // only valid until the reader moves to the next statement.
+  struct Tuple_view {
+    Tuple_view(bool i, std::string_view l, std::string_view r, ID_cat lc, ID_cat rc)
+        : input(i), lhs(l), rhs(r), lhs_cat(lc), rhs_cat(rc) {}
+
+    bool             input;
+    std::string_view lhs;
+    std::string_view rhs;
+    ID_cat           lhs_cat;
+    ID_cat           rhs_cat;
+
+    bool operator==(const Tuple_view &r) const {
+      return input == r.input && lhs == r.lhs && rhs == r.rhs && lhs_cat == r.lhs_cat
+             && rhs_cat == r.rhs_cat;
+    }
+
+    bool is_lhs_string() const { return lhs_cat == ID_cat::String_cat; }
+    bool is_lhs_base2() const { return lhs_cat == ID_cat::Base2_cat; }
+    bool is_lhs_int64() const {
+      return lhs_cat == ID_cat::Base2_cat && lhs.size() == sizeof(int64_t);
+    }
+
+    std::string_view get_lhs_string() const {
+      assert(is_lhs_string());
+      return lhs;
+    }
+    int64_t get_lhs_int64() const {
+      assert(is_lhs_int64());
+
+      int64_t v;
+      memcpy(&v, lhs.data(), sizeof(int64_t));  // mapped data may be unaligned
+
+      return v;
+    }
+
+    bool is_rhs_string() const { return rhs_cat == ID_cat::String_cat; }
+    bool is_rhs_base2() const { return rhs_cat == ID_cat::Base2_cat; }
+    bool is_rhs_int64() const {
+      return rhs_cat == ID_cat::Base2_cat && rhs.size() == sizeof(int64_t);
+    }
+    bool is_rhs_base3() const { return rhs_cat == ID_cat::Base3_cat; }
+    bool is_rhs_base4() const { return rhs_cat == ID_cat::Base4_cat; }
+    // Packed constant, get_rhs_bit decodes it from the ID bytes (see const_bit)
+    bool is_rhs_const() const {
+      return rhs_cat == ID_cat::Base2_cat || rhs_cat == ID_cat::Base3_cat
+             || rhs_cat == ID_cat::Base4_cat;
+    }
+    size_t get_rhs_bits() const {
+      assert(is_rhs_const());
+      return const_bits(rhs_cat, rhs);
+    }
+    char get_rhs_bit(size_t i) const {
+      assert(is_rhs_const() && i < get_rhs_bits());
+      return const_bit(rhs_cat, rhs, i);
+    }
+    std::string_view get_rhs_string() const {
+      assert(is_rhs_string());
+      return rhs;
+    }
+    int64_t get_rhs_int64() const {
+      assert(is_rhs_int64());
+
+      int64_t v;
+      memcpy(&v, rhs.data(), sizeof(int64_t));
+
+      return v;
+    }
+
+    Tuple_entry to_entry() const {
+      return Tuple_entry(input, lhs, rhs, lhs_cat, rhs_cat);
+    }
+  };
+
   struct Statement {
     Statement_class sclass;
 
@@ -137,6 +278,9 @@ public:
     void add(bool inp, String l, Base2 r) {
       io.emplace_back(inp, l.to_sv(), r.to_sv(), ID_cat::String_cat, ID_cat::Base2_cat);
     }
+    void add(bool inp, String l, Base3 r) {
+      io.emplace_back(inp, l.to_sv(), r.to_sv(), ID_cat::String_cat, ID_cat::Base3_cat);
+    }
     void add(bool inp, String l, Base4 r) {
       io.emplace_back(inp, l.to_sv(), r.to_sv(), ID_cat::String_cat, ID_cat::Base4_cat);
     }
@@ -161,6 +305,7 @@ public:
     void add_input(std::string_view l, const int64_t &r) { add(true, l, r); }
     void add_input(String l, String r) { add(true, l, r); }
     void add_input(String l, Base2 r) { add(true, l, r); }
+    void add_input(String l, Base3 r) { add(true, l, r); }
     void add_input(String l, Base4 r) { add(true, l, r); }
     void add_input(String l, Custom r) { add(true, l, r); }
     void add_input(Base2 l, String r) { add(true, l, r); }
@@ -173,6 +318,7 @@ public:
     void add_output(std::string_view l, const int64_t &r) { add(false, l, r); }
     void add_output(String l, String r) { add(false, l, r); }
     void add_output(String l, Base2 r) { add(false, l, r); }
+    void add_output(String l, Base3 r) { add(false, l, r); }
     void add_output(String l, Base4 r) { add(false, l, r); }
     void add_output(String l, Custom r) { add(false, l, r); }
     void add_output(Base2 l, String r) { add(false, l, r); }
@@ -205,6 +351,13 @@ public:
                         ID_cat::String_cat,
                         ID_cat::Base2_cat);
     }
+    void add_attr(String l, Base3 r) {
+      attr.emplace_back(true,
+                        l.to_sv(),
+                        r.to_sv(),
+                        ID_cat::String_cat,
+                        ID_cat::Base3_cat);
+    }
     void add_attr(String l, Base4 r) {
       attr.emplace_back(true,
                         l.to_sv(),
@@ -255,10 +408,78 @@ public:
     bool is_end() const { return sclass == Statement_class::End; }
     bool is_use() const { return sclass == Statement_class::Use; }
 
+    // format_dump to std::cout (Hif_text::write for whole designs)
     void dump() const;
-    void print_tuple_entries(const std::vector<Hif_base::Tuple_entry> tuple_entries, bool is_attr=false) const;
+    void print_tuple_entries(const std::vector<Hif_base::Tuple_entry> &tuple_entries,
+                             bool is_attr = false) const;
   };
 
+  // Non-owning Statement filled by Hif_read::next_stmt. The io/attr vectors keep their
+  // capacity across statements, so once warmed up reading does not allocate.
+  struct Statement_view {
+    Statement_class sclass;
+
+    uint16_t type;  // 12 bit type
+
+    std::string_view instance;
+
+    std::vector<Tuple_view> io;
+    std::vector<Tuple_view> attr;
+
+    Statement_view() : sclass(Statement_class::Node), type(0) {}
+
+    void clear() {
+      sclass   = Statement_class::Node;
+      type     = 0;
+      instance = std::string_view();
+      io.clear();
+      attr.clear();
+    }
+
+    Statement to_statement() const {
+      Statement stmt(sclass);
+      stmt.type     = type;
+      stmt.instance = instance;
+
+      stmt.io.reserve(io.size());
+      for (const auto &te : io) {
+        stmt.io.emplace_back(te.input, te.lhs, te.rhs, te.lhs_cat, te.rhs_cat);
+      }
+      stmt.attr.reserve(attr.size());
+      for (const auto &te : attr) {
+        stmt.attr.emplace_back(te.input, te.lhs, te.rhs, te.lhs_cat, te.rhs_cat);
+      }
+
+      return stmt;
+    }
+
+    bool operator==(const Statement_view &rhs) const {
+      return sclass == rhs.sclass && instance == rhs.instance && type == rhs.type
+             && io == rhs.io && attr == rhs.attr;
+    }
+
+    bool is_node() const { return sclass == Statement_class::Node; }
+    bool is_assign() const { return sclass == Statement_class::Assign; }
+    bool is_attr() const { return sclass == Statement_class::Attr; }
+    bool is_open_call() const { return sclass == Statement_class::Open_call; }
+    bool is_closed_call() const { return sclass == Statement_class::Closed_call; }
+    bool is_open_def() const { return sclass == Statement_class::Open_def; }
+    bool is_closed_def() const { return sclass == Statement_class::Closed_def; }
+    bool is_end() const { return sclass == Statement_class::End; }
+    bool is_use() const { return sclass == Statement_class::Use; }
+  };
+
+  // Appends the Statement::dump text (Hif_text::Style::Dump) to out, with
+  // std::to_chars and byte values in hex
+  static void format_dump(std::string &out, const Statement &stmt);
+  static void format_dump(std::string &out, const Statement_view &stmt);
+  static void format_dump_entries(std::string                    &out,
+                                  const std::vector<Tuple_entry> &entries, bool is_attr);
+  static void format_dump_entries(std::string                   &out,
+                                  const std::vector<Tuple_view> &entries, bool is_attr);
+  // "base3", "base4" or "custom" ("" for the others)
+  static std::string_view cat_name(ID_cat cat);
+
   static Statement create_node() { return Statement(Statement_class::Node); }
   static Statement create_assign() { return Statement(Statement_class::Assign); }
   static Statement create_attr() { return Statement(Statement_class::Attr); }
@@ -273,4 +494,26 @@ public:
 
 protected:
   Hif_base() {}
+
+  // N.st/N.id chunk pairs, their optional N.ix/N.nx/N.ck sidecars, and 0.dx in deltas
+  static bool is_chunk_file(std::string_view name) {
+    if (name.size() < 4 || name[0] < '0' || name[0] > '9')
+      return false;
+    auto ext = name.substr(name.size() - 3);
+    return ext == ".st" || ext == ".id" || ext == ".ix" || ext == ".nx" || ext == ".ck"
+           || ext == ".dx";
+  }
+
+  // open_call, closed_call, open_def and closed_def start a scope closed by an end
+  static bool is_scope_begin(Statement_class sclass) {
+    return sclass >= Statement_class::Open_call && sclass <= Statement_class::Closed_def;
+  }
+
+  // Single stream HIF (pipes, sockets): the magic and then .st statements with frames
+  // in the reserved classes. An ID frame has the .id records of the IDs used by the
+  // next statement for the first time. A reset frame starts a new chunk (the ID
+  // positions start at 0 again).
+  static constexpr uint8_t stream_magic[4] = {0xFF, 'H', 'S', 1};
+  static constexpr uint8_t stream_ids      = 0x90;  // u32 size + .id records
+  static constexpr uint8_t stream_reset    = 0xA0;
 };
@@ -0,0 +1,124 @@
+//  This file is distributed under the BSD 3-Clause License. See LICENSE for details.
+
+#include "hif_checksum.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "file_write.hpp"
+#include "hif_crc.hpp"
+
+static constexpr uint8_t ck_magic[4] = {0xFF, 'H', 'C', 'K'};
+
+static uint32_t get32(const uint8_t *ptr) {
+  return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | (static_cast<uint32_t>(ptr[3]) << 24);
+}
+
+static uint64_t get64(const uint8_t *ptr) {
+  return get32(ptr) | (static_cast<uint64_t>(get32(ptr + 4)) << 32);
+}
+
+bool Hif_checksum::write(const std::string &fname) const {
+  auto fw = File_write::create(fname);
+  if (fw == nullptr) {
+    return false;
+  }
+
+  for (auto c : ck_magic) {
+    fw->add8(c);
+  }
+  fw->add32(block);
+  for (const auto *f : {&st, &id}) {
+    fw->add32(f->size);
+    fw->add32(f->size >> 32);
+    fw->add32(f->crcs.size());
+    for (auto crc : f->crcs) {
+      fw->add32(crc);
+    }
+  }
+
+  return fw->flush_all();
+}
+
+bool Hif_checksum::read(const std::string &fname) {
+  int fd = ::open(fname.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;  // optional file
+  }
+
+  struct stat sb;
+  if (fstat(fd, &sb) == -1 || sb.st_size == 0) {
+    close(fd);
+    return false;
+  }
+
+  auto ptr = static_cast<uint8_t *>(mmap(0, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0));
+  close(fd);
+  if (ptr == MAP_FAILED) {
+    return false;
+  }
+
+  bool ok = read(ptr, sb.st_size);
+
+  munmap(ptr, sb.st_size);
+
+  if (!ok) {
+    std::cerr << "Hif_checksum::read invalid checksum file " << fname << "\n";
+  }
+
+  return ok;
+}
+
+bool Hif_checksum::read(const uint8_t *data, size_t sz) {
+  st = File();
+  id = File();
+
+  if (sz < 8 || memcmp(data, ck_magic, sizeof(ck_magic)) != 0)
+    return false;
+
+  block = get32(data + 4);
+
+  const uint8_t *ptr = data + 8;
+  const uint8_t *end = data + sz;
+  for (auto *f : {&st, &id}) {
+    if (ptr + 12 > end)
+      return false;
+    f->size = get64(ptr);
+    auto n  = get32(ptr + 8);
+    ptr += 12;
+
+    // every block but the last is full
+    auto expected = block ? (f->size + block - 1) / block : 0;
+    if (n != expected || static_cast<size_t>(end - ptr) < 4 * static_cast<size_t>(n))
+      return false;
+    for (auto i = 0u; i < n; ++i, ptr += 4) {
+      f->crcs.emplace_back(get32(ptr));
+    }
+  }
+
+  return ptr == end;
+}
+
+Hif_checksum::File Hif_checksum::compute(const uint8_t *data, size_t sz, uint32_t block) {
+  File f;
+  f.size = sz;
+  for (size_t off = 0; off < sz; off += block) {
+    f.crcs.emplace_back(Hif_crc::crc32c(data + off, std::min<size_t>(block, sz - off)));
+  }
+  return f;
+}
+
+bool Hif_checksum::check_block(const File &f, uint32_t block, const uint8_t *data,
+                               size_t sz, size_t num) {
+  if (sz != f.size || num >= f.crcs.size())
+    return false;
+
+  size_t off = num * block;
+  return Hif_crc::crc32c(data + off, std::min<size_t>(block, sz - off)) == f.crcs[num];
+}
@@ -0,0 +1,39 @@
+//  This file is distributed under the BSD 3-Clause License. See LICENSE for details.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Optional per chunk sidecar (N.ck) with the CRC32C (Hif_crc) of the N.st and N.id
+// bytes as stored (compressed if they are). There is one CRC per block, so several
+// threads verify a chunk and a mismatch points to the damaged range.
+//
+//   0xFF 'H' 'C' 'K'          magic
+//   u32 block                 bytes per CRC (the last one can be shorter)
+//   { u64 size, u32 num_crcs, u32 crc[num_crcs] }  N.st, then N.id
+//
+// All the fields are little endian.
+class Hif_checksum {
+public:
+  struct File {
+    uint64_t              size = 0;
+    std::vector<uint32_t> crcs;
+  };
+
+  uint32_t block = 0;
+  File     st;
+  File     id;
+
+  bool write(const std::string &fname) const;
+  bool read(const std::string &fname);
+  bool read(const uint8_t *data, size_t sz);
+
+  // CRCs of data in blocks (what File_write computes while writing)
+  static File compute(const uint8_t *data, size_t sz, uint32_t block);
+  // Block num of data matches f (false if the data size is not f.size)
+  static bool check_block(const File &f, uint32_t block, const uint8_t *data, size_t sz,
+                          size_t num);
+};
@@ -0,0 +1,293 @@
+//  This file is distributed under the BSD 3-Clause License. See LICENSE for details.
+
+#include "hif_codec.hpp"
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <iostream>
+
+#include "thread_pool.hpp"
+
+static constexpr uint8_t hz_magic[3] = {0xFF, 'H', 'Z'};
+
+static uint32_t get32(const uint8_t *ptr) {
+  return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | (static_cast<uint32_t>(ptr[3]) << 24);
+}
+
+static void set32(uint8_t *ptr, uint32_t x) {
+  ptr[0] = x;
+  ptr[1] = x >> 8;
+  ptr[2] = x >> 16;
+  ptr[3] = x >> 24;
+}
+
+static uint32_t load32(const uint8_t *ptr) {
+  uint32_t x;
+  memcpy(&x, ptr, 4);
+  return x;
+}
+
+// LZ4 block format: sequences of {token, literals, u16 offset, match length} where
+// the token nibbles are the literal length and the match length - 4 (15 continues in
+// the next bytes). The last sequence has only literals.
+class Hif_lz : public Hif_codec {
+public:
+  uint8_t id() const override { return 1; }
+
+  size_t compress(const uint8_t *src, size_t sz, uint8_t *dst,
+                  size_t dst_cap) const override {
+    static constexpr int      hash_bits    = 14;
+    static constexpr size_t   last_literal = 5;   // format rule: last bytes are literals
+    static constexpr size_t   match_limit  = 12;  // no match starts after sz - 12
+    static constexpr uint32_t max_offset   = 65535;
+
+    std::array<uint32_t, 1 << hash_bits> table;
+    table.fill(0);
+
+    size_t op     = 0;
+    size_t anchor = 0;
+
+    auto put_len = [&](size_t len) {
+      for (; len >= 255; len -= 255) {
+        dst[op++] = 255;
+      }
+      dst[op++] = len;
+    };
+
+    auto put_seq = [&](size_t lit, size_t off, size_t mlen) -> bool {
+      // worst case: token + literal length bytes + literals + offset + match bytes
+      if (op + 1 + lit / 255 + 1 + lit + 2 + mlen / 255 + 1 > dst_cap)
+        return false;
+
+      auto &token = dst[op++];
+      token       = (lit < 15 ? lit : 15) << 4;
+      if (lit >= 15)
+        put_len(lit - 15);
+      memcpy(dst + op, src + anchor, lit);
+      op += lit;
+
+      if (off == 0)
+        return true;  // last sequence
+
+      dst[op++] = off;
+      dst[op++] = off >> 8;
+      mlen -= 4;
+      token |= mlen < 15 ? mlen : 15;
+      if (mlen >= 15)
+        put_len(mlen - 15);
+      return true;
+    };
+
+    size_t ip = 0;
+    while (sz > match_limit && ip < sz - match_limit) {
+      auto     seq = load32(src + ip);
+      uint32_t h   = (seq * 2654435761u) >> (32 - hash_bits);
+      size_t   ref = table[h];
+      table[h]     = ip;
+
+      if (ref >= ip || ip - ref > max_offset || load32(src + ref) != seq) {
+        ip += 1 + ((ip - anchor) >> 6);  // go faster over incompressible data
+        continue;
+      }
+
+      size_t mlen = 4;
+      while (ip + mlen < sz - last_literal && src[ref + mlen] == src[ip + mlen]) {
+        ++mlen;
+      }
+
+      if (!put_seq(ip - anchor, ip - ref, mlen))
+        return 0;
+
+      ip += mlen;
+      anchor = ip;
+    }
+
+    if (!put_seq(sz - anchor, 0, 0))
+      return 0;
+
+    return op;
+  }
+
+  bool decompress(const uint8_t *src, size_t sz, uint8_t *dst,
+                  size_t raw_sz) const override {
+    const uint8_t *ip   = src;
+    const uint8_t *iend = src + sz;
+    uint8_t       *op   = dst;
+    uint8_t       *oend = dst + raw_sz;
+
+    auto get_len = [&](size_t &len) -> bool {
+      uint8_t b;
+      do {
+        if (ip >= iend)
+          return false;
+        b = *ip++;
+        len += b;
+      } while (b == 255);
+      return true;
+    };
+
+    while (ip < iend) {
+      uint8_t token = *ip++;
+
+      size_t lit = token >> 4;
+      if (lit == 15 && !get_len(lit))
+        return false;
+      if (lit > static_cast<size_t>(iend - ip) || lit > static_cast<size_t>(oend - op))
+        return false;
+      if (lit <= 16 && iend - ip >= 16 && oend - op >= 16) {
+        memcpy(op, ip, 16);  // fixed size copy is faster, the extra bytes get overwritten
+      } else {
+        memcpy(op, ip, lit);
+      }
+      ip += lit;
+      op += lit;
+
+      if (ip == iend)
+        break;  // last sequence
+
+      if (iend - ip < 2)
+        return false;
+      size_t off = ip[0] | (ip[1] << 8);
+      ip += 2;
+      if (off == 0 || off > static_cast<size_t>(op - dst))
+        return false;
+
+      size_t mlen = token & 0xF;
+      if (mlen == 15 && !get_len(mlen))
+        return false;
+      mlen += 4;
+      if (mlen > static_cast<size_t>(oend - op))
+        return false;
+
+      const uint8_t *ref = op - off;
+      if (off >= 8 && static_cast<size_t>(oend - op) >= mlen + 8) {
+        for (size_t i = 0; i < mlen; i += 8) {  // may copy up to 7 extra bytes
+          memcpy(op + i, ref + i, 8);
+        }
+      } else {
+        // overlapping (runs like 0xFF 0xFF ...), every copy doubles the repeated pattern
+        for (size_t i = 0; i < mlen;) {
+          auto n = std::min(mlen - i, static_cast<size_t>(op + i - ref));
+          memcpy(op + i, ref, n);
+          i += n;
+        }
+      }
+      op += mlen;
+    }
+
+    return op == oend;
+  }
+};
+
+static std::array<const Hif_codec *, 256> &codec_table() {
+  static std::array<const Hif_codec *, 256> table = [] {
+    std::array<const Hif_codec *, 256> t{};
+    t[Hif_codec::lz()->id()] = Hif_codec::lz();
+    return t;
+  }();
+  return table;
+}
+
+const Hif_codec *Hif_codec::lz() {
+  static const Hif_lz codec;
+  return &codec;
+}
+
+void Hif_codec::add(const Hif_codec *codec) { codec_table()[codec->id()] = codec; }
+
+const Hif_codec *Hif_codec::find(uint8_t id) { return codec_table()[id]; }
+
+void Hif_codec::write_header(const Hif_codec *codec, uint32_t block_size, uint8_t *out) {
+  memcpy(out, hz_magic, sizeof(hz_magic));
+  out[3] = codec->id();
+  set32(out + 4, block_size);
+}
+
+void Hif_codec::encode_block(const Hif_codec *codec, const uint8_t *src, size_t sz,
+                             std::vector<uint8_t> &out) {
+  auto start = out.size();
+  out.resize(start + 8 + sz);
+
+  auto csz = codec->compress(src, sz, out.data() + start + 8, sz);
+  if (csz == 0 || csz >= sz) {  // does not compress, store it
+    memcpy(out.data() + start + 8, src, sz);
+    csz = sz;
+  }
+
+  set32(out.data() + start, sz);
+  set32(out.data() + start + 4, csz);
+  out.resize(start + 8 + csz);
+}
+
+bool Hif_codec::is_compressed(const uint8_t *data, size_t sz) {
+  return sz >= header_size && memcmp(data, hz_magic, sizeof(hz_magic)) == 0;
+}
+
+std::tuple<uint8_t *, size_t> Hif_codec::decompress_file(const uint8_t *data, size_t sz) {
+  assert(is_compressed(data, sz));
+
+  auto *codec = find(data[3]);
+  if (codec == nullptr) {
+    std::cerr << "Hif_codec unknown codec " << static_cast<int>(data[3]) << "\n";
+    return std::make_tuple(nullptr, 0);
+  }
+
+  struct Block {
+    size_t src;
+    size_t dst;
+  };
+  std::vector<Block> blocks;
+
+  size_t raw_sz = 0;
+  size_t pos    = header_size;
+  while (pos < sz) {
+    if (pos + 8 > sz || pos + 8 + get32(data + pos + 4) > sz) {
+      std::cerr << "Hif_codec truncated block at byte " << pos << "\n";
+      return std::make_tuple(nullptr, 0);
+    }
+    blocks.emplace_back(Block{pos, raw_sz});
+    raw_sz += get32(data + pos);
+    pos += 8 + get32(data + pos + 4);
+  }
+
+  if (raw_sz == 0)
+    return std::make_tuple(nullptr, 0);
+
+  auto *raw = static_cast<uint8_t *>(
+      mmap(0, raw_sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  if (raw == MAP_FAILED) {
+    std::cerr << "Hif_codec could not allocate " << raw_sz << " bytes\n";
+    return std::make_tuple(nullptr, 0);
+  }
+
+  std::atomic<bool> ok{true};
+  // 0 is one per core, serial when the caller is already a Thread_pool worker
+  unsigned          nthreads = blocks.size() >= 8 ? 0 : 1;
+  Thread_pool::run(blocks.size(), nthreads, [&](size_t i, unsigned) {
+    const auto *src  = data + blocks[i].src;
+    auto        bsz  = get32(src);
+    auto        csz  = get32(src + 4);
+    auto       *dst  = raw + blocks[i].dst;
+    bool        good = true;
+    if (csz == bsz) {
+      memcpy(dst, src + 8, bsz);
+    } else {
+      good = codec->decompress(src + 8, csz, dst, bsz);
+    }
+    if (!good)
+      ok = false;
+  });
+
+  if (!ok) {
+    std::cerr << "Hif_codec corrupted compressed block\n";
+    munmap(raw, raw_sz);
+    return std::make_tuple(nullptr, 0);
+  }
+
+  return std::make_tuple(raw, raw_sz);
+}
@@ -0,0 +1,51 @@
+//  This file is distributed under the BSD 3-Clause License. See LICENSE for details.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <tuple>
+#include <vector>
+
+// Block compression for .st/.id chunks. A compressed file is
+//
+//   0xFF 'H' 'Z' codec        magic (0xFF is not a valid .st or .id first byte)
+//   u32 block_size            raw bytes per block (the last one can be smaller)
+//   { u32 raw_size, u32 comp_size, data }*
+//
+// Blocks are independent, so readers decompress them in parallel. comp_size ==
+// raw_size means the block is stored uncompressed. All the fields are little endian.
+class Hif_codec {
+public:
+  virtual ~Hif_codec() = default;
+
+  virtual uint8_t id() const = 0;
+
+  // Returns the compressed size, or 0 if the result does not fit in dst_cap
+  virtual size_t compress(const uint8_t *src, size_t sz, uint8_t *dst,
+                          size_t dst_cap) const = 0;
+  // dst must be filled with exactly raw_sz bytes, false on corrupted input
+  virtual bool decompress(const uint8_t *src, size_t sz, uint8_t *dst,
+                          size_t raw_sz) const = 0;
+
+  // Built-in LZ77 codec (LZ4 block format), id 1
+  static const Hif_codec *lz();
+
+  // Codecs are found by the id stored in the file. Register custom codecs (ids 2 to
+  // 255) before creating or opening any file that uses them.
+  static void             add(const Hif_codec *codec);
+  static const Hif_codec *find(uint8_t id);
+
+  static constexpr size_t header_size = 8;
+
+  static void write_header(const Hif_codec *codec, uint32_t block_size, uint8_t *out);
+  // Appends the block (with its sizes) to out
+  static void encode_block(const Hif_codec *codec, const uint8_t *src, size_t sz,
+                           std::vector<uint8_t> &out);
+
+  static bool is_compressed(const uint8_t *data, size_t sz);
+  // Decompresses a whole file into an anonymous mmap (release with munmap). Returns
+  // nullptr on error or if the file has no data. Blocks are decompressed on all the
+  // cores, or on the calling thread inside a Thread_pool worker.
+  static std::tuple<uint8_t *, size_t> decompress_file(const uint8_t *data, size_t sz);
+};
@@ -0,0 +1,255 @@
+//  This file is distributed under the BSD 3-Clause License. See LICENSE for details.
+
+#include "hif_const.hpp"
+
+#include <array>
+#include <charconv>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define HIF_CONST_SSE2
+#endif
+
+// bits, so a Base3 (2 planes and a 4 byte width) fits in an ID. Base4 is checked
+// once packed.
+static constexpr size_t max_width = (Hif_base::max_id_size - 4) / 2 * 8;
+
+#ifdef HIF_CONST_SSE2
+static constexpr std::array<uint8_t, 256> rev8 = []() {
+  std::array<uint8_t, 256> t{};
+  for (int n = 0; n < 256; ++n) {
+    for (int k = 0; k < 8; ++k) {
+      t[n] |= ((n >> k) & 1) << (7 - k);
+    }
+  }
+  return t;
+}();
+
+// movemask has the first digit in bit 0, the planes the last digit
+static void store_rev16(uint8_t *dst, int mask) {
+  dst[0] = rev8[(mask >> 8) & 0xFF];
+  dst[1] = rev8[mask & 0xFF];
+}
+#endif
+
+bool Hif_const::from_bits(std::string_view bits, std::string &packed,
+                          Hif_base::ID_cat &cat) {
+  std::string no_sep;
+  if (bits.find('_') != std::string_view::npos) {
+    for (auto c : bits) {
+      if (c != '_')
+        no_sep.push_back(c);
+    }
+    bits = no_sep;
+  }
+
+  auto n = bits.size();
+  if (n == 0 || n > max_width)
+    return false;
+
+  uint8_t width[5];  // varint
+  size_t  hdr = 0;
+  for (auto w = n; w; w >>= 7) {
+    width[hdr++] = (w & 0x7F) | (w >> 7 ? 0x80 : 0);
+  }
+
+  auto nbytes = (n + 7) / 8;
+  packed.assign(hdr + 3 * nbytes, 0);
+  memcpy(packed.data(), width, hdr);
+  auto *val = reinterpret_cast<uint8_t *>(packed.data()) + hdr;
+  auto *xm  = val + nbytes;
+  auto *zm  = xm + nbytes;
+
+  // From the last digit, so each block of 16 fills 2 whole bytes of each plane
+  const char *p = bits.data();
+  size_t      i = n;  // digits [0, i) left
+#ifdef HIF_CONST_SSE2
+  for (; i >= 16; i -= 16) {
+    auto blk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i - 16));
+    auto eq  = [&blk](char c) { return _mm_cmpeq_epi8(blk, _mm_set1_epi8(c)); };
+
+    auto one = eq('1');
+    auto x   = _mm_or_si128(_mm_or_si128(eq('x'), eq('X')), eq('?'));
+    auto z   = _mm_or_si128(eq('z'), eq('Z'));
+    auto ok  = _mm_or_si128(_mm_or_si128(one, eq('0')), _mm_or_si128(x, z));
+    if (_mm_movemask_epi8(ok) != 0xFFFF)
+      return false;
+
+    auto off = (n - i) / 8;
+    store_rev16(val + off, _mm_movemask_epi8(one));
+    store_rev16(xm + off, _mm_movemask_epi8(x));
+    store_rev16(zm + off, _mm_movemask_epi8(z));
+  }
+#endif
+  for (size_t k = 0; k < i; ++k) {
+    auto b    = n - 1 - k;
+    auto mask = static_cast<uint8_t>(1 << (b & 7));
+    switch (p[k]) {
+      case '0': break;
+      case '1': val[b / 8] |= mask; break;
+      case 'x':
+      case 'X':
+      case '?': xm[b / 8] |= mask; break;
+      case 'z':
+      case 'Z': zm[b / 8] |= mask; break;
+      default: return false;
+    }
+  }
+
+  auto any = [nbytes](const uint8_t *plane) {
+    for (size_t k = 0; k < nbytes; ++k) {
+      if (plane[k])
+        return true;
+    }
+    return false;
+  };
+  if (any(zm)) {
+    if (packed.size() > Hif_base::max_id_size)
+      return false;
+    cat = Hif_base::Base4_cat;
+  } else if (any(xm) || n % 8) {
+    cat = Hif_base::Base3_cat;
+    packed.resize(hdr + 2 * nbytes);
+  } else {
+    cat = Hif_base::Base2_cat;
+    packed.resize(hdr + nbytes);
+    packed.erase(0, hdr);
+  }
+
+  return true;
+}
+
+bool Hif_const::from_verilog(std::string_view lit, std::string &packed,
+                             Hif_base::ID_cat &cat) {
+  auto q = lit.find('\'');
+  if (q == std::string_view::npos)
+    return false;
+
+  size_t width = 0;
+  if (q) {
+    auto [p, ec] = std::from_chars(lit.data(), lit.data() + q, width);
+    if (ec != std::errc() || p != lit.data() + q || width == 0 || width > max_width)
+      return false;
+  }
+
+  auto rest = lit.substr(q + 1);
+  if (!rest.empty() && (rest[0] == 's' || rest[0] == 'S'))
+    rest.remove_prefix(1);
+  if (rest.size() < 2)
+    return false;
+
+  std::string bits;
+  auto        digits = rest.substr(1);
+  switch (rest[0] | 0x20) {  // lower case
+    case 'b':
+      for (auto c : digits) {
+        if (c != '_')
+          bits.push_back(c);
+      }
+      break;
+    case 'o':
+    case 'h': {
+      int n = (rest[0] | 0x20) == 'o' ? 3 : 4;
+      for (auto c : digits) {
+        if (c == '_')
+          continue;
+        if (c == 'x' || c == 'X' || c == '?' || c == 'z' || c == 'Z') {
+          bits.append(n, c);
+          continue;
+        }
+        int v = -1;
+        if (c >= '0' && c <= '9')
+          v = c - '0';
+        else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+          v = (c | 0x20) - 'a' + 10;
+        if (v < 0 || v >= (1 << n))
+          return false;
+        for (int k = n - 1; k >= 0; --k) {
+          bits.push_back((v >> k) & 1 ? '1' : '0');
+        }
+      }
+      break;
+    }
+    case 'd': {
+      std::string dec;
+      for (auto c : digits) {
+        if (c != '_')
+          dec.push_back(c);
+      }
+      if (dec == "x" || dec == "X" || dec == "?" || dec == "z" || dec == "Z") {
+        bits = dec;
+        break;
+      }
+      uint64_t v;
+      auto [p, ec] = std::from_chars(dec.data(), dec.data() + dec.size(), v);
+      if (dec.empty() || ec != std::errc() || p != dec.data() + dec.size())
+        return false;
+      do {
+        bits.insert(bits.begin(), v & 1 ? '1' : '0');
+        v >>= 1;
+      } while (v);
+      break;
+    }
+    default: return false;
+  }
+  if (bits.empty())
+    return false;
+
+  if (width && bits.size() > width) {
+    bits.erase(0, bits.size() - width);
+  } else if (width > bits.size()) {
+    char fill = '0';
+    if (bits[0] == 'x' || bits[0] == 'X' || bits[0] == '?')
+      fill = 'x';
+    else if (bits[0] == 'z' || bits[0] == 'Z')
+      fill = 'z';
+    bits.insert(0, width - bits.size(), fill);
+  }
+
+  return from_bits(bits, packed, cat);
+}
+
+std::string Hif_const::to_verilog(Hif_base::ID_cat cat, std::string_view packed) {
+  auto bits = Hif_base::const_bits(cat, packed);
+  if (bits == 0)
+    return "";
+
+  std::string out = std::to_string(bits) + "'b";
+  for (auto i = bits; i-- > 0;) {
+    out.push_back(Hif_base::const_bit(cat, packed, i));
+  }
+  return out;
+}
+
+bool Hif_const::is_canonical(Hif_base::ID_cat cat, std::string_view packed) {
+  size_t off  = 0;
+  auto   bits = Hif_base::const_bits(cat, packed, &off);
+  if (bits == 0)
+    return false;
+  if (cat == Hif_base::Base2_cat)
+    return true;
+  if (off > 1 && packed[off - 1] == 0)
+    return false;  // width varint with a zero last byte
+
+  size_t  planes = cat == Hif_base::Base4_cat ? 3 : 2;
+  auto    nbytes = (bits + 7) / 8;
+  uint8_t pad    = bits % 8 ? static_cast<uint8_t>(0xFF << (bits % 8)) : 0;
+  auto    byte   = [&](size_t plane, size_t k) {
+    return static_cast<uint8_t>(packed[off + plane * nbytes + k]);
+  };
+  uint8_t last = 0;  // bits of the last plane
+  for (size_t k = 0; k < nbytes; ++k) {
+    uint8_t x = byte(1, k);
+    uint8_t z = planes > 2 ? byte(2, k) : 0;
+    if ((byte(0, k) & (x | z)) || (x & z))
+      return false;
+    last |= byte(planes - 1, k);
+  }
+  for (size_t p = 0; p < planes; ++p) {
+    if (byte(p, nbytes - 1) & pad)
+      return false;
+  }
+
+  return last || (planes == 2 && bits % 8);
+}
@@ -0,0 +1,35 @@
+//  This file is distributed under the BSD 3-Clause License. See LICENSE for details.
+
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include "hif_base.hpp"
+
+// Four state (0, 1, x, z) constants packed as Base2/Base3/Base4 planes (see
+// Hif_base::Base3). Each plane has one bit per digit, padded to bytes. Base3 and
+// Base4 keep the width, Base2 has none (its width is its bytes).
+class Hif_const {
+public:
+  // Binary digits, most significant first: 0, 1, x/X/?, z/Z, and _ separators. cat is
+  // the smallest category that keeps the value and the width: Base2 without x/z and
+  // a multiple of 8 digits, Base3 with x (or a width that Base2 can not hold), Base4
+  // with z. Blocks of 16 digits are converted with SSE2 compares and movemask (one per
+  // plane) where available. false on other characters.
+  static bool from_bits(std::string_view bits, std::string &packed,
+                        Hif_base::ID_cat &cat);
+
+  // Verilog literal: [width]'[s](b|o|d|h)digits, e.g. 8'b10xz_0011, 4'hz, 'o17. The
+  // digits are extended (with x or z if the top one is) or truncated to width.
+  // Decimals are up to 64 bits, or a single x or z digit. The sign flag is ignored.
+  static bool from_verilog(std::string_view lit, std::string &packed,
+                           Hif_base::ID_cat &cat);
+
+  // <width>'b<digits>, empty if packed is not a valid constant of cat
+  static std::string to_verilog(Hif_base::ID_cat cat, std::string_view packed);
+
+  // from_verilog(to_verilog(cat, packed)) gives the same cat and bytes: no x/z bit has
+  // a value bit, the padding bits are 0, and cat is the smallest one
+  static bool is_canonical(Hif_base::ID_cat cat, std::string_view packed);
+};
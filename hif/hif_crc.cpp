@@ -0,0 +1,192 @@
+//  This file is distributed under the BSD 3-Clause License. See LICENSE for details.
+
+#include "hif_crc.hpp"
+
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#define HIF_CRC_X86
+#endif
+
+static constexpr uint32_t crc_poly = 0x82F63B78;  // reflected Castagnoli
+
+// Interleaved stream sizes of the SSE4.2 loop
+static constexpr size_t long_block  = 8192;
+static constexpr size_t short_block = 256;
+
+struct Crc_tables {
+  uint32_t slice[8][256];  // slicing-by-8
+  uint32_t long_shift[4][256];
+  uint32_t short_shift[4][256];
+
+  Crc_tables() {
+    for (uint32_t n = 0; n < 256; ++n) {
+      uint32_t crc = n;
+      for (int k = 0; k < 8; ++k) {
+        crc = crc & 1 ? (crc >> 1) ^ crc_poly : crc >> 1;
+      }
+      slice[0][n] = crc;
+    }
+    for (uint32_t n = 0; n < 256; ++n) {
+      for (int k = 1; k < 8; ++k) {
+        slice[k][n] = (slice[k - 1][n] >> 8) ^ slice[0][slice[k - 1][n] & 0xFF];
+      }
+    }
+
+    zeros_table(long_shift, long_block);
+    zeros_table(short_shift, short_block);
+  }
+
+  // The CRC is linear over GF(2), so appending len zero bytes is a 32x32 bit matrix
+  // (built by squaring the one zero bit operator), applied a byte at a time
+  static uint32_t times(const uint32_t *mat, uint32_t vec) {
+    uint32_t sum = 0;
+    for (; vec; vec >>= 1, ++mat) {
+      if (vec & 1)
+        sum ^= *mat;
+    }
+    return sum;
+  }
+
+  static void square(uint32_t *sq, const uint32_t *mat) {
+    for (int n = 0; n < 32; ++n) {
+      sq[n] = times(mat, mat[n]);
+    }
+  }
+
+  static void zeros_table(uint32_t table[4][256], size_t len) {  // len power of 2
+    uint32_t odd[32];
+    uint32_t even[32];
+
+    odd[0] = crc_poly;  // one zero bit
+    for (int n = 1; n < 32; ++n) {
+      odd[n] = 1u << (n - 1);
+    }
+    square(even, odd);  // two bits
+    square(odd, even);  // four bits
+
+    const uint32_t *op = nullptr;
+    while (true) {
+      square(even, odd);  // one byte the first time, doubles each square
+      len >>= 1;
+      if (len == 0) {
+        op = even;
+        break;
+      }
+      square(odd, even);
+      len >>= 1;
+      if (len == 0) {
+        op = odd;
+        break;
+      }
+    }
+
+    for (uint32_t n = 0; n < 256; ++n) {
+      for (int k = 0; k < 4; ++k) {
+        table[k][n] = times(op, n << (8 * k));
+      }
+    }
+  }
+
+  static uint32_t shift(const uint32_t table[4][256], uint32_t crc) {
+    return table[0][crc & 0xFF] ^ table[1][(crc >> 8) & 0xFF]
+           ^ table[2][(crc >> 16) & 0xFF] ^ table[3][crc >> 24];
+  }
+};
+
+static const Crc_tables &tables() {
+  static const Crc_tables t;
+  return t;
+}
+
+static uint32_t crc32c_table(const uint8_t *ptr, size_t sz, uint32_t crc) {
+  const auto &t = tables();
+
+  crc = ~crc;
+  for (; sz >= 8; sz -= 8, ptr += 8) {
+    uint64_t w;
+    memcpy(&w, ptr, 8);
+    w ^= crc;
+    crc = t.slice[7][w & 0xFF] ^ t.slice[6][(w >> 8) & 0xFF]
+          ^ t.slice[5][(w >> 16) & 0xFF] ^ t.slice[4][(w >> 24) & 0xFF]
+          ^ t.slice[3][(w >> 32) & 0xFF] ^ t.slice[2][(w >> 40) & 0xFF]
+          ^ t.slice[1][(w >> 48) & 0xFF] ^ t.slice[0][w >> 56];
+  }
+  for (; sz; --sz, ++ptr) {
+    crc = (crc >> 8) ^ t.slice[0][(crc ^ *ptr) & 0xFF];
+  }
+
+  return ~crc;
+}
+
+#ifdef HIF_CRC_X86
+// Three streams over consecutive blocks, then the first two are shifted over the
+// blocks after them and combined
+template <size_t Block>
+__attribute__((target("sse4.2"))) static const uint8_t *crc32c_three(
+    const uint8_t *ptr, size_t &sz, uint64_t &crc0, const uint32_t shift[4][256]) {
+  while (sz >= 3 * Block) {
+    uint64_t crc1 = 0;
+    uint64_t crc2 = 0;
+    for (const uint8_t *end = ptr + Block; ptr < end; ptr += 8) {
+      uint64_t w0, w1, w2;
+      memcpy(&w0, ptr, 8);
+      memcpy(&w1, ptr + Block, 8);
+      memcpy(&w2, ptr + 2 * Block, 8);
+      crc0 = _mm_crc32_u64(crc0, w0);
+      crc1 = _mm_crc32_u64(crc1, w1);
+      crc2 = _mm_crc32_u64(crc2, w2);
+    }
+    crc0 = Crc_tables::shift(shift, crc0) ^ crc1;
+    crc0 = Crc_tables::shift(shift, crc0) ^ crc2;
+    ptr += 2 * Block;
+    sz -= 3 * Block;
+  }
+  return ptr;
+}
+
+__attribute__((target("sse4.2"))) static uint32_t crc32c_sse42(const uint8_t *ptr,
+                                                                 size_t         sz,
+                                                                 uint32_t       crc) {
+  const auto &t = tables();
+
+  uint64_t crc0 = ~crc;
+  ptr           = crc32c_three<long_block>(ptr, sz, crc0, t.long_shift);
+  ptr           = crc32c_three<short_block>(ptr, sz, crc0, t.short_shift);
+  for (; sz >= 8; sz -= 8, ptr += 8) {
+    uint64_t w;
+    memcpy(&w, ptr, 8);
+    crc0 = _mm_crc32_u64(crc0, w);
+  }
+  for (; sz; --sz, ++ptr) {
+    crc0 = _mm_crc32_u8(crc0, *ptr);
+  }
+
+  return ~static_cast<uint32_t>(crc0);
+}
+#endif
+
+Hif_crc::Impl Hif_crc::best_impl() {
+#ifdef HIF_CRC_X86
+  static const Impl impl = __builtin_cpu_supports("sse4.2") ? Impl::Sse42 : Impl::Table;
+  return impl;
+#else
+  return Impl::Table;
+#endif
+}
+
+uint32_t Hif_crc::crc32c(const void *data, size_t sz, uint32_t crc) {
+  return crc32c(best_impl(), data, sz, crc);
+}
+
+uint32_t Hif_crc::crc32c(Impl impl, const void *data, size_t sz, uint32_t crc) {
+  auto *ptr = static_cast<const uint8_t *>(data);
+#ifdef HIF_CRC_X86
+  if (impl == Impl::Sse42 && best_impl() == Impl::Sse42)
+    return crc32c_sse42(ptr, sz, crc);
+#else
+  (void)impl;
+#endif
+  return crc32c_table(ptr, sz, crc);
+}
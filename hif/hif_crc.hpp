@@ -0,0 +1,20 @@
+//  This file is distributed under the BSD 3-Clause License. See LICENSE for details.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC32C (Castagnoli polynomial, same as iSCSI and ext4). SSE4.2 has an instruction
+// for it; three interleaved streams hide its latency, so one core runs at memory
+// bandwidth. It is picked at run time, other machines use slicing-by-8 tables.
+class Hif_crc {
+public:
+  // A previous result continues the checksum: crc32c(b, crc32c(a)) == crc32c(a + b)
+  static uint32_t crc32c(const void *data, size_t sz, uint32_t crc = 0);
+
+  // Exposed to compare the implementations
+  enum class Impl { Table, Sse42 };
+  static uint32_t crc32c(Impl impl, const void *data, size_t sz, uint32_t crc = 0);
+  static Impl     best_impl();
+};
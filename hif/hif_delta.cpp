@@ -0,0 +1,260 @@
+//  This file is distributed under the BSD 3-Clause License. See LICENSE for details.
+
+#include "hif_delta.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <iostream>
+
+#include "file_write.hpp"
+#include "hif_delta_read.hpp"
+#include "hif_pack.hpp"
+#include "hif_read.hpp"
+
+static constexpr uint8_t dx_magic[4] = {0xFF, 'H', 'D', 'X'};
+
+static uint32_t get32(const uint8_t *ptr) {
+  return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | (static_cast<uint32_t>(ptr[3]) << 24);
+}
+
+static uint64_t get64(const uint8_t *ptr) {
+  return get32(ptr) | (static_cast<uint64_t>(get32(ptr + 4)) << 32);
+}
+
+static void add64(File_write &fw, uint64_t v) {
+  fw.add32(v);
+  fw.add32(v >> 32);
+}
+
+std::shared_ptr<Hif_delta> Hif_delta::create(std::string_view dname,
+                                             std::string_view base,
+                                             std::string_view tool,
+                                             std::string_view version) {
+  auto ptr = std::make_shared<Hif_delta>(dname, base, tool, version);
+
+  return ptr->is_ok() ? ptr : nullptr;
+}
+
+Hif_delta::Hif_delta(std::string_view _dname, std::string_view base,
+                     std::string_view tool, std::string_view version)
+    : dname(_dname) {
+  struct stat sb;
+  if ((stat(dname.c_str(), &sb) == 0 && !S_ISDIR(sb.st_mode))
+      || (dname.size() > 4 && dname.compare(dname.size() - 4, 4, ".hif") == 0)) {
+    std::cerr << "Hif_delta::create " << dname << " must be a directory (see hif_pack)\n";
+    return;
+  }
+
+  Ops tmp;
+  if (read_ops(base, tmp)) {
+    std::cerr << "Hif_delta::create base " << base << " is a delta (compact it first)\n";
+    return;
+  }
+
+  auto rd = Hif_read::open(base);
+  if (rd == nullptr) {
+    std::cerr << "Hif_delta::create could not open base " << base << "\n";
+    return;
+  }
+  data.base       = std::string(base);
+  data.base_hash  = rd->content_hash();
+  data.base_stmts = rd->statement_count();
+  data.base_stamp = rd->file_stamp();
+
+  Hif_write::Options opt;
+  opt.index_stride = 64;  // deltas are small, keep seek cheap anyway
+
+  wr = Hif_write::create(dname, tool, version, opt);
+}
+
+Hif_delta::~Hif_delta() { close(); }
+
+Hif_delta::Op *Hif_delta::op_at(uint64_t begin, uint64_t end) {
+  if (!is_ok() || begin > end || end > data.base_stmts) {
+    std::cerr << "Hif_delta invalid base range [" << begin << ", " << end << ")\n";
+    return nullptr;
+  }
+
+  uint64_t first = 0;
+  if (!data.ops.empty()) {
+    auto &last = data.ops.back();
+    if (last.end == begin) {
+      last.end = end;
+      return &last;
+    }
+    if (begin < last.end) {
+      std::cerr << "Hif_delta edit at " << begin << " goes back (last edit ends at "
+                << last.end << ")\n";
+      return nullptr;
+    }
+    first = last.first + last.count;
+  }
+
+  data.ops.emplace_back(Op{begin, end, first, 0});
+  return &data.ops.back();
+}
+
+template <typename S>
+bool Hif_delta::add(uint64_t pos, uint64_t end, const S &stmt) {
+  auto *op = op_at(pos, end);
+  if (op == nullptr)
+    return false;
+
+  wr->add(stmt);
+  ++op->count;
+  return true;
+}
+
+bool Hif_delta::insert(uint64_t pos, const Statement &stmt) {
+  return add(pos, pos, stmt);
+}
+
+bool Hif_delta::insert(uint64_t pos, const Statement_view &stmt) {
+  return add(pos, pos, stmt);
+}
+
+bool Hif_delta::replace(uint64_t pos, const Statement &stmt) {
+  return add(pos, pos + 1, stmt);
+}
+
+bool Hif_delta::replace(uint64_t pos, const Statement_view &stmt) {
+  return add(pos, pos + 1, stmt);
+}
+
+bool Hif_delta::erase(uint64_t begin, uint64_t end) {
+  return op_at(begin, end) != nullptr;
+}
+
+bool Hif_delta::close() {
+  if (!is_ok())
+    return false;
+
+  bool ok = wr->close();  // the statements before the ops that point to them
+  wr      = nullptr;
+  if (!ok)
+    return false;
+
+  auto fw = File_write::create(dname + "/0.dx");
+  if (fw == nullptr)
+    return false;
+
+  for (auto c : dx_magic) {
+    fw->add8(c);
+  }
+  add64(*fw, data.base_hash);
+  add64(*fw, data.base_stmts);
+  add64(*fw, data.base_stamp);
+  fw->add32(data.base.size());
+  fw->add(data.base);
+  fw->add32(data.ops.size());
+  for (const auto &op : data.ops) {
+    add64(*fw, op.begin);
+    add64(*fw, op.end);
+    add64(*fw, op.first);
+    add64(*fw, op.count);
+  }
+  if (!fw->flush_all()) {
+    std::cerr << "Hif_delta could not write " << dname << "/0.dx\n";
+    return false;
+  }
+
+  return true;
+}
+
+bool Hif_delta::read_ops(std::string_view dname, Ops &ops) {
+  std::string sname(dname.data(), dname.size());
+
+  std::vector<uint8_t> buf;
+  const uint8_t       *ptr;
+  size_t               sz;
+
+  std::shared_ptr<Hif_pack> pk;
+  struct stat               sb;
+  if (stat(sname.c_str(), &sb) == 0 && S_ISREG(sb.st_mode)) {
+    pk      = Hif_pack::open(sname);
+    auto *f = pk ? pk->find("0.dx") : nullptr;
+    if (f == nullptr)
+      return false;
+    ptr = f->data;
+    sz  = f->size;
+  } else {
+    int fd = ::open((sname + "/0.dx").c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;  // not a delta
+    if (fstat(fd, &sb) == 0) {
+      buf.resize(sb.st_size);
+      if (::read(fd, buf.data(), buf.size()) != static_cast<ssize_t>(buf.size()))
+        buf.clear();
+    }
+    ::close(fd);
+    ptr = buf.data();
+    sz  = buf.size();
+  }
+
+  const uint8_t *end = ptr + sz;
+  if (sz < 4 + 8 + 8 + 8 + 4 || memcmp(ptr, dx_magic, sizeof(dx_magic)) != 0) {
+    std::cerr << "Hif_delta invalid " << dname << "/0.dx\n";
+    return false;
+  }
+  ptr += sizeof(dx_magic);
+
+  ops.base_hash  = get64(ptr);
+  ops.base_stmts = get64(ptr + 8);
+  ops.base_stamp = get64(ptr + 16);
+  auto name_sz   = get32(ptr + 24);
+  ptr += 28;
+  if (name_sz + 4u > static_cast<size_t>(end - ptr)) {
+    std::cerr << "Hif_delta truncated " << dname << "/0.dx\n";
+    return false;
+  }
+  ops.base.assign(reinterpret_cast<const char *>(ptr), name_sz);
+  ptr += name_sz;
+
+  auto num_ops  = get32(ptr);
+  auto ops_size = static_cast<size_t>(num_ops) * 32;
+  ptr += 4;
+  if (ops_size != static_cast<size_t>(end - ptr)) {
+    std::cerr << "Hif_delta truncated " << dname << "/0.dx\n";
+    return false;
+  }
+
+  ops.ops.clear();
+  uint64_t base_pos = 0;
+  uint64_t first    = 0;
+  for (auto i = 0u; i < num_ops; ++i, ptr += 32) {
+    Op op{get64(ptr), get64(ptr + 8), get64(ptr + 16), get64(ptr + 24)};
+    if (op.begin < base_pos || op.end < op.begin || op.end > ops.base_stmts
+        || op.first != first) {
+      std::cerr << "Hif_delta op " << i << " out of order in " << dname << "/0.dx\n";
+      return false;
+    }
+    base_pos = op.end;
+    first    = op.first + op.count;
+    ops.ops.emplace_back(op);
+  }
+
+  return true;
+}
+
+bool Hif_delta::compact(std::string_view dname, std::string_view fname,
+                        std::string_view base) {
+  auto rd = Hif_delta_read::open(dname, base);
+  if (rd == nullptr)
+    return false;
+
+  auto wr = Hif_write::create(fname, rd->get_tool(), rd->get_version());
+  if (wr == nullptr)
+    return false;
+
+  rd->each([&wr](const Statement_view &stmt) { wr->add(stmt); });
+  if (rd->has_error()) {
+    std::cerr << "Hif_delta::compact " << dname << " stopped at a corrupted statement\n";
+    wr->close();
+    return false;
+  }
+
+  return wr->close();
+}
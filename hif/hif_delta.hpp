@@ -0,0 +1,89 @@
+//  This file is distributed under the BSD 3-Clause License. See LICENSE for details.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "hif_base.hpp"
+#include "hif_write.hpp"
+
+// Edits (e.g. an ECO) of a base HIF saved without rewriting it. A delta is a HIF
+// directory with only the new statements, plus a 0.dx sidecar with the edit ops:
+//
+//   0xFF 'H' 'D' 'X'          magic
+//   u64 base_hash             Hif_read::content_hash of the base
+//   u64 base_stmts            Hif_read::statement_count of the base
+//   u64 base_stamp            Hif_read::file_stamp of the base
+//   u32 size, base name       as given to create
+//   u32 num_ops
+//   { u64 begin, u64 end, u64 first, u64 count }[num_ops]
+//
+// Each op replaces the base statements [begin, end) with the delta statements
+// [first, first + count): begin == end inserts, count == 0 deletes. Ops are sorted and
+// do not overlap. Statement numbers are the ones of Hif_read::seek (HIF header
+// excluded). Hif_delta_read shows the patched design, compact writes it. It hashes
+// the base again only when the base_stamp does not match.
+class Hif_delta : public Hif_base {
+public:
+  struct Op {
+    uint64_t begin;
+    uint64_t end;
+    uint64_t first;
+    uint64_t count;
+  };
+
+  struct Ops {
+    uint64_t        base_hash  = 0;
+    uint64_t        base_stmts = 0;
+    uint64_t        base_stamp = 0;
+    std::string     base;
+    std::vector<Op> ops;
+  };
+
+  // dname is a directory (hif_pack can pack it once closed). base must be a full
+  // design, not another delta.
+  static std::shared_ptr<Hif_delta> create(std::string_view dname, std::string_view base,
+                                           std::string_view tool,
+                                           std::string_view version);
+
+  // Edits go in base order (pos never goes back), false otherwise. insert adds stmt
+  // before base statement pos (base_stmts appends). Consecutive edits at the same
+  // place become one op, so replace(5, a) + insert(6, b) replaces 5 with a, b.
+  bool insert(uint64_t pos, const Statement &stmt);
+  bool insert(uint64_t pos, const Statement_view &stmt);
+  bool replace(uint64_t pos, const Statement &stmt);
+  bool replace(uint64_t pos, const Statement_view &stmt);
+  bool erase(uint64_t begin, uint64_t end);
+
+  // Writes 0.dx and closes the delta (the destructor calls it). False if the
+  // statements or 0.dx were not written.
+  bool close();
+
+  // Ops of a delta (directory or pack), false if dname is not a delta
+  static bool read_ops(std::string_view dname, Ops &ops);
+
+  // Writes the patched design to fname (a directory or a pack, see Hif_write::create).
+  // False if it was not fully written (e.g. a damaged base statement).
+  static bool compact(std::string_view dname, std::string_view fname,
+                      std::string_view base = "");
+
+  Hif_delta(std::string_view dname, std::string_view base, std::string_view tool,
+            std::string_view version);
+  ~Hif_delta();
+
+protected:
+  bool is_ok() const { return wr != nullptr; }
+
+  // Op that ends at pos (new or merged with the last one)
+  Op  *op_at(uint64_t begin, uint64_t end);
+  template <typename S>
+  bool add(uint64_t pos, uint64_t end, const S &stmt);
+
+  std::string                dname;
+  std::shared_ptr<Hif_write> wr;
+  Ops                        data;
+};
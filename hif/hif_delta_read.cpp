@@ -0,0 +1,115 @@
+//  This file is distributed under the BSD 3-Clause License. See LICENSE for details.
+
+#include "hif_delta_read.hpp"
+
+#include <iostream>
+
+std::shared_ptr<Hif_delta_read> Hif_delta_read::open(std::string_view dname,
+                                                     std::string_view base) {
+  auto ptr = std::make_shared<Hif_delta_read>(dname, base);
+
+  return ptr->is_ok() ? ptr : nullptr;
+}
+
+Hif_delta_read::Hif_delta_read(std::string_view dname, std::string_view base) {
+  if (!Hif_delta::read_ops(dname, ops)) {
+    std::cerr << "Hif_delta_read::open " << dname << " is not a HIF delta\n";
+    return;
+  }
+  if (!base.empty()) {
+    ops.base = std::string(base);
+  }
+
+  base_rd = Hif_read::open(ops.base);
+  if (base_rd == nullptr) {
+    std::cerr << "Hif_delta_read::open could not open base " << ops.base << "\n";
+    return;
+  }
+  // The whole base is read for the hash, only when its files changed since
+  if (base_rd->statement_count() != ops.base_stmts
+      || (base_rd->file_stamp() != ops.base_stamp
+          && base_rd->content_hash() != ops.base_hash)) {
+    std::cerr << "Hif_delta_read::open base " << ops.base
+              << " changed after the delta was written\n";
+    return;
+  }
+
+  auto rd = Hif_read::open(dname);
+  if (rd == nullptr)
+    return;
+
+  num_stmts = ops.base_stmts;
+  for (const auto &op : ops.ops) {
+    num_stmts += op.count - (op.end - op.begin);
+  }
+  auto num_new = ops.ops.empty() ? 0 : ops.ops.back().first + ops.ops.back().count;
+  if (num_new > rd->statement_count()) {
+    std::cerr << "Hif_delta_read::open " << dname << " has fewer statements than ops\n";
+    return;
+  }
+
+  delta_rd = rd;
+  cur_rd   = base_rd.get();
+}
+
+bool Hif_delta_read::next_stmt() {
+  if (!is_ok())
+    return false;
+
+  while (true) {
+    if (pending) {
+      --pending;
+      cur_rd = delta_rd.get();
+      return delta_rd->next_stmt();
+    }
+
+    if (next_op < ops.ops.size() && ops.ops[next_op].begin == base_pos) {
+      const auto &op = ops.ops[next_op++];
+      if (op.end != op.begin) {
+        base_rd->skip(op.end - op.begin);  // deleted or replaced
+      }
+      base_pos = op.end;
+      pending  = op.count;
+      continue;  // delta statements are in op order, delta_rd is already there
+    }
+
+    cur_rd = base_rd.get();
+    if (!base_rd->next_stmt())
+      return false;
+    ++base_pos;
+    return true;
+  }
+}
+
+bool Hif_delta_read::seek(uint64_t stmt_index) {
+  if (!is_ok() || stmt_index > num_stmts)
+    return false;
+
+  uint64_t out = 0;  // patched number of base statement pos
+  uint64_t pos = 0;
+  size_t   k   = 0;
+  for (; k < ops.ops.size(); ++k) {
+    const auto &op = ops.ops[k];
+    if (stmt_index < out + (op.begin - pos))
+      break;  // kept base statement before op
+    out += op.begin - pos;
+
+    if (stmt_index < out + op.count) {  // inside the op statements
+      auto in  = stmt_index - out;
+      next_op  = k + 1;
+      base_pos = op.end;
+      pending  = op.count - in;
+      return base_rd->seek(op.end) && delta_rd->seek(op.first + in);
+    }
+    out += op.count;
+    pos = op.end;
+  }
+
+  next_op  = k;
+  base_pos = pos + (stmt_index - out);
+  pending  = 0;
+  if (k < ops.ops.size() && !delta_rd->seek(ops.ops[k].first))
+    return false;
+
+  return base_rd->seek(base_pos);
+}
@@ -0,0 +1,70 @@
+//  This file is distributed under the BSD 3-Clause License. See LICENSE for details.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <type_traits>
+
+#include "hif_base.hpp"
+#include "hif_delta.hpp"
+#include "hif_read.hpp"
+
+// Patched view of a delta (see Hif_delta): the base statements outside the ops, and
+// the delta statements in their place. Nothing is copied, next_stmt switches between
+// a base and a delta Hif_read at each op.
+class Hif_delta_read : public Hif_base {
+public:
+  // base overrides the base name in the delta (e.g. the design was moved). Fails if the
+  // base content hash is not the one the delta was written against.
+  static std::shared_ptr<Hif_delta_read> open(std::string_view dname,
+                                              std::string_view base = "");
+
+  bool next_stmt();
+  // A base or delta statement did not decode (see Hif_read::has_error)
+  bool has_error() const {
+    return is_ok() && (base_rd->has_error() || delta_rd->has_error());
+  }
+  Hif_base::Statement get_current_stmt() const { return cur_rd->get_current_stmt(); }
+  // The view is valid until the next call to next_stmt
+  const Hif_base::Statement_view &get_current_view() const {
+    return cur_rd->get_current_view();
+  }
+
+  // fn takes a Statement_view (zero-copy) or a Statement
+  template <typename F>
+  void each(F &&fn) {
+    while (next_stmt()) {
+      if constexpr (std::is_invocable_v<F &, const Hif_base::Statement_view &>) {
+        fn(get_current_view());
+      } else {
+        fn(get_current_stmt());
+      }
+    }
+  }
+
+  // Same as Hif_read, in patched statement numbers
+  uint64_t statement_count() const { return num_stmts; }
+  bool     seek(uint64_t stmt_index);
+
+  const Hif_delta::Ops &get_ops() const { return ops; }
+
+  std::string_view get_tool() const { return delta_rd->get_tool(); }
+  std::string_view get_version() const { return delta_rd->get_version(); }
+
+  Hif_delta_read(std::string_view dname, std::string_view base);
+
+protected:
+  bool is_ok() const { return delta_rd != nullptr; }
+
+  Hif_delta::Ops            ops;
+  std::shared_ptr<Hif_read> base_rd;
+  std::shared_ptr<Hif_read> delta_rd;
+  Hif_read                 *cur_rd = nullptr;  // reader of the current statement
+
+  uint64_t num_stmts = 0;
+  size_t   next_op   = 0;  // first op not applied yet
+  uint64_t base_pos  = 0;  // base statement that base_rd returns next
+  uint64_t pending   = 0;  // delta statements left in the current op
+};
@@ -0,0 +1,141 @@
+//  This file is distributed under the BSD 3-Clause License. See LICENSE for details.
+
+#include "hif_design.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include "hif_read.hpp"
+
+uint32_t Hif_design::intern(std::string_view txt, ID_cat cat) {
+  auto it = id2pos.find(txt);
+  if (it != id2pos.end())
+    return it->second;
+
+  char *dst;
+  if (txt.size() > arena_block) {  // large IDs get their own block
+    arena.emplace_back(new char[txt.size()]);
+    arena_bytes += txt.size();
+    dst = arena.back().get();
+  } else {
+    if (txt.size() > arena_left) {  // blocks double up to arena_block
+      auto sz = std::min(arena_block, std::max<size_t>(4096, arena_bytes));
+      arena.emplace_back(new char[sz]);
+      arena_bytes += sz;
+      arena_ptr  = arena.back().get();
+      arena_left = sz;
+    }
+    dst = arena_ptr;
+    arena_ptr += txt.size();
+    arena_left -= txt.size();
+  }
+  memcpy(dst, txt.data(), txt.size());
+  txt = std::string_view(dst, txt.size());
+
+  uint32_t pos = ids.size();
+  ids.emplace_back(txt);
+  id_cat.emplace_back(cat);
+  id2pos.emplace(txt, pos);
+
+  return pos;
+}
+
+std::shared_ptr<Hif_design> Hif_design::open(std::string_view dname) {
+  auto rd = Hif_read::open(dname);
+  if (rd == nullptr)
+    return nullptr;
+
+  auto design     = std::make_shared<Hif_design>();
+  design->tool    = rd->get_tool();
+  design->version = rd->get_version();
+
+  // Each chunk ID is looked up by text once, later references hit the pointer cache
+  // (the view points to the chunk ID file)
+  size_t chunk = SIZE_MAX;
+#ifdef USE_ABSL_MAP
+  absl::flat_hash_map<const char *, uint32_t> chunk_ids;
+#else
+  std::unordered_map<const char *, uint32_t> chunk_ids;
+#endif
+  auto lookup = [&](std::string_view txt, ID_cat cat) {
+    auto [it, inserted] = chunk_ids.try_emplace(txt.data(), 0);
+    if (inserted)
+      it->second = design->intern(txt, cat);
+    return it->second;
+  };
+
+  auto *d = design.get();
+  rd->each([&](const Statement_view &stmt) {
+    if (rd->get_current_chunk() != chunk) {
+      chunk = rd->get_current_chunk();
+      chunk_ids.clear();
+    }
+
+    d->sclass.emplace_back(stmt.sclass);
+    d->type.emplace_back(stmt.type);
+    d->instance.emplace_back(stmt.instance.empty() ? no_id
+                                                   : lookup(stmt.instance, String_cat));
+
+    for (const auto &te : stmt.io) {  // empty lhs/rhs are not IDs in io
+      d->io.emplace_back(Entry{te.lhs.empty() ? no_id : lookup(te.lhs, te.lhs_cat),
+                               te.rhs.empty() ? no_id : lookup(te.rhs, te.rhs_cat)});
+      d->io_input.emplace_back(te.input);
+    }
+    d->io_begin.emplace_back(d->io.size());
+
+    for (const auto &te : stmt.attr) {  // empty attr values are IDs
+      d->attr.emplace_back(Entry{lookup(te.lhs, te.lhs_cat), lookup(te.rhs, te.rhs_cat)});
+    }
+    d->attr_begin.emplace_back(d->attr.size());
+  });
+
+  decltype(design->id2pos)().swap(design->id2pos);
+
+  return design;
+}
+
+void Hif_design::get_view(size_t pos, Statement_view &view) const {
+  view.clear();
+
+  view.sclass   = static_cast<Statement_class>(sclass[pos]);
+  view.type     = type[pos];
+  view.instance = get_id(instance[pos]);
+
+  for (auto k = io_begin[pos]; k < io_begin[pos + 1]; ++k) {
+    view.io.emplace_back(io_input[k],
+                         get_id(io[k].lhs),
+                         get_id(io[k].rhs),
+                         get_id_cat(io[k].lhs),
+                         get_id_cat(io[k].rhs));
+  }
+  for (auto k = attr_begin[pos]; k < attr_begin[pos + 1]; ++k) {
+    view.attr.emplace_back(true,
+                           get_id(attr[k].lhs),
+                           get_id(attr[k].rhs),
+                           get_id_cat(attr[k].lhs),
+                           get_id_cat(attr[k].rhs));
+  }
+}
+
+bool Hif_design::write(std::string_view dname, const Hif_write::Options &opt) const {
+  auto wr = Hif_write::create(dname, tool, version, opt);
+  if (wr == nullptr)
+    return false;
+
+  Statement_view view;
+  for (auto i = 0u; i < size(); ++i) {
+    get_view(i, view);
+    wr->add(view);
+  }
+
+  return wr->close();
+}
+
+size_t Hif_design::memory_bytes() const {
+  return sclass.capacity() * sizeof(uint8_t) + type.capacity() * sizeof(uint16_t)
+         + instance.capacity() * sizeof(uint32_t)
+         + (io_begin.capacity() + attr_begin.capacity()) * sizeof(uint32_t)
+         + (io.capacity() + attr.capacity()) * sizeof(Entry) + io_input.capacity()
+         + ids.capacity() * sizeof(std::string_view) + id_cat.capacity() + arena_bytes;
+}
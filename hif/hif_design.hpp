@@ -0,0 +1,131 @@
+//  This file is distributed under the BSD 3-Clause License. See LICENSE for details.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "hif_base.hpp"
+#include "hif_write.hpp"
+
+// Whole design in memory as structure of arrays. Every ID is stored once in a design
+// wide table and statements refer to it by position, so a pin costs 9 bytes (lhs, rhs
+// and direction) instead of a Tuple_entry with two std::string.
+class Hif_design : public Hif_base {
+public:
+  static constexpr uint32_t no_id = UINT32_MAX;
+
+  struct Entry {
+    uint32_t lhs;  // position in the ID table, no_id if missing
+    uint32_t rhs;
+  };
+
+  // Loads every statement of dname (HIF header excluded)
+  static std::shared_ptr<Hif_design> open(std::string_view dname);
+
+  // Writes the statements through Hif_write (no Statement is created). False if a
+  // file was not written (see Hif_write::close).
+  bool write(std::string_view dname,
+             const Hif_write::Options &opt = Hif_write::Options()) const;
+
+  class Stmt {
+  public:
+    Stmt(const Hif_design *_design, size_t _pos) : design(_design), pos(_pos) {}
+
+    size_t get_pos() const { return pos; }
+
+    Statement_class get_class() const {
+      return static_cast<Statement_class>(design->sclass[pos]);
+    }
+    uint16_t get_type() const { return design->type[pos]; }
+    uint32_t get_instance() const { return design->instance[pos]; }
+
+    std::span<const Entry> get_io() const {
+      auto b = design->io_begin[pos];
+      return {design->io.data() + b, design->io_begin[pos + 1] - b};
+    }
+    // k is the position in get_io
+    bool is_input(size_t k) const { return design->io_input[design->io_begin[pos] + k]; }
+
+    std::span<const Entry> get_attr() const {
+      auto b = design->attr_begin[pos];
+      return {design->attr.data() + b, design->attr_begin[pos + 1] - b};
+    }
+
+  private:
+    const Hif_design *design;
+    size_t            pos;
+  };
+
+  class iterator {
+  public:
+    iterator(const Hif_design *_design, size_t _pos) : design(_design), pos(_pos) {}
+
+    Stmt      operator*() const { return Stmt(design, pos); }
+    iterator &operator++() {
+      ++pos;
+      return *this;
+    }
+    bool operator!=(const iterator &o) const { return pos != o.pos; }
+    bool operator==(const iterator &o) const { return pos == o.pos; }
+
+  private:
+    const Hif_design *design;
+    size_t            pos;
+  };
+
+  iterator begin() const { return iterator(this, 0); }
+  iterator end() const { return iterator(this, size()); }
+  Stmt     operator[](size_t pos) const { return Stmt(this, pos); }
+
+  size_t size() const { return sclass.size(); }
+
+  size_t           get_num_ids() const { return ids.size(); }
+  std::string_view get_id(uint32_t id) const { return id == no_id ? "" : ids[id]; }
+  ID_cat           get_id_cat(uint32_t id) const {
+    return id == no_id ? ID_cat::String_cat : static_cast<ID_cat>(id_cat[id]);
+  }
+
+  // Fills view with statement pos (reusing its capacity)
+  void get_view(size_t pos, Statement_view &view) const;
+
+  std::string_view get_tool() const { return tool; }
+  std::string_view get_version() const { return version; }
+
+  // Bytes allocated by the statement and ID storage
+  size_t memory_bytes() const;
+
+protected:
+  uint32_t intern(std::string_view txt, ID_cat cat);
+
+  std::vector<uint8_t>  sclass;
+  std::vector<uint16_t> type;
+  std::vector<uint32_t> instance;
+
+  std::vector<uint32_t> io_begin{0};  // size()+1, ranges in io/io_input
+  std::vector<Entry>    io;
+  std::vector<uint8_t>  io_input;
+  std::vector<uint32_t> attr_begin{0};
+  std::vector<Entry>    attr;
+
+  // ID table. The text lives in arena blocks that never move.
+  static constexpr size_t              arena_block = 1 << 20;  // largest block
+  std::vector<std::string_view>        ids;
+  std::vector<uint8_t>                 id_cat;
+  std::vector<std::unique_ptr<char[]>> arena;
+  char                                *arena_ptr   = nullptr;  // free part of last block
+  size_t                               arena_left  = 0;
+  size_t                               arena_bytes = 0;
+#ifdef USE_ABSL_MAP
+  absl::flat_hash_map<std::string_view, uint32_t> id2pos;  // only while loading
+#else
+  std::unordered_map<std::string_view, uint32_t> id2pos;
+#endif
+
+  std::string tool;
+  std::string version;
+};
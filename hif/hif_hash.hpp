@@ -0,0 +1,53 @@
+//  This file is distributed under the BSD 3-Clause License. See LICENSE for details.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+// 64 bit hash that is stable across runs, builds and little endian machines (unlike
+// std::hash or absl::Hash), so it can be stored in files. Not cryptographic.
+class Hif_hash {
+public:
+  static uint64_t hash64(const void *data, size_t sz, uint64_t seed = 0) {
+    auto    *ptr = static_cast<const uint8_t *>(data);
+    uint64_t h   = seed ^ (sz * k1);
+
+    for (; sz >= 8; sz -= 8, ptr += 8) {
+      uint64_t w;
+      memcpy(&w, ptr, 8);
+      h = rotl(h ^ (w * k2), 31) * k1;
+    }
+    if (sz) {
+      uint64_t w = 0;
+      memcpy(&w, ptr, sz);  // little endian tail, as the 8 byte loads
+      h = rotl(h ^ (w * k2), 31) * k1;
+    }
+
+    return mix(h);
+  }
+
+  static uint64_t hash64(std::string_view txt, uint64_t seed = 0) {
+    return hash64(txt.data(), txt.size(), seed);
+  }
+
+  // Order dependent combination (h is the running hash)
+  static uint64_t combine(uint64_t h, uint64_t v) { return mix(h ^ (v + k2 + (h << 6))); }
+
+private:
+  static constexpr uint64_t k1 = 0x9E3779B97F4A7C15ULL;
+  static constexpr uint64_t k2 = 0xC2B2AE3D27D4EB4FULL;
+
+  static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+  static uint64_t mix(uint64_t h) {  // murmur3 finalizer
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+  }
+};
@@ -0,0 +1,420 @@
+//  This file is distributed under the BSD 3-Clause License. See LICENSE for details.
+
+#include "hif_index.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "file_write.hpp"
+
+static constexpr uint8_t ix_magic[4] = {0xFF, 'H', 'I', 'X'};
+
+static uint32_t get32(const uint8_t *ptr) {
+  return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | (static_cast<uint32_t>(ptr[3]) << 24);
+}
+
+static uint64_t get64(const uint8_t *ptr) {
+  return get32(ptr) | (static_cast<uint64_t>(get32(ptr + 4)) << 32);
+}
+
+bool Hif_index::write(const std::string &fname) const {
+  auto fw = File_write::create(fname);
+  if (fw == nullptr) {
+    return false;
+  }
+
+  for (auto c : ix_magic) {
+    fw->add8(c);
+  }
+
+  fw->add32(ckpt_tag);
+  fw->add32(8 + 8 * checkpoints.size());
+  fw->add32(num_stmts);
+  fw->add32(stride);
+  for (auto off : checkpoints) {
+    fw->add32(off);
+    fw->add32(off >> 32);
+  }
+
+  auto nscopes = std::count_if(scopes.begin(), scopes.end(), [](const Scope &s) {
+    return s.end != 0 && s.span == 0;
+  });
+  if (nscopes) {
+    fw->add32(scop_tag);
+    fw->add32(16 * nscopes);
+    for (const auto &s : scopes) {
+      if (s.end == 0 || s.span)
+        continue;  // still open when the chunk was closed, or begins in another one
+      fw->add32(s.begin);
+      fw->add32(s.begin >> 32);
+      fw->add32(s.end);
+      fw->add32(s.end >> 32);
+    }
+  }
+
+  auto sig_bytes = [](const Module &m) {
+    size_t bytes = 4 + m.name.size() + 4;
+    for (const auto &p : m.ports) {
+      bytes += 1 + 4 + p.name.size();
+    }
+    return bytes;
+  };
+  auto add_sig = [&fw](const Module &m) {
+    fw->add32(m.name.size());
+    fw->add(m.name);
+    fw->add32(m.ports.size());
+    for (const auto &p : m.ports) {
+      fw->add8(p.input ? 1 : 0);
+      fw->add32(p.name.size());
+      fw->add(p.name);
+    }
+  };
+  auto entry_bytes = [&sig_bytes](const Module &m) { return 16 + sig_bytes(m); };
+  auto add_entry   = [this, &fw, &add_sig](const Module &m) {
+    const auto &s = scopes[m.scope];
+    fw->add32(s.begin);
+    fw->add32(s.begin >> 32);
+    fw->add32(s.end);
+    fw->add32(s.end >> 32);
+    add_sig(m);
+  };
+
+  std::vector<const Module *> closed;
+  std::vector<const Module *> cross;  // began in a previous chunk
+  size_t                      bytes       = 0;
+  size_t                      cross_bytes = 0;
+  for (const auto &m : modules) {
+    if (m.scope >= scopes.size() || scopes[m.scope].end == 0)
+      continue;
+    if (scopes[m.scope].span) {
+      cross.emplace_back(&m);
+      cross_bytes += 4 + entry_bytes(m) + 8;
+    } else {
+      closed.emplace_back(&m);
+      bytes += entry_bytes(m);
+    }
+  }
+  if (!closed.empty()) {
+    fw->add32(mhsh_tag);  // same order as MODS, older readers skip it
+    fw->add32(8 * closed.size());
+    for (const auto *m : closed) {
+      fw->add32(m->hash);
+      fw->add32(m->hash >> 32);
+    }
+
+    fw->add32(mods_tag);
+    fw->add32(bytes);
+    for (const auto *m : closed) {
+      add_entry(*m);
+    }
+  }
+  if (!cross.empty()) {  // u32 span, a MODS entry, u64 hash
+    fw->add32(xmod_tag);
+    fw->add32(cross_bytes);
+    for (const auto *m : cross) {
+      fw->add32(scopes[m->scope].span);
+      add_entry(*m);
+      fw->add32(m->hash);
+      fw->add32(m->hash >> 32);
+    }
+  }
+
+  std::vector<Scope>  open;
+  std::vector<Module> open_mods;
+  still_open(open, open_mods);
+  // u32 nscopes, {u32 span, u64 begin}*, {u32 scope, sig, u64 hash}*
+  if (!open.empty()) {
+    size_t open_bytes = 4 + 12 * open.size();
+    for (const auto &m : open_mods) {
+      open_bytes += 4 + sig_bytes(m) + 8;
+    }
+    fw->add32(open_tag);
+    fw->add32(open_bytes);
+    fw->add32(open.size());
+    for (const auto &sc : open) {
+      fw->add32(sc.span);
+      fw->add32(sc.begin);
+      fw->add32(sc.begin >> 32);
+    }
+    for (const auto &m : open_mods) {
+      fw->add32(m.scope);
+      add_sig(m);
+      fw->add32(m.hash);
+      fw->add32(m.hash >> 32);
+    }
+  }
+
+  return fw->flush_all();
+}
+
+// u32 size + text, false if it does not fit before end
+static bool get_str(const uint8_t *&ptr, const uint8_t *end, std::string &str) {
+  if (ptr + 4 > end)
+    return false;
+  auto sz = get32(ptr);
+  ptr += 4;
+  if (sz > static_cast<size_t>(end - ptr))
+    return false;
+  str.assign(reinterpret_cast<const char *>(ptr), sz);
+  ptr += sz;
+  return true;
+}
+
+// Def name and ports
+static bool get_sig(const uint8_t *&ptr, const uint8_t *end, Hif_index::Module &m) {
+  if (!get_str(ptr, end, m.name) || ptr + 4 > end)
+    return false;
+
+  auto nports = get32(ptr);
+  ptr += 4;
+  for (auto i = 0u; i < nports; ++i) {
+    Hif_index::Port p;
+    if (ptr >= end)
+      return false;
+    p.input = *ptr++ != 0;
+    if (!get_str(ptr, end, p.name))
+      return false;
+    m.ports.emplace_back(std::move(p));
+  }
+  return true;
+}
+
+// MODS entries, or XMOD ones (cross) with the span before and the hash after
+static bool read_modules(const uint8_t *ptr, const uint8_t *end, bool cross,
+                         std::vector<Hif_index::Module> &modules) {
+  while (ptr < end) {
+    Hif_index::Module m;
+    if (cross) {
+      if (ptr + 4 > end)
+        return false;
+      m.span = get32(ptr);
+      ptr += 4;
+    }
+    if (ptr + 16 > end)
+      return false;
+    m.begin = get64(ptr);
+    m.end   = get64(ptr + 8);
+    ptr += 16;
+    if (!get_sig(ptr, end, m))
+      return false;
+    if (cross) {
+      if (ptr + 8 > end)
+        return false;
+      m.hash = get64(ptr);
+      ptr += 8;
+    }
+    modules.emplace_back(std::move(m));
+  }
+
+  return true;
+}
+
+static bool read_open(const uint8_t *ptr, const uint8_t *end,
+                      std::vector<Hif_index::Scope>  &open,
+                      std::vector<Hif_index::Module> &mods) {
+  if (ptr + 4 > end)
+    return false;
+  auto nscopes = get32(ptr);
+  ptr += 4;
+  if (nscopes > static_cast<size_t>(end - ptr) / 12)
+    return false;
+  for (auto i = 0u; i < nscopes; ++i, ptr += 12) {
+    open.emplace_back(Hif_index::Scope{get64(ptr + 4), 0, get32(ptr)});
+  }
+
+  while (ptr < end) {
+    Hif_index::Module m;
+    if (ptr + 4 > end)
+      return false;
+    m.scope = get32(ptr);
+    ptr += 4;
+    if (m.scope >= nscopes || !get_sig(ptr, end, m) || ptr + 8 > end)
+      return false;
+    m.hash = get64(ptr);
+    ptr += 8;
+    mods.emplace_back(std::move(m));
+  }
+
+  return true;
+}
+
+void Hif_index::still_open(std::vector<Scope> &open, std::vector<Module> &mods) const {
+  std::vector<size_t> moved(scopes.size(), SIZE_MAX);
+  for (auto i = 0u; i < scopes.size(); ++i) {  // the open ones are the open_scopes stack
+    if (scopes[i].end == 0) {
+      moved[i] = open.size();
+      open.emplace_back(scopes[i]);
+    }
+  }
+  for (const auto &m : modules) {
+    if (m.scope < scopes.size() && moved[m.scope] != SIZE_MAX) {
+      mods.emplace_back(m);
+      mods.back().scope = moved[m.scope];
+    }
+  }
+}
+
+void Hif_index::carry(std::vector<Scope> &&open, std::vector<Module> &&mods) {
+  clear();
+  scopes  = std::move(open);
+  modules = std::move(mods);
+  for (auto i = 0u; i < scopes.size(); ++i) {
+    ++scopes[i].span;
+    open_scopes.emplace_back(i);
+  }
+  for (auto i = 0u; i < modules.size(); ++i) {
+    open_modules.emplace_back(i);
+  }
+}
+
+void Hif_index::next_chunk() {
+  std::vector<Scope>  open;
+  std::vector<Module> mods;
+  still_open(open, mods);
+  carry(std::move(open), std::move(mods));
+}
+
+void Hif_index::continue_from(const Hif_index &prev) {
+  auto open = prev.open_at_end;
+  auto mods = prev.modules_at_end;
+  for (auto &m : mods) {
+    if (m.scope >= open.size()) {  // corrupted OPEN section
+      clear();
+      return;
+    }
+  }
+  carry(std::move(open), std::move(mods));
+}
+
+void Hif_index::restart_chunk() {
+  num_stmts = 0;
+  checkpoints.clear();
+
+  size_t carried = 0;
+  while (carried < scopes.size() && scopes[carried].span) {
+    scopes[carried].end = 0;
+    ++carried;
+  }
+  scopes.resize(carried);
+  open_scopes.clear();
+  for (auto i = 0u; i < carried; ++i) {
+    open_scopes.emplace_back(i);
+  }
+}
+
+const Hif_index::Scope *Hif_index::find_scope(uint64_t begin) const {
+  auto it = std::lower_bound(scopes.begin(), scopes.end(), begin,
+                             [](const Scope &s, uint64_t b) { return s.begin < b; });
+  if (it == scopes.end() || it->begin != begin || it->end == 0)
+    return nullptr;
+
+  return &*it;
+}
+
+bool Hif_index::read(const std::string &fname) {
+  int fd = ::open(fname.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;  // optional file
+  }
+
+  struct stat sb;
+  if (fstat(fd, &sb) == -1 || sb.st_size == 0) {
+    close(fd);
+    return false;
+  }
+
+  auto ptr = static_cast<uint8_t *>(mmap(0, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0));
+  close(fd);
+  if (ptr == MAP_FAILED) {
+    return false;
+  }
+
+  bool ok = read(ptr, sb.st_size);
+
+  munmap(ptr, sb.st_size);
+
+  return ok;
+}
+
+bool Hif_index::read(const uint8_t *data, size_t sz) {
+  clear();
+
+  if (sz < sizeof(ix_magic) || memcmp(data, ix_magic, sizeof(ix_magic)) != 0) {
+    std::cerr << "Hif_index::read invalid index file\n";
+    return false;
+  }
+
+  const uint8_t *ptr     = data + sizeof(ix_magic);
+  const uint8_t *ptr_end = data + sz;
+  std::vector<uint64_t> hashes;
+  const uint8_t        *cross_ptr = nullptr;
+  const uint8_t        *cross_end = nullptr;
+
+  while (ptr + 8 <= ptr_end) {
+    auto tag   = get32(ptr);
+    auto bytes = get32(ptr + 4);
+    ptr += 8;
+    if (ptr + bytes > ptr_end) {
+      std::cerr << "Hif_index::read truncated section " << tag << "\n";
+      clear();
+      return false;
+    }
+
+    if (tag == ckpt_tag && bytes >= 8) {
+      num_stmts = get32(ptr);
+      stride    = get32(ptr + 4);
+      for (auto i = 8u; i + 8 <= bytes; i += 8) {
+        checkpoints.emplace_back(get64(ptr + i));
+      }
+    } else if (tag == scop_tag) {
+      for (auto i = 0u; i + 16 <= bytes; i += 16) {
+        scopes.emplace_back(Scope{get64(ptr + i), get64(ptr + i + 8)});
+      }
+    } else if (tag == mods_tag) {
+      if (!read_modules(ptr, ptr + bytes, false, modules)) {
+        std::cerr << "Hif_index::read corrupted module section\n";
+        clear();
+        return false;
+      }
+    } else if (tag == open_tag) {
+      if (!read_open(ptr, ptr + bytes, open_at_end, modules_at_end)) {
+        std::cerr << "Hif_index::read corrupted open scope section\n";
+        clear();
+        return false;
+      }
+    } else if (tag == xmod_tag) {
+      cross_ptr = ptr;
+      cross_end = ptr + bytes;
+    } else if (tag == mhsh_tag) {
+      for (auto i = 0u; i + 8 <= bytes; i += 8) {
+        hashes.emplace_back(get64(ptr + i));
+      }
+    }
+
+    ptr += bytes;
+  }
+
+  if (hashes.size() == modules.size()) {
+    for (auto i = 0u; i < modules.size(); ++i) {
+      modules[i].hash = hashes[i];
+    }
+  }
+
+  // They began in previous chunks, so they go first (file order of the defs)
+  std::vector<Module> cross;
+  if (cross_ptr && !read_modules(cross_ptr, cross_end, true, cross)) {
+    std::cerr << "Hif_index::read corrupted module section\n";
+    clear();
+    return false;
+  }
+  modules.insert(modules.begin(), std::make_move_iterator(cross.begin()),
+                 std::make_move_iterator(cross.end()));
+
+  return true;
+}
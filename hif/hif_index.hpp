@@ -0,0 +1,141 @@
+//  This file is distributed under the BSD 3-Clause License. See LICENSE for details.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "hif_hash.hpp"
+
+// Optional per chunk sidecar (N.ix). A small header followed by tagged sections, so
+// readers skip sections that they do not know and chunks without N.ix still work.
+//
+//   0xFF 'H' 'I' 'X'          magic (0xFF is not a valid .st or .id first byte)
+//   { u32 tag, u32 bytes, payload }*
+//
+// All the fields are little endian.
+class Hif_index {
+public:
+  static constexpr uint32_t ckpt_tag = 0x54504B43;  // "CKPT"
+  static constexpr uint32_t scop_tag = 0x504F4353;  // "SCOP"
+  static constexpr uint32_t mods_tag = 0x53444F4D;  // "MODS"
+  static constexpr uint32_t mhsh_tag = 0x4853484D;  // "MHSH"
+  static constexpr uint32_t xmod_tag = 0x444F4D58;  // "XMOD"
+  static constexpr uint32_t open_tag = 0x4E45504F;  // "OPEN"
+
+  // Statement k*stride starts at byte checkpoints[k] of N.st. Statement 0 is the
+  // first statement in the chunk (the HIF header in chunk 0).
+  uint32_t              num_stmts = 0;
+  uint32_t              stride    = 0;
+  std::vector<uint64_t> checkpoints;
+
+  // Scopes that begin and end in the chunk, sorted by begin (the N.st offset of the
+  // open_*/closed_* statement). end is the offset after the matching end statement.
+  // The writer keeps the ones that continue from previous chunks first.
+  struct Scope {
+    uint64_t begin;
+    uint64_t end  = 0;  // 0 while open
+    uint32_t span = 0;  // writer only, chunks back to the begin (not in SCOP if > 0)
+  };
+  std::vector<Scope>  scopes;
+  std::vector<size_t> open_scopes;  // writer only
+
+  // open_def/closed_def statements (modules, functions) by instance name. Same
+  // begin/end as their scope, and the def IO names as signature. hash covers every
+  // statement from the def to its end by ID text (not position), so the same module
+  // has the same hash in any design and run (0 if the N.ix has no MHSH section).
+  //
+  // A def listed in MODS begins and ends in the chunk. One that spans chunks is in the
+  // XMOD section of the chunk with its end: begin is an offset in the chunk span
+  // chunks before, end an offset in this one.
+  struct Port {
+    std::string name;
+    bool        input;
+  };
+  struct Module {
+    std::string       name;
+    uint64_t          begin = 0;
+    uint64_t          end   = 0;
+    std::vector<Port> ports;
+    uint64_t          hash  = 0;
+    uint32_t          span  = 0;
+    size_t            scope = SIZE_MAX;  // writer only, position in scopes
+  };
+  std::vector<Module> modules;
+  std::vector<size_t> open_modules;  // writer only
+
+  // Scopes still open at the end of the chunk (OPEN section, outermost first) and
+  // their defs (scope is the position in open_at_end, hash the running one). Only
+  // read, Hif_write::open_append continues the next chunk with them.
+  std::vector<Scope>  open_at_end;
+  std::vector<Module> modules_at_end;
+
+  explicit Hif_index(uint32_t _stride = 0) : stride(_stride) {}
+
+  void add_stmt(uint64_t offset) {
+    if (stride && (num_stmts % stride) == 0) {
+      checkpoints.emplace_back(offset);
+    }
+    ++num_stmts;
+  }
+
+  // Call before the open_scope of the def statement
+  void add_module(std::string_view name, std::vector<Port> &&ports) {
+    open_modules.emplace_back(modules.size());
+    modules.emplace_back(
+        Module{std::string(name), 0, 0, std::move(ports), 0, 0, scopes.size()});
+  }
+
+  // Statement hash (see Hif_write), added to every module that is open
+  bool in_module() const { return !open_modules.empty(); }
+  void add_hash(uint64_t h) {
+    for (auto m : open_modules) {
+      modules[m].hash = Hif_hash::combine(modules[m].hash, h);
+    }
+  }
+
+  void open_scope(uint64_t begin) {
+    open_scopes.emplace_back(scopes.size());
+    scopes.emplace_back(Scope{begin});
+  }
+  void close_scope(uint64_t end) {
+    if (open_scopes.empty())
+      return;  // opened in a chunk without N.ix (open_append)
+    if (!open_modules.empty() && modules[open_modules.back()].scope == open_scopes.back())
+      open_modules.pop_back();
+    scopes[open_scopes.back()].end = end;
+    open_scopes.pop_back();
+  }
+  // nullptr if no scope begins at offset or if it ends in another chunk
+  const Scope *find_scope(uint64_t begin) const;
+
+  // Between chunks of a writer: the scopes and modules still open (with their running
+  // hash) continue in the next chunk, one more chunk away from their begin
+  void next_chunk();
+  // Same state as next_chunk after the chunk of prev (read from its N.ix)
+  void continue_from(const Hif_index &prev);
+  // Back to the first statement of the chunk, keeping what continues from the
+  // previous chunks (the rank_short_refs rewrite tracks the statements again)
+  void restart_chunk();
+
+  void clear() {
+    num_stmts = 0;
+    checkpoints.clear();
+    scopes.clear();
+    open_scopes.clear();
+    modules.clear();
+    open_modules.clear();
+    open_at_end.clear();
+    modules_at_end.clear();
+  }
+
+  bool write(const std::string &fname) const;
+  bool read(const std::string &fname);
+  bool read(const uint8_t *data, size_t sz);
+
+protected:
+  void still_open(std::vector<Scope> &open, std::vector<Module> &mods) const;
+  void carry(std::vector<Scope> &&open, std::vector<Module> &&mods);
+};
@@ -0,0 +1,296 @@
+//  This file is distributed under the BSD 3-Clause License. See LICENSE for details.
+
+#include "hif_net_index.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "file_write.hpp"
+#include "hif_hash.hpp"
+
+static constexpr uint8_t nx_magic[4] = {0xFF, 'H', 'N', 'X'};
+
+static uint32_t get32(const uint8_t *ptr) {
+  return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | (static_cast<uint32_t>(ptr[3]) << 24);
+}
+
+// ID reference (short or long), false if it does not fit before ptr_end
+static bool read_ref(const uint8_t *&ptr, const uint8_t *ptr_end, uint32_t &ref) {
+  if (*ptr & 1) {
+    ref = *ptr++;
+    return true;
+  }
+  if (ptr + 3 > ptr_end)
+    return false;
+  ref = ptr[0] | (ptr[1] << 8) | (ptr[2] << 16);
+  ptr += 3;
+  return true;
+}
+
+// (pos, stmt) pairs to CSR, keeping the statement order inside each position
+static void to_csr(const std::vector<std::pair<uint32_t, uint32_t>> &pairs,
+                   uint32_t num_ids, std::vector<uint32_t> &off,
+                   std::vector<uint32_t> &vals) {
+  off.assign(num_ids + 1, 0);
+  for (const auto &[pos, stmt] : pairs) {
+    ++off[pos + 1];
+  }
+  for (auto i = 0u; i < num_ids; ++i) {
+    off[i + 1] += off[i];
+  }
+
+  vals.resize(pairs.size());
+  std::vector<uint32_t> next(off.begin(), off.end() - 1);
+  for (const auto &[pos, stmt] : pairs) {
+    vals[next[pos]++] = stmt;
+  }
+}
+
+// Text of the N.id entry at off, false if it does not fit
+static bool id_text(const uint8_t *id, size_t id_sz, size_t off, std::string_view &txt,
+                    size_t &next) {
+  if (off >= id_sz)
+    return false;
+  const uint8_t *ptr = id + off;
+  uint32_t       sz  = *ptr >> 4;
+  if (*ptr & 0x08) {  // small
+    ++off;
+  } else {
+    if (off + 3 > id_sz)
+      return false;
+    sz |= (ptr[1] | (ptr[2] << 8)) << 4;
+    off += 3;
+  }
+  if (sz > id_sz - off)
+    return false;
+
+  txt  = std::string_view(reinterpret_cast<const char *>(id) + off, sz);
+  next = off + sz;
+  return true;
+}
+
+bool Hif_net_index::build_ids(const uint8_t *id, size_t sz) {
+  id_slots.clear();
+  has_id_table = false;
+
+  std::vector<std::pair<uint32_t, uint64_t>> ents;  // id_off, hash
+  std::string_view                           txt;
+  for (size_t off = 0, next; off < sz; off = next) {
+    if (!id_text(id, sz, off, txt, next)) {
+      std::cerr << "Hif_net_index::build_ids corrupted ID " << ents.size() << "\n";
+      return false;
+    }
+    ents.emplace_back(off, Hif_hash::hash64(txt));
+  }
+
+  size_t slots = ents.empty() ? 0 : 2;
+  while (slots < 2 * ents.size()) {
+    slots *= 2;
+  }
+  id_slots.assign(2 * slots, UINT32_MAX);
+  for (auto pos = 0u; pos < ents.size(); ++pos) {  // first use order, so first wins
+    auto slot = ents[pos].second & (slots - 1);
+    while (id_slots[2 * slot] != UINT32_MAX) {
+      slot = (slot + 1) & (slots - 1);
+    }
+    id_slots[2 * slot]     = pos;
+    id_slots[2 * slot + 1] = ents[pos].first;
+  }
+
+  has_id_table = true;
+  return true;
+}
+
+uint32_t Hif_net_index::find_id(std::string_view txt, const uint8_t *id,
+                                size_t id_sz) const {
+  auto slots = id_slots.size() / 2;
+  if (slots == 0)
+    return UINT32_MAX;
+
+  std::string_view cand;
+  size_t           next;
+  auto             slot = Hif_hash::hash64(txt) & (slots - 1);
+  for (size_t n = 0; n < slots && id_slots[2 * slot] != UINT32_MAX; ++n) {
+    if (id_text(id, id_sz, id_slots[2 * slot + 1], cand, next) && cand == txt)
+      return id_slots[2 * slot];
+    slot = (slot + 1) & (slots - 1);
+  }
+
+  return UINT32_MAX;
+}
+
+bool Hif_net_index::build(const uint8_t *st, size_t st_sz, const uint8_t *id,
+                          size_t id_sz) {
+  clear();
+
+  if (!build_ids(id, id_sz))
+    return false;
+
+  std::vector<std::pair<uint32_t, uint32_t>> drv;
+  std::vector<std::pair<uint32_t, uint32_t>> rd;
+
+  uint32_t       num_ids = 0;
+  uint32_t       stmt    = 0;
+  const uint8_t *ptr     = st;
+  const uint8_t *ptr_end = st + st_sz;
+  while (ptr < ptr_end) {
+    ptr += 2;  // cccc + type
+
+    uint32_t ref;
+    if (ptr >= ptr_end)
+      break;
+    if (*ptr == 0xFF) {
+      ++ptr;
+    } else if (!read_ref(ptr, ptr_end, ref)) {
+      break;
+    }
+
+    // io: lhs (not last) then rhs (last), or a single last ID
+    while (ptr < ptr_end && *ptr != 0xFF) {
+      if (!read_ref(ptr, ptr_end, ref))
+        break;
+      uint32_t pos = ref >> 3;
+      num_ids      = std::max(num_ids, pos + 1);
+      if (ref & 0x4) {  // last, pos is the net. Inputs read it, outputs drive it
+        (ref & 0x2 ? rd : drv).emplace_back(pos, stmt);
+      }
+    }
+    if (ptr >= ptr_end)
+      break;
+    ++ptr;
+
+    while (ptr < ptr_end && *ptr != 0xFF) {  // attrs
+      if (!read_ref(ptr, ptr_end, ref))
+        break;
+    }
+    if (ptr >= ptr_end)
+      break;
+    ++ptr;
+
+    ++stmt;
+  }
+
+  if (ptr != ptr_end) {
+    std::cerr << "Hif_net_index::build corrupted statement " << stmt << "\n";
+    return false;
+  }
+
+  to_csr(drv, num_ids, driver_off, drivers);
+  to_csr(rd, num_ids, reader_off, readers);
+
+  return true;
+}
+
+bool Hif_net_index::write(const std::string &fname) const {
+  auto fw = File_write::create(fname);
+  if (fw == nullptr) {
+    return false;
+  }
+
+  for (auto c : nx_magic) {
+    fw->add8(c);
+  }
+  fw->add32(get_num_ids());
+  fw->add32(drivers.size());
+  fw->add32(readers.size());
+  for (const auto *v : {&driver_off, &drivers, &reader_off, &readers}) {
+    for (auto x : *v) {
+      fw->add32(x);
+    }
+  }
+  if (has_id_table) {
+    fw->add32(id_slots.size() / 2);
+    for (auto x : id_slots) {
+      fw->add32(x);
+    }
+  }
+
+  return true;
+}
+
+bool Hif_net_index::read(const std::string &fname) {
+  clear();
+
+  int fd = ::open(fname.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;  // optional file
+  }
+
+  struct stat sb;
+  if (fstat(fd, &sb) == -1 || sb.st_size < 16) {
+    close(fd);
+    return false;
+  }
+
+  auto ptr = static_cast<uint8_t *>(mmap(0, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0));
+  close(fd);
+  if (ptr == MAP_FAILED) {
+    return false;
+  }
+
+  bool ok = read(ptr, sb.st_size);
+
+  munmap(ptr, sb.st_size);
+
+  if (!ok) {
+    std::cerr << "Hif_net_index::read invalid net index " << fname << "\n";
+  }
+
+  return ok;
+}
+
+bool Hif_net_index::read(const uint8_t *ptr, size_t sz) {
+  clear();
+
+  if (sz < 16)
+    return false;
+
+  auto num_ids = get32(ptr + 4);
+  auto ndrv    = get32(ptr + 8);
+  auto nrd     = get32(ptr + 12);
+
+  size_t csr_sz = 16 + 4 * (2 * (static_cast<size_t>(num_ids) + 1) + ndrv + nrd);
+  size_t slots  = sz >= csr_sz + 4 ? get32(ptr + csr_sz) : 0;
+
+  bool ok = memcmp(ptr, nx_magic, sizeof(nx_magic)) == 0
+            && (sz == csr_sz
+                || (sz == csr_sz + 4 + 8 * slots && (slots & (slots - 1)) == 0));
+  if (ok) {
+    const uint8_t *p = ptr + 16;
+    for (auto [v, n] : {std::pair(&driver_off, num_ids + 1),
+                        std::pair(&drivers, ndrv),
+                        std::pair(&reader_off, num_ids + 1),
+                        std::pair(&readers, nrd)}) {
+      v->resize(n);
+      for (auto &x : *v) {
+        x = get32(p);
+        p += 4;
+      }
+    }
+    for (auto i = 0u; ok && i < num_ids; ++i) {
+      ok = driver_off[i] <= driver_off[i + 1] && reader_off[i] <= reader_off[i + 1];
+    }
+    ok = ok && driver_off.back() == ndrv && reader_off.back() == nrd;
+
+    if (ok && sz > csr_sz) {
+      p += 4;
+      id_slots.resize(2 * slots);
+      for (auto &x : id_slots) {
+        x = get32(p);
+        p += 4;
+      }
+      has_id_table = true;
+    }
+  }
+
+  if (!ok)
+    clear();
+
+  return ok;
+}
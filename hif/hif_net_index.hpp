@@ -0,0 +1,71 @@
+//  This file is distributed under the BSD 3-Clause License. See LICENSE for details.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Net connectivity of one chunk (optional N.nx sidecar), indexed by ID position so
+// that no string is hashed. The net of an io entry is its rhs ID (or the lhs when
+// there is no rhs). Output entries drive the net, input entries read it.
+//
+//   0xFF 'H' 'N' 'X'          magic
+//   u32 num_ids, u32 num_drivers, u32 num_readers
+//   u32 driver_off[num_ids+1], u32 drivers[num_drivers]
+//   u32 reader_off[num_ids+1], u32 readers[num_readers]
+//   u32 slots, {u32 pos, u32 id_off}[slots]      ID table (older N.nx do not have it)
+//
+// drivers/readers are statement numbers in the chunk (0 is the first N.st statement)
+// in increasing order. The ID table finds the position of a net name without decoding
+// N.id: open addressing by Hif_hash of the ID text (linear probing, slots a power of
+// 2, pos 0xFFFFFFFF when empty), id_off is the N.id offset of the entry to compare
+// the text. All the fields are little endian.
+class Hif_net_index {
+public:
+  // One pass over the N.st bytes, and one over the N.id ones for the ID table
+  bool build(const uint8_t *st, size_t st_sz, const uint8_t *id, size_t id_sz);
+  // Only the ID table (for an N.nx without it)
+  bool build_ids(const uint8_t *id, size_t sz);
+  bool has_ids() const { return has_id_table; }
+  // Position of the ID with text txt, UINT32_MAX if the chunk does not have it. id is
+  // the N.id of the chunk (the table has offsets in it).
+  uint32_t find_id(std::string_view txt, const uint8_t *id, size_t id_sz) const;
+
+  bool write(const std::string &fname) const;
+  bool read(const std::string &fname);
+  bool read(const uint8_t *data, size_t sz);
+
+  std::span<const uint32_t> get_drivers(uint32_t pos) const {
+    if (pos + 1 >= driver_off.size())
+      return {};
+    return {drivers.data() + driver_off[pos], driver_off[pos + 1] - driver_off[pos]};
+  }
+  std::span<const uint32_t> get_readers(uint32_t pos) const {
+    if (pos + 1 >= reader_off.size())
+      return {};
+    return {readers.data() + reader_off[pos], reader_off[pos + 1] - reader_off[pos]};
+  }
+
+  size_t get_num_ids() const { return driver_off.empty() ? 0 : driver_off.size() - 1; }
+
+  void clear() {
+    driver_off.clear();
+    drivers.clear();
+    reader_off.clear();
+    readers.clear();
+    id_slots.clear();
+    has_id_table = false;
+  }
+
+protected:
+  std::vector<uint32_t> driver_off;
+  std::vector<uint32_t> drivers;
+  std::vector<uint32_t> reader_off;
+  std::vector<uint32_t> readers;
+  std::vector<uint32_t> id_slots;  // pos, id_off per slot
+  bool                  has_id_table = false;
+};
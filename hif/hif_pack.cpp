@@ -0,0 +1,398 @@
+//  This file is distributed under the BSD 3-Clause License. See LICENSE for details.
+
+#include "hif_pack.hpp"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "file_write.hpp"
+
+static constexpr uint8_t pk_magic[4] = {0xFF, 'H', 'P', 'K'};
+
+static uint32_t get32(const uint8_t *ptr) {
+  return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | (static_cast<uint32_t>(ptr[3]) << 24);
+}
+
+static uint64_t get64(const uint8_t *ptr) {
+  return get32(ptr) | (static_cast<uint64_t>(get32(ptr + 4)) << 32);
+}
+
+// Chunk number, then extension (N.id, N.ix, N.nx, N.st)
+static bool chunk_order(const std::string &a, const std::string &b) {
+  auto na = std::stoull(a);
+  auto nb = std::stoull(b);
+  return na < nb || (na == nb && a < b);
+}
+
+std::shared_ptr<Hif_pack> Hif_pack::open(std::string_view fname) {
+  std::string name(fname.data(), fname.size());
+
+  int fd = ::open(name.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return nullptr;
+  }
+
+  struct stat sb;
+  if (fstat(fd, &sb) == -1 || !S_ISREG(sb.st_mode) || sb.st_size < 16) {
+    close(fd);
+    return nullptr;
+  }
+
+  auto ptr = static_cast<uint8_t *>(mmap(0, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0));
+  close(fd);
+  if (ptr == MAP_FAILED) {
+    std::cerr << "Hif_pack could not mmap " << fname << "\n";
+    return nullptr;
+  }
+
+  auto pk = std::make_shared<Hif_pack>(ptr, sb.st_size);
+  if (!pk->read_table()) {
+    return nullptr;
+  }
+
+  return pk;
+}
+
+bool Hif_pack::is_pack(std::string_view fname) {
+  std::string name(fname.data(), fname.size());
+
+  int fd = ::open(name.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  uint8_t magic[sizeof(pk_magic)];
+  bool    ok = ::read(fd, magic, sizeof(magic)) == sizeof(magic)
+            && memcmp(magic, pk_magic, sizeof(magic)) == 0;
+  close(fd);
+
+  return ok;
+}
+
+Hif_pack::~Hif_pack() {
+  if (base) {
+    munmap(base, size);
+  }
+}
+
+bool Hif_pack::read_table() {
+  if (memcmp(base, pk_magic, sizeof(pk_magic)) != 0) {
+    return false;
+  }
+
+  auto version   = get32(base + 4);
+  auto num_files = get32(base + 8);
+  if (version != 1 || 16 + static_cast<size_t>(num_files) * entry_size > size) {
+    std::cerr << "Hif_pack invalid header\n";
+    return false;
+  }
+
+  files.reserve(num_files);
+  name2file.reserve(num_files);
+
+  const uint8_t *ent = base + 16;
+  for (auto i = 0u; i < num_files; ++i, ent += entry_size) {
+    auto off = get64(ent + name_size);
+    auto sz  = get64(ent + name_size + 8);
+    if (off > size || sz > size - off) {
+      std::cerr << "Hif_pack file " << i << " out of range\n";
+      files.clear();
+      name2file.clear();
+      return false;
+    }
+
+    auto            *txt = reinterpret_cast<const char *>(ent);
+    std::string_view name(txt, strnlen(txt, name_size));
+    if (!is_chunk_file(name)) {  // the readers parse the chunk number
+      std::cerr << "Hif_pack file " << i << " has an invalid name\n";
+      files.clear();
+      name2file.clear();
+      return false;
+    }
+    name2file.try_emplace(name, static_cast<uint32_t>(files.size()));
+    files.emplace_back(File{name, base + off, sz});
+  }
+
+  return true;
+}
+
+const Hif_pack::File *Hif_pack::find(std::string_view name) const {
+  // Called per chunk file when opening, a scan would make that O(chunks^2)
+  auto it = name2file.find(name);
+  if (it == name2file.end())
+    return nullptr;
+  return &files[it->second];
+}
+
+// Chunk files of dname from chunk first, mapped, in chunk order
+bool Hif_pack::map_dir(const std::string &dname, uint32_t first, std::vector<Src> &srcs) {
+  DIR *dir = opendir(dname.c_str());
+  if (dir == nullptr) {
+    std::cerr << "Hif_pack could not open directory " << dname << "\n";
+    return false;
+  }
+
+  std::vector<std::string> names;
+  struct dirent           *dirp;
+  while ((dirp = readdir(dir)) != NULL) {
+    std::string_view sv(dirp->d_name, strlen(dirp->d_name));
+    if (is_chunk_file(sv) && sv.size() < name_size
+        && std::stoull(std::string(sv)) >= first) {
+      names.emplace_back(sv);
+    }
+  }
+  closedir(dir);
+
+  std::sort(names.begin(), names.end(), chunk_order);
+
+  for (auto &name : names) {
+    auto path = dname + "/" + name;
+    int  fd   = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+    Src         src{std::move(name), nullptr, 0, true};
+    struct stat sb;
+    if (fstat(fd, &sb) == 0 && sb.st_size > 0) {
+      auto ptr = mmap(0, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (ptr == MAP_FAILED) {
+        close(fd);
+        return false;
+      }
+      src.data = static_cast<uint8_t *>(ptr);
+      src.size = sb.st_size;
+    }
+    close(fd);
+    srcs.emplace_back(std::move(src));
+  }
+
+  return true;
+}
+
+void Hif_pack::unmap(std::vector<Src> &srcs) {
+  for (const auto &src : srcs) {
+    if (src.mapped && src.data)
+      munmap(const_cast<uint8_t *>(src.data), src.size);
+  }
+  srcs.clear();
+}
+
+// Through fname.part, renamed when complete
+bool Hif_pack::write(const std::vector<Src> &srcs, std::string_view fname) {
+  std::string part(fname.data(), fname.size());
+  part += ".part";
+
+  auto fw = File_write::create(part);
+  if (fw == nullptr)
+    return false;
+
+  for (auto c : pk_magic) {
+    fw->add8(c);
+  }
+  fw->add32(1);
+  fw->add32(srcs.size());
+  fw->add32(align);
+
+  uint64_t off = aligned(16 + srcs.size() * entry_size);
+  for (const auto &src : srcs) {
+    std::string name = src.name;
+    name.resize(name_size, '\0');
+    fw->add(name);
+    fw->add32(off);
+    fw->add32(off >> 32);
+    fw->add32(src.size);
+    fw->add32(static_cast<uint64_t>(src.size) >> 32);
+    off = aligned(off + src.size);
+  }
+
+  std::string pad;
+  for (const auto &src : srcs) {
+    pad.assign(aligned(fw->get_pos()) - fw->get_pos(), '\0');
+    fw->add(pad);
+    fw->add(std::string_view(reinterpret_cast<const char *>(src.data), src.size));
+  }
+  bool ok = fw->flush_all();
+  fw      = nullptr;  // close
+  if (!ok) {
+    std::cerr << "Hif_pack could not write " << part << "\n";
+    remove(part.c_str());
+    return false;
+  }
+
+  std::string to(fname.data(), fname.size());
+  if (rename(part.c_str(), to.c_str()) != 0) {
+    std::cerr << "Hif_pack could not rename " << part << " to " << fname << "\n";
+    return false;
+  }
+
+  return true;
+}
+
+// Chunk files of dname, then dname
+void Hif_pack::remove_files(const std::string &dname) {
+  DIR *dir = opendir(dname.c_str());
+  if (dir == nullptr)
+    return;
+  struct dirent *dirp;
+  while ((dirp = readdir(dir)) != NULL) {
+    std::string_view sv(dirp->d_name, strlen(dirp->d_name));
+    if (is_chunk_file(sv))
+      remove((dname + "/" + std::string(sv)).c_str());
+  }
+  closedir(dir);
+  rmdir(dname.c_str());
+}
+
+bool Hif_pack::pack(std::string_view dname, std::string_view fname, bool remove_dir) {
+  std::string      sname(dname.data(), dname.size());
+  std::vector<Src> srcs;
+
+  bool ok = map_dir(sname, 0, srcs) && write(srcs, fname);
+  if (!ok)
+    std::cerr << "Hif_pack could not pack " << dname << " to " << fname << "\n";
+  unmap(srcs);
+
+  if (ok && remove_dir)
+    remove_files(sname);
+
+  return ok;
+}
+
+bool Hif_pack::append(std::string_view dname, std::string_view fname, uint32_t first,
+                      bool remove_dir) {
+  std::string sname(dname.data(), dname.size());
+  std::string pname(fname.data(), fname.size());
+
+  auto pk = open(fname);
+  if (pk == nullptr) {
+    std::cerr << "Hif_pack " << fname << " is not a HIF pack\n";
+    return false;
+  }
+
+  // Pack files before chunk first, then the dname ones. Packs are in chunk order, so
+  // the kept files are a prefix of the table.
+  std::vector<Src>      srcs;
+  std::vector<uint64_t> offs;
+  for (const auto &f : pk->get_files()) {
+    if (std::stoull(std::string(f.name)) >= first)
+      break;
+    srcs.emplace_back(Src{std::string(f.name), f.data, f.size, false});
+    offs.emplace_back(f.data - pk->base);
+  }
+  auto nkept = srcs.size();
+  bool ok    = map_dir(sname, first, srcs);
+
+  // In place when the new table fits before the first kept file. The new files go
+  // after the end of the pack, so the old table stays valid (and the mapped bytes of
+  // other readers do not change) until the table is written. The replaced files are
+  // left as dead space, packed again once that is more than the live bytes.
+  auto     table_end = aligned(16 + srcs.size() * entry_size);
+  uint64_t live      = table_end;
+  for (const auto &src : srcs) {
+    live += aligned(src.size);
+  }
+  auto data_start = nkept ? *std::min_element(offs.begin(), offs.end()) : 0;
+  uint64_t end = aligned(pk->size);
+  for (auto i = nkept; ok && i < srcs.size(); ++i) {
+    offs.emplace_back(end);
+    end = aligned(end + srcs[i].size);
+  }
+  bool in_place = ok && nkept && table_end <= data_start && end <= 2 * live;
+
+  if (in_place) {
+    std::string table;
+    auto        put32 = [&table](uint32_t v) {
+      for (int k = 0; k < 4; ++k) {
+        table.push_back(static_cast<char>(v >> (8 * k)));
+      }
+    };
+    table.append(reinterpret_cast<const char *>(pk_magic), sizeof(pk_magic));
+    put32(1);
+    put32(srcs.size());
+    put32(align);
+    for (auto i = 0u; i < srcs.size(); ++i) {
+      std::string name = srcs[i].name;
+      name.resize(name_size, '\0');
+      table.append(name);
+      put32(offs[i]);
+      put32(offs[i] >> 32);
+      put32(srcs[i].size);
+      put32(static_cast<uint64_t>(srcs[i].size) >> 32);
+    }
+    table.resize(data_start, '\0');  // up to the first file
+
+    int  fd  = ::open(pname.c_str(), O_WRONLY);
+    auto put = [&ok, fd](const void *data, size_t sz, uint64_t at) {
+      auto *ptr = static_cast<const char *>(data);
+      while (ok && sz) {
+        auto n = pwrite(fd, ptr, sz, at);
+        ok     = n > 0;
+        if (ok) {
+          ptr += n;
+          sz -= n;
+          at += n;
+        }
+      }
+    };
+    ok = fd >= 0;
+
+    for (auto i = nkept; i < srcs.size(); ++i) {  // the gaps read as zeros
+      put(srcs[i].data, srcs[i].size, offs[i]);
+    }
+    if (ok)
+      ok = fdatasync(fd) == 0;  // the data is on disk before the table points to it
+    if (ok) {
+      auto n = pwrite(fd, table.data(), table.size(), 0);
+      ok     = n == static_cast<ssize_t>(table.size());
+    }
+    if (fd >= 0)
+      close(fd);
+    if (!ok)
+      std::cerr << "Hif_pack could not append to " << fname << "\n";
+  } else if (ok) {
+    ok = write(srcs, fname);  // packed again
+    if (!ok)
+      std::cerr << "Hif_pack could not pack " << dname << " to " << fname << "\n";
+  }
+  unmap(srcs);
+  pk = nullptr;
+
+  if (ok && remove_dir)
+    remove_files(sname);
+
+  return ok;
+}
+
+bool Hif_pack::unpack(std::string_view fname, std::string_view dname, uint32_t first) {
+  auto pk = open(fname);
+  if (pk == nullptr) {
+    std::cerr << "Hif_pack " << fname << " is not a HIF pack\n";
+    return false;
+  }
+
+  std::string sname(dname.data(), dname.size());
+  mkdir(sname.c_str(), 0755);  // may exist
+
+  for (const auto &f : pk->get_files()) {
+    if (std::stoull(std::string(f.name)) < first)
+      continue;
+    auto fw = File_write::create(sname + "/" + std::string(f.name));
+    if (fw == nullptr) {
+      return false;
+    }
+    fw->add(std::string_view(reinterpret_cast<const char *>(f.data), f.size));
+    if (!fw->flush_all()) {
+      std::cerr << "Hif_pack could not write " << sname << "/" << f.name << "\n";
+      return false;
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,84 @@
+//  This file is distributed under the BSD 3-Clause License. See LICENSE for details.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "hif_base.hpp"
+
+// Single file HIF: the chunk files of a HIF directory (N.st, N.id and the N.ix/N.nx
+// sidecars) in one file, so a design is one inode and readers need one mmap.
+//
+//   0xFF 'H' 'P' 'K'          magic
+//   u32 version (1), u32 num_files, u32 align (4096)
+//   { char name[16], u64 offset, u64 size }[num_files]
+//   file data, each one starting at a multiple of align
+//
+// Names are zero padded and files are in chunk order. All the fields are little
+// endian. Hif_read::open and Hif_write::create detect packs (see Hif_write).
+class Hif_pack : public Hif_base {
+public:
+  struct File {
+    std::string_view name;
+    const uint8_t   *data;
+    size_t           size;
+  };
+
+  // nullptr if fname is not a readable pack
+  static std::shared_ptr<Hif_pack> open(std::string_view fname);
+  static bool                      is_pack(std::string_view fname);
+
+  // Directory layout to pack (through fname.part, renamed when complete). With
+  // remove_dir, the chunk files and the directory are removed once packed.
+  static bool pack(std::string_view dname, std::string_view fname,
+                   bool remove_dir = false);
+  // Pack to directory layout (dname is created if missing), only the files of chunks
+  // from first
+  static bool unpack(std::string_view fname, std::string_view dname,
+                     uint32_t first = 0);
+  // Replaces the files of chunks from first in pack fname with the dname ones (lower
+  // chunks in dname are ignored). In place when the table fits before the first kept
+  // file: the new files go after the end and the table is written last, so the cost
+  // is the new files and an interrupted append keeps the old pack. The replaced files
+  // stay as dead space, and the pack is written again (through fname.part) when that
+  // is more than the live bytes or the table does not fit.
+  static bool append(std::string_view dname, std::string_view fname, uint32_t first,
+                     bool remove_dir = false);
+
+  const std::vector<File> &get_files() const { return files; }
+  const File              *find(std::string_view name) const;  // O(1)
+
+  Hif_pack(uint8_t *_base, size_t _size) : base(_base), size(_size) {}
+  ~Hif_pack();
+
+protected:
+  static constexpr uint32_t align     = 4096;
+  static constexpr size_t   name_size = 16;
+  static constexpr size_t   entry_size = name_size + 16;
+
+  struct Src {
+    std::string    name;
+    const uint8_t *data;
+    size_t         size;
+    bool           mapped;  // by map_dir
+  };
+  static uint64_t aligned(uint64_t x) { return (x + align - 1) / align * align; }
+  static bool map_dir(const std::string &dname, uint32_t first, std::vector<Src> &srcs);
+  static void unmap(std::vector<Src> &srcs);
+  static bool write(const std::vector<Src> &srcs, std::string_view fname);
+  static void remove_files(const std::string &dname);
+
+  bool read_table();
+
+  uint8_t          *base;
+  size_t            size;
+  std::vector<File> files;
+
+  std::unordered_map<std::string_view, uint32_t> name2file;  // names point into base
+};
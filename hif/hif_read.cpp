@@ -12,9 +12,18 @@
 #include <cassert>
 #include <climits>
 #include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <iostream>
 #include <iterator>
-#include <algorithm>
+#include <mutex>
+
+#include "hif_checksum.hpp"
+#include "hif_codec.hpp"
+#include "hif_hash.hpp"
+#include "hif_scan.hpp"
+#include "thread_pool.hpp"
 
 std::shared_ptr<Hif_read> Hif_read::open(std::string_view fname) {
   auto ptr = std::make_shared<Hif_read>(fname);
@@ -22,42 +31,64 @@ std::shared_ptr<Hif_read> Hif_read::open(std::string_view fname) {
   return ptr->is_ok() ? ptr : nullptr;
 }
 
-Hif_read::Hif_read(std::string_view fname) {
-  std::string sname(fname.data(), fname.size());
-
-  const char *path = sname.c_str();
+std::shared_ptr<Hif_read> Hif_read::open(std::string_view fname, const Options &opt) {
+  auto ptr = open(fname);
+  if (ptr == nullptr)
+    return nullptr;
 
-  DIR *dir = opendir(path);
-  if (dir == nullptr) {
-    return;
+  if (opt.verify && !ptr->verify(opt.verify_threads, nullptr, opt.allow_missing_ck)) {
+    std::cerr << "Hif_read::open " << fname << " failed verification\n";
+    return nullptr;
   }
 
-  struct dirent *dirp;
-
-  while ((dirp = readdir(dir)) != NULL) {
-    std::string_view sv(dirp->d_name, strlen(dirp->d_name));
-    if (sv == ".." || sv == ".")
-      continue;
+  return ptr;
+}
 
-    bool unexpected_file = !std::isdigit(sv[0]) || sv.size() < 4;
-    auto end_sv          = sv.substr(sv.size() - 3);
-    if (!unexpected_file) {
-      unexpected_file = (end_sv != ".st" && end_sv != ".id");
-    }
+Hif_read::Hif_read(std::string_view fname) {
+  std::string sname(fname.data(), fname.size());
 
-    if (unexpected_file) {
-      continue;  // ignore unexpected files
-    }
+  auto add_file = [&](std::string_view sv) {
+    if (sv.size() < 4 || !std::isdigit(sv[0]))
+      return;  // ignore unexpected files
 
+    auto end_sv = sv.substr(sv.size() - 3);
     if (end_sv == ".id")
       idflist.push_back(sname + "/" + std::string(sv));
-    else
+    else if (end_sv == ".st")
       stflist.push_back(sname + "/" + std::string(sv));
+  };
+
+  struct stat sb;
+  if (stat(sname.c_str(), &sb) == 0 && S_ISREG(sb.st_mode)) {
+    pack = Hif_pack::open(sname);
+    if (pack == nullptr) {
+      std::cerr << "Hif_read::open " << fname << " is not a HIF pack\n";
+      return;
+    }
+    for (const auto &f : pack->get_files()) {
+      add_file(f.name);
+    }
+  } else {
+    DIR *dir = opendir(sname.c_str());
+    if (dir == nullptr) {
+      return;
+    }
+
+    struct dirent *dirp;
+    while ((dirp = readdir(dir)) != NULL) {
+      add_file(std::string_view(dirp->d_name, strlen(dirp->d_name)));
+    }
+    closedir(dir);
   }
-  closedir(dir);
 
-  std::sort(idflist.begin(), idflist.end());
-  std::sort(stflist.begin(), stflist.end());
+  // N.st/N.id pairs are ordered by the decimal N (10.st goes after 9.st)
+  auto chunk_order = [](const std::string &a, const std::string &b) {
+    auto na = chunk_number(a);
+    auto nb = chunk_number(b);
+    return na < nb || (na == nb && a < b);
+  };
+  std::sort(idflist.begin(), idflist.end(), chunk_order);
+  std::sort(stflist.begin(), stflist.end(), chunk_order);
 
   bool corrupted = stflist.size() != idflist.size();
   if (!corrupted) {
@@ -89,47 +120,35 @@ Hif_read::Hif_read(std::string_view fname) {
     return;
   }
 
-  filepos = 0;
-
   if (idflist.empty()) {
     return;
   }
 
-  read_idfile(idflist[0]);
+  open_chunk(0);
 
-  std::tie(ptr_base, ptr_size, ptr_fd) = open_file(stflist[0]);
-  if (ptr_base == nullptr) {
+  Statement_view stmt;
+  if (!cur.next_stmt(stmt)) {
+    std::cerr << "Hif_read empty HIF header chunk " << stflist[0] << "\n";
     idflist.clear();
     return;
   }
 
-  ptr     = ptr_base;
-  ptr_end = ptr_base + ptr_size;
-
-  Statement stmt;
-
-  ptr = read_header(ptr, ptr_end, stmt);
-  ptr = read_te(ptr, ptr_end, stmt.io);
-  ptr = read_te(ptr, ptr_end, stmt.attr);
-
   if (stmt.attr.size() != 3) {
-    munmap(ptr_base, ptr_size);
-    close(ptr_fd);
     std::cerr << "Hif_read invalid HIF header " << fname << "\n";
-    stmt.dump();
+    stmt.to_statement().dump();
     idflist.clear();
     return;
   }
 
   if (stmt.attr[0].lhs != "HIF" || stmt.attr[0].rhs != hif_version) {
     std::cerr << "Hif_read unsupported HIF version " << fname << "\n";
-    stmt.dump();
+    stmt.to_statement().dump();
     idflist.clear();
     return;
   }
   if (stmt.attr[1].lhs != "tool" || stmt.attr[2].lhs != "version") {
     std::cerr << "Hif_read missing tool/version attributes " << fname << "\n";
-    stmt.dump();
+    stmt.to_statement().dump();
     idflist.clear();
     return;
   }
@@ -139,11 +158,528 @@ Hif_read::Hif_read(std::string_view fname) {
 }
 
 Hif_read::~Hif_read() {
-  munmap(ptr_base, ptr_size);
-  close(ptr_fd);
+  for (auto [ptr, sz, fd] : net_ids) {
+    close_file(ptr, sz, fd);
+  }
+}
+
+uint64_t Hif_read::chunk_number(const std::string &path) {
+  auto pos = path.find_last_of('/');
+  pos      = pos == std::string::npos ? 0 : pos + 1;
+
+  uint64_t num = 0;
+  while (pos < path.size() && std::isdigit(path[pos])) {
+    num = num * 10 + (path[pos] - '0');
+    ++pos;
+  }
+
+  return num;
+}
+
+void Hif_read::open_chunk(size_t chunk) {
+  filepos = chunk;
+
+  cur.open(*this, chunk);
+}
+
+void Hif_read::load_index() {
+  if (!chunk_index.empty())
+    return;
+
+  chunk_index.resize(stflist.size());
+  for (auto i = 0u; i < stflist.size(); ++i) {
+    auto ixfile = stflist[i].substr(0, stflist[i].size() - 3) + ".ix";
+    if (pack) {
+      auto *f = pack->find(ixfile.substr(ixfile.rfind('/') + 1));
+      if (f)
+        chunk_index[i].read(f->data, f->size);
+    } else {
+      chunk_index[i].read(ixfile);  // optional, stride stays 0 if missing
+    }
+  }
+}
+
+uint64_t Hif_read::statement_count() {
+  assert(is_ok());
+
+  if (!chunk_first.empty())
+    return chunk_first.back();
+
+  load_index();
+
+  uint64_t total = 0;
+  chunk_first.resize(stflist.size() + 1);
+  for (auto i = 0u; i < stflist.size(); ++i) {
+    chunk_first[i] = total;
+
+    auto &ix = chunk_index[i];
+    if (ix.stride == 0) {  // no N.ix, count by scanning
+      auto [ptr, sz, fd] = open_file(stflist[i]);
+      ix.num_stmts       = ptr ? Hif_scan::count(ptr, ptr + sz) : 0;
+      close_file(ptr, sz, fd);
+    }
+
+    total += ix.num_stmts;
+    if (i == 0 && total)
+      total -= 1;  // HIF header
+  }
+  chunk_first.back() = total;
+
+  return total;
+}
+
+uint64_t Hif_read::content_hash() const {
+  assert(is_ok());
+
+  uint64_t h = 0;
+  for (auto i = 0u; i < stflist.size(); ++i) {
+    for (const auto *file : {&stflist[i], &idflist[i]}) {
+      auto [ptr, sz, fd] = open_file(*file);
+      h                  = Hif_hash::combine(h, Hif_hash::hash64(ptr, sz));
+      close_file(ptr, sz, fd);
+    }
+  }
+
+  return h;
+}
+
+uint64_t Hif_read::file_stamp() const {
+  assert(is_ok());
+
+  auto stamp = [](uint64_t h, const std::string &fname) {
+    struct stat sb;
+    if (stat(fname.c_str(), &sb) != 0)
+      return Hif_hash::combine(h, 0);
+#ifdef __APPLE__
+    const auto &mt = sb.st_mtimespec;
+#else
+    const auto &mt = sb.st_mtim;
+#endif
+    uint64_t v[4] = {static_cast<uint64_t>(sb.st_size),
+                     static_cast<uint64_t>(mt.tv_sec),
+                     static_cast<uint64_t>(mt.tv_nsec),
+                     static_cast<uint64_t>(sb.st_ino)};
+    return Hif_hash::combine(h, Hif_hash::hash64(v, sizeof(v)));
+  };
+
+  if (pack)  // the lists have pack/N.st names
+    return stflist.empty() ? 0 : stamp(0, stflist[0].substr(0, stflist[0].rfind('/')));
+
+  uint64_t h = 0;
+  for (auto i = 0u; i < stflist.size(); ++i) {
+    h = stamp(stamp(h, stflist[i]), idflist[i]);
+  }
+
+  return h;
+}
+
+bool Hif_read::verify(unsigned nthreads, uint64_t *bytes, bool allow_missing) const {
+  assert(is_ok());
+
+  struct File {
+    std::string               name;
+    uint8_t                  *ptr;
+    size_t                    sz;
+    int                       fd;
+    const Hif_checksum::File *crcs;
+    uint32_t                  block;
+  };
+  struct Task {
+    uint32_t file;
+    uint32_t num;  // block
+  };
+
+  std::vector<Hif_checksum> sums(stflist.size());
+  std::vector<File>         files;
+  std::vector<Task>         tasks;
+  bool                      ok = true;
+
+  if (bytes)
+    *bytes = 0;
+
+  for (auto i = 0u; i < stflist.size(); ++i) {
+    auto ckfile = stflist[i].substr(0, stflist[i].size() - 3) + ".ck";
+    bool exists = false;
+    bool found  = false;
+    if (pack) {
+      auto *f = pack->find(ckfile.substr(ckfile.rfind('/') + 1));
+      exists  = f != nullptr;
+      found   = exists && sums[i].read(f->data, f->size);
+    } else {
+      exists = access(ckfile.c_str(), F_OK) == 0;
+      found  = exists && sums[i].read(ckfile);
+    }
+    if (!found) {
+      if (exists) {
+        std::cerr << "Hif_read::verify invalid checksum file " << ckfile << "\n";
+        ok = false;
+      } else if (!allow_missing) {
+        std::cerr << "Hif_read::verify missing checksum file " << ckfile << "\n";
+        ok = false;
+      }
+      continue;
+    }
+
+    for (auto *f : {&sums[i].st, &sums[i].id}) {
+      const auto &name = f == &sums[i].st ? stflist[i] : idflist[i];
+
+      auto [ptr, sz, fd] = open_file(name, true);
+      if (sz != f->size) {
+        std::cerr << "Hif_read::verify " << name << " has " << sz << " bytes, expected "
+                  << f->size << "\n";
+        ok = false;
+        close_file(ptr, sz, fd);
+        continue;
+      }
+      for (auto num = 0u; num < f->crcs.size(); ++num) {
+        tasks.emplace_back(Task{static_cast<uint32_t>(files.size()), num});
+      }
+      files.emplace_back(File{name, ptr, sz, fd, f, sums[i].block});
+      if (bytes)
+        *bytes += sz;
+    }
+  }
+
+  std::vector<uint8_t> bad(tasks.size());
+  Thread_pool::run(tasks.size(), nthreads, [&](size_t i, unsigned) {
+    const auto &f = files[tasks[i].file];
+    bad[i] = !Hif_checksum::check_block(*f.crcs, f.block, f.ptr, f.sz, tasks[i].num);
+  });
+
+  for (auto i = 0u; i < tasks.size(); ++i) {
+    if (!bad[i])
+      continue;
+    const auto &f     = files[tasks[i].file];
+    uint64_t    begin = static_cast<uint64_t>(tasks[i].num) * f.block;
+    std::cerr << "Hif_read::verify " << f.name << " checksum mismatch in bytes [" << begin
+              << ", " << std::min<uint64_t>(begin + f.block, f.sz) << ")\n";
+    ok = false;
+  }
+
+  for (auto &f : files) {
+    close_file(f.ptr, f.sz, f.fd);
+  }
+
+  return ok;
 }
 
-std::tuple<uint8_t *, uint32_t, int> Hif_read::open_file(const std::string &file) {
+bool Hif_read::seek(uint64_t stmt_index) {
+  if (stmt_index > statement_count())
+    return false;
+
+  auto   it    = std::upper_bound(chunk_first.begin(), chunk_first.end() - 1, stmt_index);
+  size_t chunk = (it - chunk_first.begin()) - 1;
+
+  uint64_t local = stmt_index - chunk_first[chunk];
+  if (chunk == 0)
+    local += 1;  // HIF header
+
+  if (cur.num != chunk || cur.ptr_base == nullptr) {
+    open_chunk(chunk);
+  }
+  filepos    = chunk;
+  stop_chunk = SIZE_MAX;
+
+  const auto &ix = chunk_index[chunk];
+
+  cur.ptr_end   = cur.ptr_base + cur.ptr_size;
+  cur.ptr       = cur.ptr_base;
+  cur.corrupted = false;
+  if (ix.stride && !ix.checkpoints.empty()) {
+    auto k = std::min<uint64_t>(local / ix.stride, ix.checkpoints.size() - 1);
+    if (ix.checkpoints[k] < cur.ptr_size) {
+      cur.ptr = cur.ptr_base + ix.checkpoints[k];
+      local -= k * ix.stride;
+    }
+  }
+
+  while (local) {
+    if (!cur.next_stmt(cur_view))
+      return false;
+    --local;
+  }
+
+  return true;
+}
+
+uint64_t Hif_read::count_statements(uint64_t *class_count) {
+  assert(is_ok());
+
+  uint64_t total = 0;
+  for (auto i = 0u; i < stflist.size(); ++i) {
+    auto [ptr, sz, fd] = open_file(stflist[i]);
+    if (ptr == nullptr)
+      continue;
+
+    const uint8_t *start = ptr;
+    if (i == 0) {  // HIF header
+      uint64_t n = 1;
+      start      = Hif_scan::skip(ptr, ptr + sz, n);
+    }
+    total += Hif_scan::count(start, ptr + sz, class_count);
+
+    close_file(ptr, sz, fd);
+  }
+
+  return total;
+}
+
+uint64_t Hif_read::skip(uint64_t n) {
+  uint64_t left = n;
+  while (left) {
+    if (cur.ptr < cur.ptr_end) {
+      cur.ptr = const_cast<uint8_t *>(Hif_scan::skip(cur.ptr, cur.ptr_end, left));
+      continue;
+    }
+    if (!open_next_chunk())
+      break;
+  }
+  cur.stmt_ptr = nullptr;  // the current statement was not decoded
+
+  return n - left;
+}
+
+bool Hif_read::skip_scope() {
+  if (!is_scope_begin(cur_view.sclass) || cur.stmt_ptr == nullptr)
+    return false;
+
+  load_index();
+
+  const auto *scope = chunk_index[cur.num].find_scope(cur.stmt_ptr - cur.ptr_base);
+  if (scope && scope->end <= cur.ptr_size) {
+    cur.ptr      = cur.ptr_base + scope->end;
+    cur.stmt_ptr = nullptr;  // skipped already
+    return true;
+  }
+
+  // Not indexed (no N.ix, or it ends in a later chunk). The body is decoded, then the
+  // begin again, so the current statement is the scope begin as above.
+  auto   begin_num = cur.num;
+  auto   begin_off = cur.stmt_ptr - cur.ptr_base;
+  size_t depth     = 1;
+  while (depth && next_stmt()) {
+    if (is_scope_begin(cur_view.sclass)) {
+      ++depth;
+    } else if (cur_view.is_end()) {
+      --depth;
+    }
+  }
+
+  if (cur.num == begin_num && cur.ptr_base) {
+    auto *next    = cur.ptr;
+    bool  bad     = cur.corrupted;
+    cur.ptr       = cur.ptr_base + begin_off;
+    cur.corrupted = false;
+    cur.next_stmt(cur_view);
+    cur.ptr       = next;
+    cur.corrupted = bad;
+  } else {
+    scope_begin.open(*this, begin_num);  // keeps the begin chunk mapped for the view
+    scope_begin.ptr = scope_begin.ptr_base + begin_off;
+    scope_begin.next_stmt(cur_view);
+  }
+  cur.stmt_ptr = nullptr;
+
+  return true;
+}
+
+void Hif_read::each_module(
+    const std::function<void(size_t chunk, const Hif_index::Module &)> fn) {
+  load_index();
+
+  for (auto i = 0u; i < chunk_index.size(); ++i) {
+    for (const auto &m : chunk_index[i].modules) {
+      if (m.span <= i)
+        fn(i - m.span, m);
+    }
+  }
+}
+
+std::pair<uint32_t, uint32_t> Hif_read::find_module(std::string_view name) {
+  if (module_dir.empty()) {
+    load_index();
+    for (auto i = 0u; i < chunk_index.size(); ++i) {
+      const auto &mods = chunk_index[i].modules;
+      for (auto j = 0u; j < mods.size(); ++j) {
+        if (mods[j].span <= i)
+          module_dir.emplace(mods[j].name, std::make_pair(i, j));  // first def wins
+      }
+    }
+  }
+
+  auto it = module_dir.find(name);
+  if (it == module_dir.end())
+    return {UINT32_MAX, 0};
+
+  return it->second;
+}
+
+uint64_t Hif_read::get_module_hash(std::string_view name) {
+  auto [chunk, pos] = find_module(name);
+  if (chunk == UINT32_MAX)
+    return 0;
+
+  return chunk_index[chunk].modules[pos].hash;
+}
+
+bool Hif_read::open_module(std::string_view name) {
+  auto [chunk, pos] = find_module(name);
+  if (chunk == UINT32_MAX)
+    return false;
+
+  const auto &m     = chunk_index[chunk].modules[pos];
+  auto        first = chunk - m.span;
+
+  if (cur.num != first || cur.ptr_base == nullptr) {
+    open_chunk(first);
+  }
+  if (m.begin >= cur.ptr_size
+      || (m.span == 0 && (m.begin >= m.end || m.end > cur.ptr_size))) {
+    std::cerr << "Hif_read::open_module invalid range for " << name << "\n";
+    return false;
+  }
+  filepos     = first;
+  stop_chunk  = chunk;
+  stop_end    = m.end;
+  cur.ptr       = cur.ptr_base + m.begin;
+  cur.ptr_end   = cur.ptr_base + (m.span ? cur.ptr_size : m.end);
+  cur.corrupted = false;
+
+  return true;
+}
+
+bool Hif_read::build_net_index(unsigned nthreads) {
+  assert(is_ok());
+
+  net_index.clear();
+  net_index.resize(stflist.size());
+
+  std::atomic<bool> ok{true};
+  Thread_pool::run(stflist.size(), nthreads, [this, &ok](size_t i, unsigned) {
+    auto [ptr, sz, fd]      = open_file(stflist[i]);
+    auto [id, id_sz, id_fd] = open_file(idflist[i]);
+
+    auto nxfile = stflist[i].substr(0, stflist[i].size() - 3) + ".nx";
+    if (!net_index[i].build(ptr, sz, id, id_sz) || (!pack && !net_index[i].write(nxfile)))
+      ok = false;
+
+    close_file(ptr, sz, fd);
+    close_file(id, id_sz, id_fd);
+  });
+
+  return ok;
+}
+
+void Hif_read::load_net_index() {
+  if (!net_index.empty())
+    return;
+
+  net_index.resize(stflist.size());
+  for (auto i = 0u; i < stflist.size(); ++i) {
+    auto nxfile = stflist[i].substr(0, stflist[i].size() - 3) + ".nx";
+    if (pack) {
+      auto *f = pack->find(nxfile.substr(nxfile.rfind('/') + 1));
+      if (f && net_index[i].read(f->data, f->size))
+        continue;
+    } else if (net_index[i].read(nxfile)) {
+      continue;
+    }
+
+    auto [ptr, sz, fd]      = open_file(stflist[i]);  // no N.nx, index it in memory
+    auto [id, id_sz, id_fd] = open_file(idflist[i]);
+    net_index[i].build(ptr, sz, id, id_sz);
+    close_file(ptr, sz, fd);
+    close_file(id, id_sz, id_fd);
+  }
+}
+
+void Hif_read::each_net(std::string_view net, bool drivers,
+                        const std::function<void(uint64_t)> &fn) {
+  assert(is_ok());
+
+  load_net_index();
+  statement_count();  // chunk_first
+
+  if (net_ids.empty()) {  // the ID tables point into N.id, kept mapped
+    net_ids.resize(stflist.size());
+    for (auto i = 0u; i < stflist.size(); ++i) {
+      net_ids[i] = open_file(idflist[i]);
+      if (!net_index[i].has_ids()) {  // older N.nx
+        auto [id, id_sz, id_fd] = net_ids[i];
+        net_index[i].build_ids(id, id_sz);
+      }
+    }
+  }
+
+  for (auto i = 0u; i < stflist.size(); ++i) {
+    auto [id, id_sz, id_fd] = net_ids[i];
+    auto pos                = net_index[i].find_id(net, id, id_sz);
+    if (pos == UINT32_MAX)
+      continue;
+
+    const auto &nx    = net_index[i];
+    auto        stmts = drivers ? nx.get_drivers(pos) : nx.get_readers(pos);
+    for (auto local : stmts) {
+      if (i == 0 && local == 0)
+        continue;  // HIF header
+      fn(chunk_first[i] + local - (i == 0 ? 1 : 0));
+    }
+  }
+}
+
+void Hif_read::each_driver(std::string_view net, const std::function<void(uint64_t)> fn) {
+  each_net(net, true, fn);
+}
+
+void Hif_read::each_reader(std::string_view net, const std::function<void(uint64_t)> fn) {
+  each_net(net, false, fn);
+}
+
+std::vector<Hif_read::Segment> Hif_read::get_segments() {
+  load_index();
+
+  // Split large chunks at N.ix checkpoints so that one giant chunk still uses all the
+  // threads
+  std::vector<Segment> segs;
+  for (auto i = 0u; i < stflist.size(); ++i) {
+    const auto &ix = chunk_index[i];
+    if (ix.stride == 0 || ix.checkpoints.empty()) {
+      segs.emplace_back(Segment{i, 0, 0});
+      continue;
+    }
+
+    size_t step = std::max<size_t>(1, segment_stmts / ix.stride);
+    for (size_t k = 0; k < ix.checkpoints.size(); k += step) {
+      uint64_t end = k + step < ix.checkpoints.size() ? ix.checkpoints[k + step] : 0;
+      segs.emplace_back(Segment{i, ix.checkpoints[k], end});
+    }
+  }
+
+  return segs;
+}
+
+std::tuple<uint8_t *, size_t, int> Hif_read::open_file(const std::string &file,
+                                                       bool               raw) const {
+  if (pack) {
+    auto *f = pack->find(std::string_view(file).substr(file.rfind('/') + 1));
+    if (f == nullptr) {
+      std::cerr << "Hif_read could not find HIF chunk " << file << "\n";
+      return std::make_tuple(nullptr, 0, -1);
+    }
+    if (f->size == 0)
+      return std::make_tuple(nullptr, 0, -1);
+
+    auto *ptr = const_cast<uint8_t *>(f->data);  // read only mapping, never written
+    if (!raw && Hif_codec::is_compressed(ptr, f->size)) {
+      auto [raw, raw_sz] = Hif_codec::decompress_file(ptr, f->size);
+      if (raw == nullptr) {
+        std::cerr << "Hif_read could not decompress " << file << "\n";
+      }
+      return std::make_tuple(raw, raw_sz, -1);
+    }
+    return std::make_tuple(ptr, f->size, in_pack);
+  }
+
   int fd = ::open(file.c_str(), O_RDONLY, 0644);
   if (fd < 0) {
     std::cerr << "Hif_read could not open HIF chunk " << file << "\n";
@@ -158,7 +694,8 @@ std::tuple<uint8_t *, uint32_t, int> Hif_read::open_file(const std::string &file
     return std::make_tuple(nullptr, 0, -1);
   }
 
-  if (sb.st_size == 0) {  // empty (likely corrupt from before)
+  if (sb.st_size == 0) {  // empty chunk, nothing to map
+    close(fd);
     return std::make_tuple(nullptr, 0, -1);
   }
 
@@ -170,20 +707,77 @@ std::tuple<uint8_t *, uint32_t, int> Hif_read::open_file(const std::string &file
     return std::make_tuple(nullptr, 0, -1);
   }
 
+  if (!raw && Hif_codec::is_compressed(ptr, sb.st_size)) {  // replaced by the raw bytes
+    auto [raw, raw_sz] = Hif_codec::decompress_file(ptr, sb.st_size);
+    munmap(ptr, sb.st_size);
+    close(fd);
+    if (raw == nullptr) {
+      std::cerr << "Hif_read could not decompress " << file << "\n";
+    }
+    return std::make_tuple(raw, raw_sz, -1);
+  }
+
   return std::make_tuple(ptr, sb.st_size, fd);
 }
 
-void Hif_read::read_idfile(const std::string &idfile) {
+void Hif_read::close_file(uint8_t *ptr, size_t sz, int fd) {
+  if (ptr == nullptr || fd == in_pack)
+    return;
+
+  munmap(ptr, sz);
+  if (fd >= 0)
+    ::close(fd);
+}
+
+void Hif_read::Chunk::open(const Hif_read &rd, size_t _num) {
+  close();
+
+  num = _num;
+
+  // An empty .id (chunk without IDs) or .st file is valid, open_file reports real errors
+  std::tie(idf_base, idf_size, idf_fd) = rd.open_file(rd.idflist[num]);
+  std::tie(ptr_base, ptr_size, ptr_fd) = rd.open_file(rd.stflist[num]);
+
+  ptr       = ptr_base;
+  ptr_end   = ptr_base + ptr_size;
+  corrupted = false;
+}
+
+void Hif_read::Chunk::close_stfile() {
+  close_file(ptr_base, ptr_size, ptr_fd);
+  ptr_base = nullptr;
+  ptr_size = 0;
+  ptr_fd   = -1;
+  ptr      = nullptr;
+  ptr_end  = nullptr;
+  stmt_ptr = nullptr;
+}
+
+void Hif_read::Chunk::close() {
+  close_stfile();
+
   pos2id.clear();
 
-  auto [ptr, ptr_size, fd] = open_file(idfile);
+  close_file(idf_base, idf_size, idf_fd);
+  idf_base = nullptr;
+  idf_size = 0;
+  idf_fd   = -1;
+  idf_scan = 0;
+
+  num = SIZE_MAX;
+}
 
-  uint8_t *ptr_base = ptr;
-  uint8_t *ptr_end  = ptr + ptr_size;
+bool Hif_read::Chunk::load_ids(uint32_t pos) {
+  // IDs are declared in first use order, so decoding up to pos is usually all that
+  // the statements seen so far need.
+  const uint8_t *ptr     = idf_base + idf_scan;
+  const uint8_t *ptr_end = idf_base + idf_size;
 
-  uint32_t pos = 0;
+  while (pos2id.size() <= pos) {
+    if (ptr >= ptr_end) {
+      return false;
+    }
 
-  while (ptr < ptr_end) {
     uint8_t ttt   = *ptr & 0x07;
     bool    small = (*ptr & 0x08) != 0;
 
@@ -191,7 +785,11 @@ void Hif_read::read_idfile(const std::string &idfile) {
     if (small) {
       ptr += 1;
     } else {
-      uint32_t sz1 = *((uint16_t *)(ptr + 1));
+      if (ptr + 3 > ptr_end) {
+        std::cerr << "Hif_read::load_ids truncated ID file at " << pos2id.size() << "\n";
+        return false;
+      }
+      uint32_t sz1 = ptr[1] | (ptr[2] << 8);
       sz1 <<= 4;
       sz |= sz1;
 
@@ -199,30 +797,27 @@ void Hif_read::read_idfile(const std::string &idfile) {
     }
 
     if (ptr + sz > ptr_end) {
-      std::cerr << "Hif_read::read_idfile corrupted HIF file " << idfile << " with " << sz
-                << "\n";
-      return;
+      std::cerr << "Hif_read::load_ids corrupted ID file with " << sz << "\n";
+      return false;
     }
-    std::string_view sv((char *)ptr, sz);
 
     if (ttt > ID_cat::Custom_cat) {
-      std::cerr << "Hif_read::read_idfile corrupted HIF file " << idfile << " cat " << ttt
-                << "\n";
-      return;
+      std::cerr << "Hif_read::load_ids corrupted ID file cat " << (int)ttt << "\n";
+      return false;
     }
 
-    if (pos2id.size() <= pos)
-      pos2id.resize(pos + 1);
-
-    pos2id[pos].ttt = static_cast<ID_cat>(ttt);
-    pos2id[pos].txt = sv;
+    id_entry ent;
+    ent.off = ptr - idf_base;
+    ent.sz  = sz;
+    ent.ttt = ttt;
+    pos2id.emplace_back(ent);
 
     ptr += sz;
-    pos += 1;
   }
 
-  munmap(ptr_base, ptr_size);
-  close(fd);
+  idf_scan = ptr - idf_base;
+
+  return true;
 }
 
 #if 0
@@ -254,10 +849,22 @@ size_t Hif_read::read_declare(size_t pos) {
 }
 #endif
 
-uint8_t *Hif_read::read_te(uint8_t *ptr, uint8_t *ptr_end, std::vector<Tuple_entry> &io) {
+uint8_t *Hif_read::Chunk::read_te(uint8_t *ptr, uint8_t *ptr_end,
+                                  std::vector<Tuple_view> &io) {
+  if (corrupted)
+    return ptr_end;
+
   int lhs_pos = -1;
 
-  while (*ptr != 0xFF) {
+  while (true) {
+    if (ptr >= ptr_end) {  // every list ends with 0xFF, even the last one
+      std::cerr << "Hif_read truncated st (aborting)\n";
+      corrupted = true;
+      return ptr_end;
+    }
+    if (*ptr == 0xFF)
+      break;
+
     bool    small = (*ptr & 1) != 0;
     uint8_t ee    = (*ptr >> 1) & 0x3;
 
@@ -268,47 +875,48 @@ uint8_t *Hif_read::read_te(uint8_t *ptr, uint8_t *ptr_end, std::vector<Tuple_ent
     if (small) {
       ptr += 1;
     } else {
-      uint32_t pos2 = *(uint16_t *)(ptr + 1);
-      pos2 <<= 5; // (8 - 3);  // 3 bits used for small + ee
+      if (ptr + 3 > ptr_end) {
+        std::cerr << "Hif_read truncated st reference (aborting)\n";
+        corrupted = true;
+        return ptr_end;
+      }
+      uint32_t pos2 = ptr[1] | (ptr[2] << 8);
+      pos2 <<= 5;  // (8 - 3);  // 3 bits used for small + ee
       pos |= pos2;
       ptr += 3;
     }
 
-
-    if (pos >= pos2id.size()) {
+    if (pos >= pos2id.size() && !load_ids(pos)) {
       std::cerr << "Hif_read corrupted st pos " << pos << " (aborting)\n";
+      corrupted = true;
       return ptr_end;
     }
 
     if (last) {
       if (lhs_pos >= 0) {
         io.emplace_back(input,
-                        pos2id[lhs_pos].txt,
-                        pos2id[pos].txt,
-                        pos2id[lhs_pos].ttt,
-                        pos2id[pos].ttt);
+                        id_txt(lhs_pos),
+                        id_txt(pos),
+                        id_cat(lhs_pos),
+                        id_cat(pos));
         lhs_pos = -1;
       } else {
-        io.emplace_back(input, pos2id[pos].txt, "", pos2id[pos].ttt, ID_cat::String_cat);
+        io.emplace_back(input, id_txt(pos), "", id_cat(pos), ID_cat::String_cat);
       }
     } else {
       if (lhs_pos >= 0) {
         std::cerr << "Hif_read corrupted 2 non last back to back?? (aborting)\n";
+        corrupted = true;
         return ptr_end;
       }
       lhs_pos = pos;
     }
+  }
 
-    if (ptr > ptr_end) {
-      std::cerr << "Hif_read corrupted st overflow (aborting)\n";
-      return ptr_end;
-    }
-
-    if (*ptr == 0xFF && lhs_pos >= 0) {
-      std::cerr << "Hif_read corrupted lhs_pos " << lhs_pos << " input " << input
-                << " last " << last << " without rhs (aborting)\n";
-      return ptr_end;
-    }
+  if (lhs_pos >= 0) {
+    std::cerr << "Hif_read corrupted lhs_pos " << lhs_pos << " without rhs (aborting)\n";
+    corrupted = true;
+    return ptr_end;
   }
 
   ptr += 1;
@@ -316,10 +924,18 @@ uint8_t *Hif_read::read_te(uint8_t *ptr, uint8_t *ptr_end, std::vector<Tuple_ent
   return ptr;
 }
 
-uint8_t *Hif_read::read_header(uint8_t *ptr, uint8_t *ptr_end, Statement &stmt) {
+uint8_t *Hif_read::Chunk::read_header(uint8_t *ptr, uint8_t *ptr_end,
+                                      Statement_view &stmt) {
+  if (ptr + 3 > ptr_end) {  // class, type and instance (or 0xFF)
+    std::cerr << "Hif_read truncated st header (aborting)\n";
+    corrupted = true;
+    return ptr_end;
+  }
+
   uint8_t cccc = (*ptr) >> 4;
   if (cccc > Statement_class::Use) {
-    std::cerr << "Hif_read invalid cccc " << cccc << "\n";
+    std::cerr << "Hif_read invalid cccc " << static_cast<int>(cccc) << "\n";
+    corrupted = true;
     return ptr_end;
   }
 
@@ -342,43 +958,231 @@ uint8_t *Hif_read::read_header(uint8_t *ptr, uint8_t *ptr_end, Statement &stmt)
     if (small) {
       ptr += 1;
     } else {
-      uint32_t pos2 = *(uint16_t *)(ptr + 1);
+      if (ptr + 3 > ptr_end) {
+        std::cerr << "Hif_read truncated st instance (aborting)\n";
+        corrupted = true;
+        return ptr_end;
+      }
+      uint32_t pos2 = ptr[1] | (ptr[2] << 8);
       pos2 <<= 5;
       pos |= pos2;
       ptr += 3;
     }
 
-    if (pos >= pos2id.size()) {
+    if (pos >= pos2id.size() && !load_ids(pos)) {
       std::cerr << "Hif_read corrupted instance pos " << pos << " (aborting)\n";
+      corrupted = true;
       return ptr_end;
     }
-    stmt.instance = pos2id[pos].txt;
+    stmt.instance = id_txt(pos);
   }
 
   return ptr;
 }
 
-bool Hif_read::next_stmt() {
-  if (ptr >= ptr_end)
+bool Hif_read::open_next_chunk() {
+  if (filepos >= stop_chunk || filepos + 1 >= stflist.size())
     return false;
 
-  cur_stmt = Statement();
-
-  ptr = read_header(ptr, ptr_end, cur_stmt);
-  ptr = read_te(ptr, ptr_end, cur_stmt.io);
-  ptr = read_te(ptr, ptr_end, cur_stmt.attr);
+  open_chunk(filepos + 1);
+  if (filepos == stop_chunk) {
+    if (stop_end > cur.ptr_size) {
+      std::cerr << "Hif_read module end " << stop_end << " after the chunk end\n";
+      stop_end = cur.ptr_size;
+    }
+    cur.ptr_end = cur.ptr_base + stop_end;
+  }
 
   return true;
 }
 
+bool Hif_read::next_chunk_stmt() {
+  while (!cur.corrupted) {  // a corrupted statement stops the reader
+    if (!open_next_chunk())
+      return false;
+    if (cur.next_stmt(cur_view))
+      return true;
+  }
+  corrupted = true;
+
+  return false;
+}
+
+size_t Hif_read::next_batch(size_t n) {
+  if (batch_views.size() < n)
+    batch_views.resize(n);
+
+  while (cur.ptr >= cur.ptr_end) {  // views of the previous batch are not used anymore
+    if (!open_next_chunk())
+      return 0;
+  }
+
+  size_t sz = 0;
+  while (sz < n && cur.next_stmt(batch_views[sz])) {
+    ++sz;
+  }
+
+  return sz;
+}
+
 void Hif_read::each(const std::function<void(const Statement &stmt)> fn) {
-  assert(ptr_base);
-  assert(ptr_fd >= 0);
+  assert(is_ok());
+
+  while (next_stmt()) {
+    fn(cur_view.to_statement());
+  }
+
+  cur.close_stfile();
+}
+
+void Hif_read::each(const std::function<void(const Statement_view &stmt)> fn) {
+  assert(is_ok());
 
   while (next_stmt()) {
-    fn(cur_stmt);
+    fn(cur_view);
+  }
+
+  cur.close_stfile();
+}
+
+void Hif_read::decode_segment(const Segment &seg, Chunk &rd,
+                              std::vector<Statement_view> &batch, size_t max_stmts,
+                              const std::function<void(size_t)> &flush) {
+  if (rd.num != seg.chunk || rd.ptr_base == nullptr) {  // reuse the loaded IDs
+    rd.open(*this, seg.chunk);
+  }
+
+  rd.ptr       = rd.ptr_base + std::min<uint64_t>(seg.begin, rd.ptr_size);
+  rd.ptr_end   = rd.ptr_base + (seg.end ? std::min<uint64_t>(seg.end, rd.ptr_size)
+                                        : rd.ptr_size);
+  rd.corrupted = false;
+
+  size_t n = 0;
+  if (seg.chunk == 0 && seg.begin == 0) {  // HIF header
+    if (batch.empty())
+      batch.emplace_back();
+    rd.next_stmt(batch[0]);
   }
 
-  munmap(ptr_base, ptr_size);
-  close(ptr_fd);
+  while (true) {
+    if (n == batch.size())
+      batch.emplace_back();
+    if (!rd.next_stmt(batch[n]))
+      break;
+
+    ++n;
+    if (n >= max_stmts) {
+      flush(n);
+      n = 0;
+    }
+  }
+  if (n)
+    flush(n);
+  if (rd.corrupted)
+    corrupted = true;
+}
+
+void Hif_read::parallel_each(unsigned nthreads, const Batch_fn fn) {
+  assert(is_ok());
+
+  if (nthreads == 0)
+    nthreads = Thread_pool::default_threads();
+
+  struct Worker {
+    Chunk                       rd;
+    std::vector<Statement_view> batch;
+  };
+  auto                segs = get_segments();
+  std::vector<Worker> workers(std::min<size_t>(nthreads, segs.size()));
+
+  Thread_pool::run(segs.size(), workers.size(), [&](size_t i, unsigned tid) {
+    auto &w = workers[tid];
+    decode_segment(segs[i], w.rd, w.batch, batch_size, [&](size_t n) {
+      fn(segs[i].chunk, std::span<const Statement_view>(w.batch.data(), n));
+    });
+  });
+}
+
+template <typename State, typename W, typename D>
+void Hif_read::ordered_segments(unsigned nthreads, W &&work, D &&deliver) {
+  assert(is_ok());
+
+  if (nthreads == 0)
+    nthreads = Thread_pool::default_threads();
+  auto segs = get_segments();
+  nthreads  = std::min<size_t>(nthreads, segs.size());
+
+  // Segments are handed out in increasing order, so the segment being waited for is
+  // always being decoded by another worker. A worker decodes its full segment (the
+  // views keep it mapped) and then waits for its turn to deliver it.
+  std::atomic<size_t>     next_task{0};
+  size_t                  next_deliver = 0;
+  bool                    stopped      = false;  // after a corrupted statement
+  std::mutex              mtx;
+  std::condition_variable cv;
+
+  // One task per worker on Thread_pool, so the codec knows it runs on a worker
+  Thread_pool::run(nthreads, nthreads, [&](size_t, unsigned) {
+    Chunk                       rd;
+    std::vector<Statement_view> batch;
+    State                       state{};
+
+    while (true) {
+      auto task = next_task.fetch_add(1);
+      if (task >= segs.size())
+        return;
+
+      work(segs[task], rd, batch, state);
+
+      bool skip;
+      {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [&]() { return next_deliver == task; });
+        skip = stopped;
+      }
+
+      if (skip)
+        state = State{};
+      else
+        deliver(segs[task], batch, state);  // up to the corrupted statement
+
+      {
+        std::lock_guard<std::mutex> lock(mtx);
+        next_deliver = task + 1;
+        stopped      = stopped || rd.corrupted;
+      }
+      cv.notify_all();
+    }
+  });
+}
+
+void Hif_read::parallel_each_ordered(unsigned nthreads, const Batch_fn fn) {
+  ordered_segments<size_t>(
+      nthreads,
+      [this](const Segment &seg, Chunk &rd, std::vector<Statement_view> &batch,
+             size_t &n) {
+        decode_segment(seg, rd, batch, SIZE_MAX, [&n](size_t sz) { n = sz; });
+      },
+      [&fn](const Segment &seg, std::vector<Statement_view> &batch, size_t &n) {
+        for (size_t i = 0; i < n; i += batch_size) {
+          auto sz = std::min(batch_size, n - i);
+          fn(seg.chunk, std::span<const Statement_view>(&batch[i], sz));
+        }
+      });
+}
+
+void Hif_read::parallel_format(unsigned nthreads, const Format_fn fn,
+                               const std::function<void(std::string &buf)> out) {
+  ordered_segments<std::string>(
+      nthreads,
+      [this, &fn](const Segment &seg, Chunk &rd, std::vector<Statement_view> &batch,
+                  std::string &buf) {
+        decode_segment(seg, rd, batch, batch_size, [&](size_t n) {
+          fn(std::span<const Statement_view>(batch.data(), n), buf);
+        });
+      },
+      [&out](const Segment &, std::vector<Statement_view> &, std::string &buf) {
+        out(buf);
+        buf.clear();
+      });
 }
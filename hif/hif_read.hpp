@@ -2,21 +2,162 @@
 
 #pragma once
 
+#include <atomic>
+#include <cassert>
 #include <cstdint>
 #include <functional>
 #include <memory>
+#include <span>
+#include <string>
 #include <tuple>
+#include <type_traits>
+#include <unordered_map>
 
 #include "hif_base.hpp"
+#include "hif_index.hpp"
+#include "hif_net_index.hpp"
+#include "hif_pack.hpp"
 
 class Hif_read : public Hif_base {
 public:
+  struct Options {
+    bool     verify           = false;  // open fails if verify does
+    unsigned verify_threads   = 0;      // 0 is Thread_pool::default_threads
+    bool     allow_missing_ck = false;  // verify passes chunks without N.ck
+  };
+
   // Load a file (fname) and populate the Hif
   static std::shared_ptr<Hif_read> open(std::string_view fname);
+  static std::shared_ptr<Hif_read> open(std::string_view fname, const Options &opt);
+
+  bool next_stmt() {
+    if (cur.next_stmt(cur_view))
+      return true;
+    return next_chunk_stmt();
+  }
+  // A statement did not decode (damaged N.st). The iteration stopped before it,
+  // instead of at the end of the HIF.
+  bool has_error() const { return corrupted || cur.corrupted; }
+  Hif_base::Statement get_current_stmt() const { return cur_view.to_statement(); }
+  // Zero-copy access. The view is valid until the next call to next_stmt
+  const Hif_base::Statement_view &get_current_view() const { return cur_view; }
+
+  void each(const std::function<void(const Hif_base::Statement &stmt)>);
+  void each(const std::function<void(const Hif_base::Statement_view &stmt)>);
+
+  // Same as each, but fn is inlined. fn takes a Statement_view (zero-copy) or a
+  // Statement.
+  template <typename F>
+  void each(F &&fn) {
+    assert(is_ok());
+
+    while (next_stmt()) {
+      if constexpr (std::is_invocable_v<F &, const Hif_base::Statement_view &>) {
+        fn(cur_view);
+      } else {
+        fn(cur_view.to_statement());
+      }
+    }
+
+    cur.close_stfile();
+  }
+
+  // fn(std::span<const Statement_view>) gets up to n statements at a time. Batches
+  // never cross chunks and the views are valid only during the call.
+  template <typename F>
+  void each_batch(size_t n, F &&fn) {
+    assert(is_ok());
+    assert(n > 0);
+
+    size_t sz;
+    while ((sz = next_batch(n)) != 0) {
+      fn(std::span<const Hif_base::Statement_view>(batch_views.data(), sz));
+    }
+
+    cur.close_stfile();
+  }
+
+  // Batches never cross chunks. The views are valid only during the call
+  using Batch_fn = std::function<void(size_t                                    chunk,
+                                      std::span<const Hif_base::Statement_view> batch)>;
+
+  // Decode every chunk on nthreads workers (independent of next_stmt). fn is called
+  // concurrently from several threads and the chunk order is not preserved. A damaged
+  // segment stops at its first corrupted statement (see has_error).
+  void parallel_each(unsigned nthreads, const Batch_fn fn);
+  // Same but fn is called by one thread at a time and in file (chunk) order, and
+  // nothing after the first corrupted statement is delivered
+  void parallel_each_ordered(unsigned nthreads, const Batch_fn fn);
 
-  bool                next_stmt();
-  Hif_base::Statement get_current_stmt() { return cur_stmt; }
-  void                each(const std::function<void(const Hif_base::Statement &stmt)>);
+  // fn appends to buf (e.g. the text of the batch) concurrently, then out gets the buf
+  // of each segment in file order and buf is cleared. Memory is one buf per thread.
+  using Format_fn = std::function<void(std::span<const Hif_base::Statement_view> batch,
+                                       std::string                              &buf)>;
+  void parallel_format(unsigned nthreads, const Format_fn fn,
+                       const std::function<void(std::string &buf)> out);
+
+  size_t get_num_chunks() const { return stflist.size(); }
+  // Chunk of the current statement
+  size_t get_current_chunk() const { return filepos; }
+
+  // Statements in the design (HIF header excluded). Uses the N.ix sidecars, chunks
+  // without one are counted by decoding them.
+  uint64_t statement_count();
+  // Position the reader so that next_stmt returns statement stmt_index (0 is the first
+  // statement after the HIF header). Returns false if out of range.
+  bool seek(uint64_t stmt_index);
+
+  // Statements in the design by scanning every N.st (see Hif_scan), ignoring N.ix.
+  // class_count (16 entries, one per Statement_class) is incremented when not null.
+  uint64_t count_statements(uint64_t *class_count = nullptr);
+  // Moves forward n statements without decoding them, so that next_stmt returns the
+  // n+1th statement after the current one. Returns the statements skipped (less than
+  // n at the end of the design).
+  uint64_t skip(uint64_t n);
+
+  // When the current statement starts a scope (open_*/closed_*), position the reader so
+  // that next_stmt returns the statement after the matching end. The N.ix scope table
+  // is sorted by offset (a binary search, O(log scopes in the chunk)), and the body is
+  // not decoded. Scopes not in the table (no N.ix, or the end is in a later chunk)
+  // decode the body. Either way the current statement stays the scope begin. Returns
+  // false if the current statement is not a scope, or was already skipped.
+  bool skip_scope();
+
+  // Module directory (open_def/closed_def in N.ix), without decoding any statement.
+  // chunk has the def, the end is m.span chunks after it. Defs in chunks without N.ix
+  // are not listed.
+  void each_module(const std::function<void(size_t chunk, const Hif_index::Module &)> fn);
+  // Position the reader at the def statement of module name. next_stmt returns the def,
+  // its body and its end (across chunks if it spans them), then false. seek continues
+  // with the whole design.
+  bool open_module(std::string_view name);
+  // Hif_index::Module::hash of module name, from N.ix only (no statement is decoded).
+  // A module that spans chunks has it in the chunk of its end. 0 if the module is not
+  // in the directory or its N.ix predates module hashes.
+  uint64_t get_module_hash(std::string_view name);
+
+  // Net connectivity (N.nx sidecars, see Hif_net_index). build_net_index writes them,
+  // one chunk per task (in memory only for packs). Chunks without N.nx are indexed in
+  // memory when queried.
+  bool build_net_index(unsigned nthreads = 0);
+  // fn(stmt_index) for every statement that drives (output) or reads (input) net, in
+  // file order. stmt_index is the same as in seek.
+  void each_driver(std::string_view net, const std::function<void(uint64_t)> fn);
+  void each_reader(std::string_view net, const std::function<void(uint64_t)> fn);
+
+  // Checks the N.st/N.id bytes as stored against the N.ck sidecars (see Hif_checksum),
+  // one block per task on nthreads workers. Mismatches are reported to std::cerr.
+  // A chunk without N.ck (deleted, or written with checksum_block 0) is reported and
+  // fails, unless allow_missing. bytes (when not null) gets the bytes checked.
+  bool verify(unsigned nthreads = 0, uint64_t *bytes = nullptr,
+              bool allow_missing = false) const;
+
+  // Hif_hash of the decoded N.st/N.id bytes of every chunk, so the same design has
+  // the same hash compressed, packed or not. Reads the whole design.
+  uint64_t content_hash() const;
+  // Hif_hash of the size, mtime and inode of the N.st/N.id files (of the file for
+  // packs). No data is read, a cheap check that the design was not written since.
+  uint64_t file_stamp() const;
 
   Hif_read(std::string_view fname);
   ~Hif_read();
@@ -25,34 +166,142 @@ public:
   std::string_view get_version() const { return version; }
 
 protected:
+  static constexpr size_t batch_size    = 4096;
+  static constexpr size_t segment_stmts = 1 << 16;  // parallel work unit with N.ix
+
   bool is_ok() const { return !idflist.empty(); }
 
-  std::tuple<uint8_t *, uint32_t, int> open_file(const std::string &file);
+  static uint64_t chunk_number(const std::string &path);
+
+  // Chunk file (from the directory or the pack), close_file releases it. fd is -1 for
+  // decompressed files and in_pack for pack files that are used in place. raw keeps
+  // compressed files as stored.
+  static constexpr int               in_pack = -2;
+  std::tuple<uint8_t *, size_t, int> open_file(const std::string &file,
+                                               bool               raw = false) const;
+  static void                        close_file(uint8_t *ptr, size_t sz, int fd);
+
+  void   open_chunk(size_t chunk);
+  void   load_index();
+  void   load_net_index();
+  // Chunk of the N.ix and position in its modules (chunk UINT32_MAX if not found)
+  std::pair<uint32_t, uint32_t> find_module(std::string_view name);
+  void   each_net(std::string_view net, bool drivers,
+                  const std::function<void(uint64_t)> &fn);
+  bool   open_next_chunk();  // false at the last chunk (of the module for open_module)
+  bool   next_chunk_stmt();
+  size_t next_batch(size_t n);
+
+  struct id_entry {  // 8 bytes, the ID text stays in the mapped .id file
+    uint32_t off;
+    uint32_t sz  : 28;
+    uint32_t ttt : 4;
+  };
+
+  // Decoding state for one N.st/N.id pair. Chunks are self-contained, so each parallel
+  // worker owns its own.
+  struct Chunk {
+    Chunk() = default;
+    Chunk(const Chunk &)            = delete;
+    Chunk &operator=(const Chunk &) = delete;
+    ~Chunk() { close(); }
+
+    void open(const Hif_read &rd, size_t _num);
+    void close();
+    void close_stfile();
+
+    bool next_stmt(Statement_view &stmt) {
+      if (corrupted || ptr >= ptr_end)
+        return false;
+
+      stmt.clear();
+
+      stmt_ptr = ptr;
+      ptr      = read_header(ptr, ptr_end, stmt);
+      ptr      = read_te(ptr, ptr_end, stmt.io);
+      ptr      = read_te(ptr, ptr_end, stmt.attr);
+
+      return !corrupted;  // stays false until the chunk is positioned again
+    }
+
+    bool load_ids(uint32_t pos);
+
+    std::string_view id_txt(uint32_t pos) const {
+      return std::string_view(reinterpret_cast<const char *>(idf_base) + pos2id[pos].off,
+                              pos2id[pos].sz);
+    }
+    Hif_base::ID_cat id_cat(uint32_t pos) const {
+      return static_cast<Hif_base::ID_cat>(pos2id[pos].ttt);
+    }
+
+    uint8_t *read_te(uint8_t *ptr, uint8_t *ptr_end, std::vector<Tuple_view> &io);
+    uint8_t *read_header(uint8_t *ptr, uint8_t *ptr_end, Hif_base::Statement_view &stmt);
+
+    size_t num = SIZE_MAX;  // position in idflist/stflist
+
+    uint8_t *ptr      = nullptr;
+    uint8_t *ptr_end  = nullptr;
+    uint8_t *stmt_ptr = nullptr;  // start of the last decoded statement
+    uint8_t *ptr_base = nullptr;
+    size_t   ptr_size = 0;
+    int      ptr_fd   = -1;
 
-  void     read_idfile(const std::string &idfile);
-  uint8_t *read_te(uint8_t *ptr, uint8_t *ptr_end, std::vector<Tuple_entry> &io);
-  uint8_t *read_header(uint8_t *ptr, uint8_t *ptr_end, Hif_base::Statement &stmt);
+    bool corrupted = false;  // a statement did not decode, next_stmt stops there
+
+    uint8_t *idf_base = nullptr;
+    size_t   idf_size = 0;
+    int      idf_fd   = -1;
+    size_t   idf_scan = 0;  // pos2id is decoded lazily up to this offset
+
+    std::vector<id_entry> pos2id;
+  };
+
+  // Statements between two N.st offsets (end == 0 is the end of the chunk)
+  struct Segment {
+    size_t   chunk;
+    uint64_t begin;
+    uint64_t end;
+  };
+  std::vector<Segment> get_segments();
+
+  // Decodes a segment (skipping the HIF header in chunk 0) into batch, reusing the
+  // views already allocated in it. flush(n) is called every max_stmts and at the end,
+  // rd stays open so the views are valid until the next decode_segment.
+  void decode_segment(const Segment &seg, Chunk &rd, std::vector<Statement_view> &batch,
+                      size_t max_stmts, const std::function<void(size_t)> &flush);
+
+  // Segments go to nthreads workers in increasing order. work(seg, rd, batch, state)
+  // runs concurrently, then deliver(seg, batch, state) in file order.
+  template <typename State, typename W, typename D>
+  void ordered_segments(unsigned nthreads, W &&work, D &&deliver);
 
   std::vector<std::string> idflist;
   std::vector<std::string> stflist;
 
-  size_t filepos;
+  std::shared_ptr<Hif_pack> pack;  // single file HIF, the lists have pack/N.st names
 
-  Statement cur_stmt;
+  // N.ix per chunk (stride 0 if missing) and first statement of each chunk
+  std::vector<Hif_index> chunk_index;
+  std::vector<uint64_t>  chunk_first;
 
-  struct id_entry {
-    Hif_base::ID_cat ttt;
-    std::string      txt;
-  };
+  // Per chunk net index, and the N.id files that its ID tables point into
+  std::vector<Hif_net_index>                      net_index;
+  std::vector<std::tuple<uint8_t *, size_t, int>> net_ids;
+
+  // open_module: name (in chunk_index) to chunk and position in its modules
+  std::unordered_map<std::string_view, std::pair<uint32_t, uint32_t>> module_dir;
+
+  size_t   filepos    = 0;         // current chunk in idflist/stflist
+  size_t   stop_chunk = SIZE_MAX;  // open_module: the last chunk, it ends at stop_end
+  uint64_t stop_end   = 0;
+
+  Statement_view              cur_view;
+  std::vector<Statement_view> batch_views;  // each_batch
 
   std::string tool;
   std::string version;
 
-  uint8_t *ptr;
-  uint8_t *ptr_end;
-  uint8_t *ptr_base;
-  size_t   ptr_size;
-  int      ptr_fd;
-
-  std::vector<id_entry> pos2id;
+  Chunk             cur;
+  Chunk             scope_begin;  // skip_scope: the begin of a scope that left its chunk
+  std::atomic<bool> corrupted{false};  // set by the parallel decoders and next_stmt
 };
@@ -0,0 +1,194 @@
+//  This file is distributed under the BSD 3-Clause License. See LICENSE for details.
+
+#include "hif_scan.hpp"
+
+#include <iostream>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HIF_SCAN_X86
+#endif
+
+// Finders return the first byte at or after ptr that is 0xFF or starts a long reference
+struct Scalar_finder {
+  const uint8_t *find(const uint8_t *ptr, const uint8_t *ptr_end) {
+    while (ptr < ptr_end && (*ptr & 1) && *ptr != 0xFF) {
+      ++ptr;
+    }
+    return ptr < ptr_end ? ptr : ptr_end;
+  }
+};
+
+#ifdef HIF_SCAN_X86
+struct Sse2_load {
+  static constexpr int width = 16;
+
+  static uint32_t mask(const uint8_t *ptr) {
+    auto v    = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr));
+    auto lng  = _mm_cmpeq_epi8(_mm_and_si128(v, _mm_set1_epi8(1)), _mm_setzero_si128());
+    auto term = _mm_cmpeq_epi8(v, _mm_set1_epi8(static_cast<char>(0xFF)));
+    return _mm_movemask_epi8(_mm_or_si128(lng, term));
+  }
+};
+
+struct Avx2_load {
+  static constexpr int width = 32;
+
+  __attribute__((target("avx2"))) static uint32_t mask(const uint8_t *ptr) {
+    auto v   = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ptr));
+    auto lng = _mm256_cmpeq_epi8(_mm256_and_si256(v, _mm256_set1_epi8(1)),
+                                 _mm256_setzero_si256());
+    auto term = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(static_cast<char>(0xFF)));
+    return _mm256_movemask_epi8(_mm256_or_si256(lng, term));
+  }
+};
+
+template <typename Load>
+struct Simd_finder {
+  const uint8_t *find(const uint8_t *ptr, const uint8_t *ptr_end) {
+    // Most lists are short (or full of long references), and a byte test has less
+    // latency than a vector load and movemask
+    for (int i = 0; i < 2; ++i, ++ptr) {
+      if (ptr >= ptr_end)
+        return ptr_end;
+      if ((*ptr & 1) == 0 || *ptr == 0xFF)
+        return ptr;
+    }
+
+    while (ptr_end - ptr >= Load::width) {
+      auto m = Load::mask(ptr);
+      if (m)
+        return ptr + __builtin_ctz(m);
+      ptr += Load::width;
+    }
+    return Scalar_finder().find(ptr, ptr_end);  // tail, or ptr past the end
+  }
+};
+#endif
+
+// Start of the statement after ptr, nullptr if it does not end before ptr_end
+template <typename Finder>
+static const uint8_t *next_stmt(Finder &finder, const uint8_t *ptr,
+                                const uint8_t *ptr_end) {
+  if (ptr_end - ptr < 3)
+    return nullptr;
+
+  ptr += 2;  // cccc + type
+  if (*ptr == 0xFF) {
+    ++ptr;  // no instance
+  } else {
+    ptr += (*ptr & 1) ? 1 : 3;
+  }
+
+  for (int list = 0; list < 2; ++list) {  // io, attr
+    while (true) {
+      ptr = finder.find(ptr, ptr_end);
+      if (ptr >= ptr_end)
+        return nullptr;
+      if (*ptr == 0xFF)
+        break;
+      ptr += 3;  // long reference
+    }
+    ++ptr;
+  }
+
+  return ptr;
+}
+
+template <typename Finder>
+static uint64_t count_with(const uint8_t *ptr, const uint8_t *ptr_end,
+                           uint64_t *class_count) {
+  Finder   finder;
+  uint64_t n = 0;
+  while (ptr < ptr_end) {
+    auto next = next_stmt(finder, ptr, ptr_end);
+    if (next == nullptr) {
+      std::cerr << "Hif_scan truncated statement " << n << "\n";
+      break;
+    }
+    if (class_count)
+      ++class_count[*ptr >> 4];
+    ++n;
+    ptr = next;
+  }
+  return n;
+}
+
+template <typename Finder>
+static const uint8_t *skip_with(const uint8_t *ptr, const uint8_t *ptr_end,
+                                uint64_t &n) {
+  Finder finder;
+  while (n && ptr < ptr_end) {
+    auto next = next_stmt(finder, ptr, ptr_end);
+    if (next == nullptr) {
+      std::cerr << "Hif_scan truncated statement\n";
+      return ptr_end;
+    }
+    --n;
+    ptr = next;
+  }
+  return ptr;
+}
+
+#ifdef HIF_SCAN_X86
+// flatten inlines the whole walk (and the AVX2 loads) in an AVX2 function
+__attribute__((target("avx2"), flatten)) static uint64_t count_avx2(
+    const uint8_t *ptr, const uint8_t *ptr_end, uint64_t *class_count) {
+  return count_with<Simd_finder<Avx2_load>>(ptr, ptr_end, class_count);
+}
+
+__attribute__((target("avx2"), flatten)) static const uint8_t *skip_avx2(
+    const uint8_t *ptr, const uint8_t *ptr_end, uint64_t &n) {
+  return skip_with<Simd_finder<Avx2_load>>(ptr, ptr_end, n);
+}
+#endif
+
+Hif_scan::Impl Hif_scan::best_impl() {
+#ifdef HIF_SCAN_X86
+  static const Impl impl = __builtin_cpu_supports("avx2") ? Impl::Avx2 : Impl::Sse2;
+  return impl;
+#else
+  return Impl::Scalar;
+#endif
+}
+
+uint64_t Hif_scan::count(const uint8_t *ptr, const uint8_t *ptr_end,
+                         uint64_t *class_count) {
+  switch (best_impl()) {
+#ifdef HIF_SCAN_X86
+    case Impl::Avx2: return count_avx2(ptr, ptr_end, class_count);
+    case Impl::Sse2: return count_with<Simd_finder<Sse2_load>>(ptr, ptr_end, class_count);
+#endif
+    default: return count_with<Scalar_finder>(ptr, ptr_end, class_count);
+  }
+}
+
+const uint8_t *Hif_scan::skip(const uint8_t *ptr, const uint8_t *ptr_end, uint64_t &n) {
+  switch (best_impl()) {
+#ifdef HIF_SCAN_X86
+    case Impl::Avx2: return skip_avx2(ptr, ptr_end, n);
+    case Impl::Sse2: return skip_with<Simd_finder<Sse2_load>>(ptr, ptr_end, n);
+#endif
+    default: return skip_with<Scalar_finder>(ptr, ptr_end, n);
+  }
+}
+
+const uint8_t *Hif_scan::stmt_end(const uint8_t *ptr, const uint8_t *ptr_end) {
+#ifdef HIF_SCAN_X86
+  Simd_finder<Sse2_load> finder;
+#else
+  Scalar_finder finder;
+#endif
+  return next_stmt(finder, ptr, ptr_end);
+}
+
+const uint8_t *Hif_scan::find_structural(Impl impl, const uint8_t *ptr,
+                                         const uint8_t *ptr_end) {
+#ifdef HIF_SCAN_X86
+  if (impl == Impl::Avx2 && best_impl() == Impl::Avx2)
+    return Simd_finder<Avx2_load>().find(ptr, ptr_end);
+  if (impl != Impl::Scalar)
+    return Simd_finder<Sse2_load>().find(ptr, ptr_end);
+#endif
+  return Scalar_finder().find(ptr, ptr_end);
+}
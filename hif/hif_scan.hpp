@@ -0,0 +1,36 @@
+//  This file is distributed under the BSD 3-Clause License. See LICENSE for details.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Statement boundaries in N.st bytes without decoding them (no ID is looked up).
+//
+// Inside the io/attr lists every byte is the start of a reference: short ones are a
+// single byte with bit 0 set, long ones take 3 bytes and start with bit 0 clear, and
+// 0xFF ends the list (no short reference is 0xFF). So the only bytes that need a look
+// are the 0xFF terminators and the long reference starts; runs of short references
+// are skipped 16 (SSE2) or 32 (AVX2) bytes at a time. AVX2 is picked at run time.
+class Hif_scan {
+public:
+  // Statements in [ptr, ptr_end). When class_count is not null, class_count[cccc] is
+  // incremented for each one (16 entries).
+  static uint64_t count(const uint8_t *ptr, const uint8_t *ptr_end,
+                        uint64_t *class_count = nullptr);
+
+  // Skips up to n statements and returns the start of the next one (ptr_end once all
+  // are skipped). n is decreased by the number of statements skipped.
+  static const uint8_t *skip(const uint8_t *ptr, const uint8_t *ptr_end, uint64_t &n);
+
+  // End of the statement at ptr, nullptr if it does not end before ptr_end (e.g. only
+  // part of it is in a stream buffer)
+  static const uint8_t *stmt_end(const uint8_t *ptr, const uint8_t *ptr_end);
+
+  // Start of the next 0xFF terminator or long reference in a reference list (ptr_end
+  // if none). Exposed to compare the implementations.
+  enum class Impl { Scalar, Sse2, Avx2 };
+  static const uint8_t *find_structural(Impl impl, const uint8_t *ptr,
+                                        const uint8_t *ptr_end);
+  static Impl           best_impl();
+};
@@ -0,0 +1,235 @@
+//  This file is distributed under the BSD 3-Clause License. See LICENSE for details.
+
+#include "hif_stream_read.hpp"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include "hif_scan.hpp"
+
+std::shared_ptr<Hif_stream_read> Hif_stream_read::open(int fd, size_t buffer_size) {
+  auto ptr = std::make_shared<Hif_stream_read>(fd, buffer_size);
+
+  return ptr->is_ok() ? ptr : nullptr;
+}
+
+Hif_stream_read::Hif_stream_read(int _fd, size_t buffer_size) : fd(_fd) {
+  buffer.resize(std::max<size_t>(buffer_size, 64));
+
+  if (!fill(sizeof(stream_magic)) || memcmp(&buffer[0], stream_magic, 4) != 0) {
+    std::cerr << "Hif_stream_read not a HIF stream\n";
+    ok = false;
+    return;
+  }
+  pos += sizeof(stream_magic);
+
+  if (!next_stmt()) {
+    std::cerr << "Hif_stream_read empty HIF stream\n";
+    ok = false;
+    return;
+  }
+
+  const auto &stmt = cur_view;
+  if (stmt.attr.size() != 3 || stmt.attr[0].lhs != "HIF"
+      || stmt.attr[0].rhs != hif_version || stmt.attr[1].lhs != "tool"
+      || stmt.attr[2].lhs != "version") {
+    std::cerr << "Hif_stream_read invalid HIF header\n";
+    ok = false;
+    return;
+  }
+
+  tool    = stmt.attr[1].rhs;
+  version = stmt.attr[2].rhs;
+}
+
+bool Hif_stream_read::fill(size_t n) {
+  if (size - pos >= n)
+    return true;
+
+  if (pos) {  // keep the partial frame, drop the ones already decoded
+    memmove(buffer.data(), buffer.data() + pos, size - pos);
+    size -= pos;
+    pos = 0;
+  }
+  if (buffer.size() < n) {
+    buffer.resize(std::max(n, 2 * buffer.size()));
+  }
+
+  while (size < n) {
+    auto sz = ::read(fd, buffer.data() + size, buffer.size() - size);
+    if (sz < 0 && errno == EINTR)
+      continue;
+    if (sz < 0) {
+      std::cerr << "Hif_stream_read read error " << strerror(errno) << "\n";
+      return false;
+    }
+    if (sz == 0)
+      return false;  // end of stream
+    size += sz;
+  }
+
+  return true;
+}
+
+bool Hif_stream_read::next_stmt() {
+  if (!ok)
+    return false;
+
+  while (true) {
+    if (!fill(1))
+      return false;
+
+    auto frame = buffer[pos];
+    if (frame == stream_reset) {
+      id_txt.clear();
+      ids.clear();
+      ++pos;
+      continue;
+    }
+
+    if (frame == stream_ids) {
+      if (!fill(5))
+        break;
+      const uint8_t *ptr = &buffer[pos];
+      size_t         sz  = ptr[1] | (ptr[2] << 8) | (ptr[3] << 16)
+                  | (static_cast<uint32_t>(ptr[4]) << 24);
+      if (!fill(5 + sz))
+        break;
+      ptr = &buffer[pos];
+      if (!read_ids(ptr + 5, ptr + 5 + sz)) {
+        ok = false;
+        return false;
+      }
+      pos += 5 + sz;
+      continue;
+    }
+
+    // Statement, read more until its end is in the buffer
+    const uint8_t *end;
+    while ((end = Hif_scan::stmt_end(&buffer[pos], buffer.data() + size)) == nullptr) {
+      if (!fill(size - pos + 1))
+        break;
+    }
+    if (end == nullptr)
+      break;
+
+    if (!read_stmt(&buffer[pos], end)) {
+      ok = false;
+      return false;
+    }
+    pos = end - buffer.data();
+
+    return true;
+  }
+
+  std::cerr << "Hif_stream_read truncated HIF stream\n";
+  ok = false;
+  return false;
+}
+
+bool Hif_stream_read::read_ids(const uint8_t *ptr, const uint8_t *ptr_end) {
+  while (ptr < ptr_end) {
+    uint8_t  ttt   = *ptr & 0x07;
+    bool     small = (*ptr & 0x08) != 0;
+    uint32_t sz    = (*ptr) >> 4;
+    if (small) {
+      ptr += 1;
+    } else {
+      if (ptr + 3 > ptr_end)
+        break;
+      sz |= (ptr[1] | (ptr[2] << 8)) << 4;
+      ptr += 3;
+    }
+
+    if (ptr + sz > ptr_end || ttt > ID_cat::Custom_cat)
+      break;
+
+    id_entry ent;
+    ent.off = id_txt.size();
+    ent.sz  = sz;
+    ent.ttt = ttt;
+    ids.emplace_back(ent);
+    id_txt.append(reinterpret_cast<const char *>(ptr), sz);
+
+    ptr += sz;
+  }
+
+  if (ptr != ptr_end) {
+    std::cerr << "Hif_stream_read corrupted ID frame at ID " << ids.size() << "\n";
+    return false;
+  }
+
+  return true;
+}
+
+bool Hif_stream_read::read_ref(const uint8_t *&ptr, uint32_t &id) const {
+  id = *ptr >> 3;
+  if (*ptr & 1) {
+    ptr += 1;
+  } else {
+    id |= (ptr[1] | (ptr[2] << 8)) << 5;
+    ptr += 3;
+  }
+
+  if (id >= ids.size()) {
+    std::cerr << "Hif_stream_read undeclared ID " << id << "\n";
+    return false;
+  }
+  return true;
+}
+
+// stmt_end already checked the structure, ptr_end is the statement end
+bool Hif_stream_read::read_stmt(const uint8_t *ptr, const uint8_t *ptr_end) {
+  auto &stmt = cur_view;
+  stmt.clear();
+
+  uint8_t cccc = *ptr >> 4;
+  if (cccc > Statement_class::Use) {
+    std::cerr << "Hif_stream_read invalid cccc " << static_cast<int>(cccc) << "\n";
+    return false;
+  }
+  stmt.sclass = static_cast<Statement_class>(cccc);
+  stmt.type   = (*ptr & 0xF) | (ptr[1] << 4);
+  ptr += 2;
+
+  uint32_t id;
+  if (*ptr == 0xFF) {
+    ++ptr;
+  } else {
+    if (!read_ref(ptr, id))
+      return false;
+    stmt.instance = get_id(id);
+  }
+
+  for (auto *list : {&stmt.io, &stmt.attr}) {
+    int64_t lhs = -1;
+    while (*ptr != 0xFF) {
+      bool input = (*ptr >> 1) & 1;
+      bool last  = (*ptr >> 2) & 1;
+      if (!read_ref(ptr, id))
+        return false;
+
+      if (!last) {
+        if (lhs >= 0)
+          break;  // two lhs in a row
+        lhs = id;
+      } else if (lhs >= 0) {
+        list->emplace_back(input, get_id(lhs), get_id(id), get_cat(lhs), get_cat(id));
+        lhs = -1;
+      } else {
+        list->emplace_back(input, get_id(id), "", get_cat(id), ID_cat::String_cat);
+      }
+    }
+    if (*ptr != 0xFF || lhs >= 0) {
+      std::cerr << "Hif_stream_read corrupted statement entries\n";
+      return false;
+    }
+    ++ptr;
+  }
+
+  return ptr == ptr_end;
+}
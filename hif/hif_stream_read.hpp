@@ -0,0 +1,81 @@
+//  This file is distributed under the BSD 3-Clause License. See LICENSE for details.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "hif_base.hpp"
+
+// Reads a single stream HIF (Hif_write::create_stream) from a file descriptor, so
+// it works with pipes and sockets (no fstat or mmap). The bytes go through a buffer of
+// fixed size; a frame that does not fit is moved to the front and completed with the
+// next reads. Memory is the buffer plus the ID dictionary of the current chunk,
+// independent of the design size.
+class Hif_stream_read : public Hif_base {
+public:
+  // fd is not closed. buffer_size only grows for frames (statement or IDs) larger than
+  // it.
+  static std::shared_ptr<Hif_stream_read> open(int fd, size_t buffer_size = 1 << 20);
+
+  bool next_stmt();
+  Hif_base::Statement get_current_stmt() const { return cur_view.to_statement(); }
+  // The view is valid until the next call to next_stmt
+  const Hif_base::Statement_view &get_current_view() const { return cur_view; }
+
+  // fn takes a Statement_view (zero-copy) or a Statement
+  template <typename F>
+  void each(F &&fn) {
+    while (next_stmt()) {
+      if constexpr (std::is_invocable_v<F &, const Hif_base::Statement_view &>) {
+        fn(cur_view);
+      } else {
+        fn(cur_view.to_statement());
+      }
+    }
+  }
+
+  std::string_view get_tool() const { return tool; }
+  std::string_view get_version() const { return version; }
+
+  Hif_stream_read(int fd, size_t buffer_size);
+
+protected:
+  bool is_ok() const { return ok; }
+
+  // At least n bytes after pos in the buffer, false if the stream ends before
+  bool fill(size_t n);
+
+  bool read_ids(const uint8_t *ptr, const uint8_t *ptr_end);
+  bool read_ref(const uint8_t *&ptr, uint32_t &pos) const;
+  bool read_stmt(const uint8_t *ptr, const uint8_t *ptr_end);
+
+  struct id_entry {  // same as Hif_read, the text is in id_txt
+    uint32_t off;
+    uint32_t sz  : 28;
+    uint32_t ttt : 4;
+  };
+
+  std::string_view get_id(uint32_t id) const {
+    return std::string_view(id_txt).substr(ids[id].off, ids[id].sz);
+  }
+  ID_cat get_cat(uint32_t id) const { return static_cast<ID_cat>(ids[id].ttt); }
+
+  int                  fd;
+  std::vector<uint8_t> buffer;
+  size_t               pos  = 0;  // next frame
+  size_t               size = 0;  // bytes read in buffer
+  bool                 ok   = true;
+
+  std::string           id_txt;
+  std::vector<id_entry> ids;
+
+  Statement_view cur_view;
+
+  std::string tool;
+  std::string version;
+};
@@ -0,0 +1,735 @@
+//  This file is distributed under the BSD 3-Clause License. See LICENSE for details.
+
+#include "hif_text.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "file_write.hpp"
+#include "hif_const.hpp"
+#include "thread_pool.hpp"
+
+// Character classes of the scanner
+static constexpr uint8_t space_ch = 1;  // between tokens
+static constexpr uint8_t head_ch  = 2;  // ends a type or instance
+static constexpr uint8_t tuple_ch = 4;  // ends an io or attribute ID
+static constexpr uint8_t word_ch  = 8;  // statement class and io direction
+
+static constexpr std::array<uint8_t, 256> char_class = []() {
+  std::array<uint8_t, 256> t{};
+  for (auto c : {' ', '\t', '\r', '\n'}) {
+    t[static_cast<uint8_t>(c)] |= space_ch | head_ch;
+  }
+  for (auto c : {',', ')', '=', '\r', '\n'}) {
+    t[static_cast<uint8_t>(c)] |= tuple_ch;
+  }
+  t['('] |= head_ch;
+  for (int c = 'a'; c <= 'z'; ++c) {
+    t[c] |= word_ch;
+  }
+  t['_'] |= word_ch;
+  return t;
+}();
+
+static bool is(char c, uint8_t cl) { return char_class[static_cast<uint8_t>(c)] & cl; }
+
+static bool statement_class(std::string_view w, Hif_base::Statement_class &sclass) {
+  for (auto i = 0u; i < std::size(Hif_base::class_names); ++i) {
+    if (w == Hif_base::class_names[i]) {
+      sclass = static_cast<Hif_base::Statement_class>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+// p starts a statement: a class followed by a space, '(', '@' or the end
+static bool at_statement(const char *p, const char *end) {
+  auto *w = p;
+  while (p < end && is(*p, word_ch)) {
+    ++p;
+  }
+  if (p < end && !is(*p, space_ch) && *p != '(' && *p != '@')
+    return false;
+
+  Hif_base::Statement_class sclass;
+  return statement_class(std::string_view(w, p - w), sclass);
+}
+
+// First line at or after p whose first token is a statement class
+static const char *next_statement(const char *p, const char *end) {
+  while (p < end) {
+    auto *nl = static_cast<const char *>(memchr(p, '\n', end - p));
+    if (nl == nullptr)
+      return end;
+
+    p = nl + 1;
+    while (p < end && (*p == ' ' || *p == '\t')) {
+      ++p;
+    }
+    if (p < end && at_statement(p, end))
+      return p;
+  }
+  return end;
+}
+
+static int hex_digit(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+// Numbers in a bare io/attribute ID (see the header). Others stay strings.
+static void classify(std::string_view &txt, std::string &scratch, Hif_base::ID_cat &cat) {
+  if (txt.find('\'') != std::string_view::npos) {
+    auto ncat = Hif_base::String_cat;
+    if (Hif_const::from_verilog(txt, scratch, ncat)) {
+      txt = scratch;
+      cat = ncat;
+    }
+    return;
+  }
+
+  auto c = txt[0];
+  if ((c >= '0' && c <= '9') || c == '-') {
+    auto digits    = txt.substr(c == '-');  // no leading zeros, "-0" or "-"
+    bool canonical = !digits.empty() && (digits[0] != '0' || txt == "0");
+
+    int64_t v;
+    auto [p, ec] = std::from_chars(txt.data(), txt.data() + txt.size(), v);
+    if (canonical && ec == std::errc() && p == txt.data() + txt.size()) {
+      scratch.assign(reinterpret_cast<const char *>(&v), sizeof(v));
+      txt = scratch;
+      cat = Hif_base::Base2_cat;
+      return;
+    }
+  }
+
+  if (txt.size() < 3 || txt[0] != '0' || txt[1] != 'x')
+    return;
+
+  auto digits = txt.substr(2);
+  auto ncat   = Hif_base::Base2_cat;
+  auto colon  = digits.find(':');
+  if (colon != std::string_view::npos) {
+    auto suffix = digits.substr(colon + 1);
+    if (suffix == "base3")
+      ncat = Hif_base::Base3_cat;
+    else if (suffix == "base4")
+      ncat = Hif_base::Base4_cat;
+    else if (suffix == "custom")
+      ncat = Hif_base::Custom_cat;
+    else
+      return;
+    digits = digits.substr(0, colon);
+  }
+  if (digits.empty())
+    return;
+
+  // little endian, the last digits are the first byte
+  scratch.assign((digits.size() + 1) / 2, 0);
+  for (auto i = 0u; i < digits.size(); ++i) {
+    auto d = hex_digit(digits[digits.size() - 1 - i]);
+    if (d < 0)
+      return;
+    scratch[i / 2] |= static_cast<char>(d << (4 * (i & 1)));
+  }
+  txt = scratch;
+  cat = ncat;
+}
+
+namespace {
+
+struct Text_parser {
+  Text_parser(const char *p, const char *e, const Hif_text::Options &o)
+      : ptr(p), end(e), opt(o) {}
+
+  const char              *ptr;
+  const char              *end;
+  const Hif_text::Options &opt;
+
+  const char *err_pos = nullptr;  // first error
+  std::string err_msg;
+
+  std::string scratch[3];  // type/lhs, instance/rhs, escapes
+
+  bool error(const char *p, std::string_view msg) {
+    if (err_pos == nullptr) {
+      err_pos = p;
+      err_msg = msg;
+    }
+    ptr = end;
+    return false;
+  }
+
+  void skip_space() {
+    while (ptr < end && is(*ptr, space_ch)) {
+      ++ptr;
+    }
+  }
+  void skip_blank() {  // same line
+    while (ptr < end && (*ptr == ' ' || *ptr == '\t' || *ptr == '\r')) {
+      ++ptr;
+    }
+  }
+  bool at_attrs() const { return ptr + 1 < end && ptr[0] == '@' && ptr[1] == '('; }
+
+  std::string_view read_word() {
+    auto *w = ptr;
+    while (ptr < end && is(*ptr, word_ch)) {
+      ++ptr;
+    }
+    return std::string_view(w, ptr - w);
+  }
+
+  // Escape at p (after the backslash) to out, returns the next position
+  const char *unescape(const char *p, std::string &out) {
+    if (p >= end)
+      return p;
+    switch (*p) {
+      case 'n': out.push_back('\n'); return p + 1;
+      case 't': out.push_back('\t'); return p + 1;
+      case 'r': out.push_back('\r'); return p + 1;
+      case 'x':
+        if (p + 2 < end && hex_digit(p[1]) >= 0 && hex_digit(p[2]) >= 0) {
+          out.push_back(static_cast<char>(hex_digit(p[1]) << 4 | hex_digit(p[2])));
+          return p + 3;
+        }
+        break;
+    }
+    out.push_back(*p);
+    return p + 1;
+  }
+
+  bool read_quoted(std::string &buf, std::string_view &txt) {
+    auto *start = ++ptr;
+    bool  esc   = false;
+    while (ptr < end && *ptr != '"') {
+      if (*ptr == '\n')
+        break;
+      esc |= *ptr == '\\';
+      ptr += *ptr == '\\' ? 2 : 1;
+    }
+    if (ptr >= end || *ptr != '"')
+      return error(start - 1, "unterminated string");
+
+    if (!esc) {
+      txt = std::string_view(start, ptr - start);
+    } else {
+      buf.clear();
+      for (auto *p = start; p < ptr;) {
+        p = *p == '\\' ? unescape(p + 1, buf) : (buf.push_back(*p), p + 1);
+      }
+      txt = buf;
+    }
+    ++ptr;
+    return true;
+  }
+
+  // Type or instance (head) or io/attribute ID (tuple, numbers are converted)
+  bool read_id(bool tuple, std::string &buf, std::string_view &txt,
+               Hif_base::ID_cat &cat) {
+    cat = Hif_base::String_cat;
+    if (ptr < end && *ptr == '"')
+      return read_quoted(buf, txt);
+
+    auto   *start = ptr;
+    bool    esc   = false;
+    uint8_t stop  = tuple ? tuple_ch : head_ch;
+    while (ptr < end && !is(*ptr, stop)) {
+      if (!tuple && at_attrs())
+        break;
+      if (*ptr == '\\') {
+        esc = true;
+        ptr = std::min(ptr + 2, end);
+        continue;
+      }
+      ++ptr;
+    }
+
+    auto *tail = ptr;
+    if (tuple) {  // spaces inside are kept, not around
+      while (tail > start && (tail[-1] == ' ' || tail[-1] == '\t')
+             && !(tail - 1 > start && tail[-2] == '\\')) {
+        --tail;
+      }
+    }
+    if (tail == start)
+      return error(start, "expected an ID");
+
+    if (!esc) {
+      txt = std::string_view(start, tail - start);
+      if (tuple)
+        classify(txt, buf, cat);
+      return true;
+    }
+
+    buf.clear();
+    for (auto *p = start; p < tail;) {
+      p = *p == '\\' ? unescape(p + 1, buf) : (buf.push_back(*p), p + 1);
+    }
+    txt = buf;
+    return true;
+  }
+
+  bool type_number(std::string_view txt, uint16_t &type) const {
+    unsigned v;
+    auto [p, ec] = std::from_chars(txt.data(), txt.data() + txt.size(), v);
+    if (ec == std::errc() && p == txt.data() + txt.size() && v < 4096) {
+      type = v;
+      return true;
+    }
+    if (opt.types.empty())
+      return false;
+    auto it = opt.types.find(std::string(txt));
+    if (it == opt.types.end())
+      return false;
+    type = it->second;
+    return true;
+  }
+
+  bool parse_tuple(Hif_write::Statement_builder &bld, bool io) {
+    ptr += io ? 1 : 2;  // ( or @(
+    skip_space();
+    if (ptr < end && *ptr == ')') {
+      ++ptr;
+      return true;
+    }
+
+    while (true) {
+      bool input = true;
+      if (io) {
+        auto *dir = ptr;
+        auto  w   = read_word();
+        if ((w != "input" && w != "output") || ptr >= end || !is(*ptr, space_ch))
+          return error(dir, "expected input or output");
+        input = w == "input";
+        skip_space();
+      }
+
+      std::string_view l, r;
+      auto             lc = Hif_base::String_cat;
+      auto             rc = Hif_base::String_cat;
+      if (!read_id(true, scratch[0], l, lc))
+        return false;
+      skip_space();
+      if (ptr < end && *ptr == '=') {
+        ++ptr;
+        skip_space();
+        if (!read_id(true, scratch[1], r, rc))
+          return false;
+        skip_space();
+      }
+
+      if (io) {
+        bld.add_io(input, l, r, lc, rc);
+      } else if (l.empty()) {
+        return error(ptr, "empty attribute name");
+      } else {
+        bld.add_attr(l, r, lc, rc);
+      }
+
+      if (ptr < end && *ptr == ',') {
+        ++ptr;
+        skip_space();
+        continue;
+      }
+      if (ptr < end && *ptr == ')') {
+        ++ptr;
+        return true;
+      }
+      return error(ptr, "expected , or )");
+    }
+  }
+
+  bool parse_stmt(Hif_write::Statement_builder &bld) {
+    auto *start = ptr;
+
+    Hif_base::Statement_class sclass;
+    if (!statement_class(read_word(), sclass))
+      return error(start, "expected a statement class");
+    bld.reset(sclass);
+
+    // type and instance, on the class line
+    std::string_view head[2];
+    int              nhead = 0;
+    skip_blank();
+    while (ptr < end && *ptr != '\n' && *ptr != '(' && !at_attrs()) {
+      if (nhead == 2)
+        return error(ptr, "expected ( or @( after the instance");
+      Hif_base::ID_cat cat;
+      if (!read_id(false, scratch[nhead], head[nhead], cat))
+        return false;
+      ++nhead;
+      skip_blank();
+    }
+    if (nhead == 2) {
+      if (!type_number(head[0], bld.type))
+        return error(start, "unknown type " + std::string(head[0]));
+      bld.set_instance(head[1]);
+    } else if (nhead == 1 && !type_number(head[0], bld.type)) {
+      bld.set_instance(head[0]);  // a single ID is the type only if it is one
+    }
+
+    skip_space();
+    if (ptr < end && *ptr == '(' && !parse_tuple(bld, true))
+      return false;
+    skip_space();
+    if (at_attrs() && !parse_tuple(bld, false))
+      return false;
+
+    return true;
+  }
+
+  // Statements that start before stop. ptr is left at the first one not parsed.
+  bool parse(Hif_write &wr, const char *stop) {
+    auto &bld = wr.builder();
+    while (true) {
+      skip_space();
+      if (ptr >= end || ptr >= stop)
+        return true;
+      if (!parse_stmt(bld))
+        return false;
+      wr.add(bld);
+    }
+  }
+
+  bool parse_header(std::string &tool, std::string &version) {
+    skip_space();
+    auto *start = ptr;
+
+    Hif_write::Statement_builder bld;
+    if (!parse_stmt(bld))
+      return false;
+
+    const auto &stmt = bld.get_view();
+    for (const auto &a : stmt.attr) {
+      auto txt
+          = a.is_rhs_int64() ? std::to_string(a.get_rhs_int64()) : std::string(a.rhs);
+      if (a.lhs == "tool")
+        tool = txt;
+      else if (a.lhs == "version")
+        version = txt;
+    }
+    if (stmt.sclass != Hif_base::Statement_class::Attr || tool.empty())
+      return error(start, "the first statement must be attr @(tool=..., version=...)");
+
+    return true;
+  }
+};
+
+}  // namespace
+
+bool Hif_text::parse_file(std::string_view fname, std::string_view out) {
+  return parse_file(fname, out, Options());
+}
+
+bool Hif_text::parse_file(std::string_view fname, std::string_view out,
+                          const Options &opt) {
+  std::string name(fname.data(), fname.size());
+
+  int fd = ::open(name.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::cerr << "Hif_text could not open " << fname << "\n";
+    return false;
+  }
+
+  struct stat sb;
+  if (fstat(fd, &sb) == -1 || sb.st_size == 0) {
+    std::cerr << "Hif_text empty or unreadable " << fname << "\n";
+    ::close(fd);
+    return false;
+  }
+
+  auto ptr = mmap(0, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (ptr == MAP_FAILED) {
+    std::cerr << "Hif_text could not map " << fname << "\n";
+    return false;
+  }
+  madvise(ptr, sb.st_size, MADV_SEQUENTIAL);
+
+  bool ok = parse(std::string_view(static_cast<const char *>(ptr), sb.st_size), fname,
+                  out, opt);
+
+  munmap(ptr, sb.st_size);
+
+  return ok;
+}
+
+bool Hif_text::parse(std::string_view txt, std::string_view out) {
+  return parse(txt, out, Options());
+}
+
+bool Hif_text::parse(std::string_view txt, std::string_view out, const Options &opt) {
+  return parse(txt, "text", out, opt);
+}
+
+bool Hif_text::parse(std::string_view txt, std::string_view name, std::string_view out,
+                     const Options &opt) {
+  auto *begin = txt.data();
+  auto *end   = txt.data() + txt.size();
+
+  auto report = [&](const char *pos, const std::string &msg) {
+    auto line = 1 + std::count(begin, pos, '\n');
+    std::cerr << "Hif_text " << name << ":" << line << ": " << msg << "\n";
+    return false;
+  };
+
+  std::string tool;
+  std::string version;
+  Text_parser header(begin, end, opt);
+  if (!header.parse_header(tool, version))
+    return report(header.err_pos, header.err_msg);
+
+  auto wr = Hif_write::create(out, tool, version, opt.write);
+  if (wr == nullptr)
+    return false;
+
+  // Pieces start at lines with a statement class. A line inside a statement can look
+  // like one (e.g. an attribute value "end" after a newline), so each piece checks
+  // that it stopped where the next one starts, or everything is parsed again in order.
+  auto nthreads = opt.nthreads ? opt.nthreads : Thread_pool::default_threads();
+  auto body     = header.ptr;
+  auto npieces  = std::clamp<size_t>((end - body) / std::max<size_t>(opt.piece_size, 1),
+                                    1,
+                                    nthreads);
+
+  std::vector<const char *> starts{body};
+  for (auto k = 1u; k < npieces; ++k) {
+    auto *p = next_statement(body + (end - body) * k / npieces - 1, end);
+    if (p > starts.back() && p < end)
+      starts.emplace_back(p);
+  }
+  starts.emplace_back(end);
+  npieces = starts.size() - 1;
+
+  std::vector<std::shared_ptr<Hif_write>> writers{wr};
+  for (auto k = 1u; k < npieces; ++k) {
+    writers.emplace_back(wr->thread_writer());  // creation order is the chunk order
+  }
+
+  std::vector<std::unique_ptr<Text_parser>> parsers(npieces);
+  Thread_pool::run(npieces, nthreads, [&](size_t k, unsigned) {
+    parsers[k] = std::make_unique<Text_parser>(starts[k], end, opt);
+    parsers[k]->parse(*writers[k], starts[k + 1]);
+    writers[k] = nullptr;  // closes its last chunk
+  });
+  wr = nullptr;
+
+  for (auto k = 0u; k < npieces; ++k) {
+    const auto &p = *parsers[k];
+    if (p.err_pos)
+      return report(p.err_pos, p.err_msg);
+    if (p.ptr != starts[k + 1]) {
+      auto seq     = opt;
+      seq.nthreads = 1;
+      return parse(txt, name, out, seq);
+    }
+  }
+
+  return true;
+}
+
+static void append_int(std::string &out, int64_t v) {
+  char buf[24];
+  auto [p, ec] = std::to_chars(buf, buf + sizeof(buf), v);
+  out.append(buf, p - buf);
+}
+
+static void append_hex(std::string &out, std::string_view bytes) {  // last byte first
+  static constexpr char digits[] = "0123456789abcdef";
+  for (auto i = bytes.size(); i-- > 0;) {
+    auto b = static_cast<uint8_t>(bytes[i]);
+    out.push_back(digits[b >> 4]);
+    out.push_back(digits[b & 0xF]);
+  }
+}
+
+// Bare when the parser reads it back the same (see read_id), quoted otherwise
+static void append_id(std::string &out, std::string_view txt, bool tuple) {
+  bool bare = !txt.empty() && txt[0] != '"';
+  if (bare && tuple) {
+    bare = !is(txt.front(), space_ch) && !is(txt.back(), space_ch);
+    if (bare) {
+      std::string      scratch;
+      std::string_view num  = txt;
+      auto             cat  = Hif_base::String_cat;
+      classify(num, scratch, cat);
+      bare = cat == Hif_base::String_cat;
+    }
+  } else if (bare) {
+    bare = txt.find("@(") == std::string_view::npos;
+  }
+  uint8_t stop = tuple ? tuple_ch : head_ch;
+  for (auto i = 0u; bare && i < txt.size(); ++i) {
+    auto c = static_cast<uint8_t>(txt[i]);
+    bare   = c >= 0x20 && c != 0x7F && c != '\\' && !is(c, stop);
+  }
+  if (bare) {
+    out.append(txt);
+    return;
+  }
+
+  out.push_back('"');
+  for (auto ch : txt) {
+    auto c = static_cast<uint8_t>(ch);
+    if (c == '"' || c == '\\') {
+      out.push_back('\\');
+      out.push_back(ch);
+    } else if (c == '\n') {
+      out.append("\\n");
+    } else if (c == '\t') {
+      out.append("\\t");
+    } else if (c == '\r') {
+      out.append("\\r");
+    } else if (c < 0x20 || c == 0x7F) {
+      out.append("\\x");
+      append_hex(out, std::string_view(&ch, 1));
+    } else {
+      out.push_back(ch);
+    }
+  }
+  out.push_back('"');
+}
+
+static void append_value(std::string &out, std::string_view txt, Hif_base::ID_cat cat) {
+  if (cat == Hif_base::String_cat) {
+    append_id(out, txt, true);
+  } else if (cat == Hif_base::Base2_cat && txt.size() == sizeof(int64_t)) {
+    int64_t v;
+    memcpy(&v, txt.data(), sizeof(v));
+    append_int(out, v);
+  } else if ((cat == Hif_base::Base3_cat || cat == Hif_base::Base4_cat)
+             && Hif_const::is_canonical(cat, txt)) {
+    out.append(Hif_const::to_verilog(cat, txt));
+  } else {
+    out.append("0x");
+    append_hex(out, txt);
+    if (cat != Hif_base::Base2_cat) {
+      out.push_back(':');
+      out.append(Hif_base::cat_name(cat));
+    }
+  }
+}
+
+template <typename S>
+static void format_text(std::string &out, const S &stmt) {
+  out.append(Hif_base::class_names[stmt.sclass]);
+  if (!stmt.instance.empty()) {  // a single ID would be the type if it is a number
+    out.push_back(' ');
+    append_int(out, stmt.type);
+    out.push_back(' ');
+    append_id(out, stmt.instance, false);
+  } else if (stmt.type) {
+    out.push_back(' ');
+    append_int(out, stmt.type);
+  }
+
+  for (const auto *list : {&stmt.io, &stmt.attr}) {
+    if (list->empty())
+      continue;
+    bool io = list == &stmt.io;
+    out.append(io ? "\n  (" : "\n  @(");
+    for (auto i = 0u; i < list->size(); ++i) {
+      const auto &e = (*list)[i];
+      if (i)
+        out.append(", ");
+      if (io)
+        out.append(e.input ? "input " : "output ");
+      append_value(out, e.lhs, e.lhs_cat);
+      if (!e.rhs.empty()) {
+        out.push_back('=');
+        append_value(out, e.rhs, e.rhs_cat);
+      }
+    }
+    out.push_back(')');
+  }
+  out.push_back('\n');
+}
+
+void Hif_text::format(std::string &out, const Statement &stmt, Style style) {
+  if (style == Style::Text)
+    format_text(out, stmt);
+  else
+    Hif_base::format_dump(out, stmt);
+}
+
+void Hif_text::format(std::string &out, const Statement_view &stmt, Style style) {
+  if (style == Style::Text)
+    format_text(out, stmt);
+  else
+    Hif_base::format_dump(out, stmt);
+}
+
+void Hif_text::format_header(std::string &out, std::string_view tool,
+                             std::string_view version, Style style) {
+  if (style == Style::Dump) {
+    out.append("HIF version:");
+    out.append(hif_version);
+    out.append(" tool:");
+    out.append(tool);
+    out.append(" version:");
+    out.append(version);
+    out.push_back('\n');
+    return;
+  }
+
+  out.append("attr\n  @(tool=");
+  append_id(out, tool, true);
+  out.append(", version=");
+  append_id(out, version, true);
+  out.append(")\n");
+}
+
+void Hif_text::format_entries(std::string &out, const std::vector<Tuple_entry> &entries,
+                              bool is_attr) {
+  Hif_base::format_dump_entries(out, entries, is_attr);
+}
+
+bool Hif_text::write(Hif_read &rd, int fd, Style style, unsigned nthreads) {
+  int wfd = dup(fd);  // File_write closes its fd
+  if (wfd < 0) {
+    std::cerr << "Hif_text::write invalid fd " << fd << "\n";
+    return false;
+  }
+
+  // Segment texts are bigger than the buffer, so they are written without a copy
+  File_write::Options fopt;
+  fopt.buffer_size = 1 << 16;
+  File_write out(wfd, fopt);
+
+  std::string header;
+  format_header(header, rd.get_tool(), rd.get_version(), style);
+  out.add(header);
+
+  rd.parallel_format(
+      nthreads,
+      [style](std::span<const Statement_view> batch, std::string &buf) {
+        for (const auto &stmt : batch) {
+          format(buf, stmt, style);
+        }
+      },
+      [&out](std::string &buf) { out.add(buf); });
+
+  if (!out.flush_all()) {
+    std::cerr << "Hif_text::write could not write to fd " << fd << "\n";
+    return false;
+  }
+
+  return true;
+}
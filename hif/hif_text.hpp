@@ -0,0 +1,81 @@
+//  This file is distributed under the BSD 3-Clause License. See LICENSE for details.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "hif_base.hpp"
+#include "hif_read.hpp"
+#include "hif_write.hpp"
+
+// Text HIF (the grammar in the README) to binary HIF and back:
+//
+//   attr @(tool=lgraph, version=0.1)
+//   closed_def 3 top
+//     (input a, output z)
+//   node 7 u1 (output Z=w1, input A=a) @(loc=3)
+//   end
+//
+// The first statement has the tool and version. The type and instance go on the
+// class line, the ios and attributes can continue on the next lines. type is the 12
+// bit number or a name in Options::types. In ios and attributes:
+//
+//   foo bar            string (spaces inside are kept, \, \) \= \\ \n \xHH escape)
+//   "foo,bar"          quoted string, never a number
+//   -12                Base2 int64 (canonical decimals only, 012 is a string)
+//   0x1f00             Base2 bytes, the number in hex (2 digits per byte)
+//   0x1f00:base3       same for Base3, Base4 and Custom (:base4, :custom)
+//   8'b10xz            Base2/3/4 from a Verilog literal (Hif_const, 'o 'd 'h too)
+//
+// Big files are split at lines that start with a statement class and parsed in
+// parallel, one thread writer per piece so the chunks keep the text order. format
+// writes the same syntax (or the Statement::dump one), appending to a string with
+// std::to_chars, so formatting does not go through iostreams.
+class Hif_text : public Hif_base {
+public:
+  struct Options {
+    Hif_write::Options write;
+
+    unsigned nthreads   = 0;        // 0 is Thread_pool::default_threads
+    size_t   piece_size = 1 << 24;  // minimum text bytes per thread
+
+    std::unordered_map<std::string, uint16_t> types;  // type names to type numbers
+  };
+
+  // Parses the text file fname (mapped, not read) into a new HIF out (a directory or a
+  // pack, see Hif_write::create). Errors go to std::cerr with the line number, and out
+  // is left incomplete.
+  static bool parse_file(std::string_view fname, std::string_view out);
+  static bool parse_file(std::string_view fname, std::string_view out,
+                         const Options &opt);
+
+  // Same for text in memory
+  static bool parse(std::string_view txt, std::string_view out);
+  static bool parse(std::string_view txt, std::string_view out, const Options &opt);
+
+  // Text is the grammar above (parse reads it back), Dump the Statement::dump style
+  enum class Style { Text, Dump };
+
+  // Appends the statement text to out, without allocating once out has the capacity
+  static void format(std::string &out, const Statement &stmt, Style style);
+  static void format(std::string &out, const Statement_view &stmt, Style style);
+  // The tool/version attr of a Text file, the HIF version line of hif_cat for Dump
+  static void format_header(std::string &out, std::string_view tool,
+                            std::string_view version, Style style);
+  // Dump style io or attribute list (Hif_base::format_dump_entries)
+  static void format_entries(std::string &out, const std::vector<Tuple_entry> &entries,
+                             bool is_attr);
+
+  // Writes the design to fd (not closed). Segments are formatted on nthreads workers
+  // (0 is Thread_pool::default_threads) and written in file order. false if a write
+  // to fd failed.
+  static bool write(Hif_read &rd, int fd, Style style, unsigned nthreads = 0);
+
+protected:
+  static bool parse(std::string_view txt, std::string_view name, std::string_view out,
+                    const Options &opt);
+};
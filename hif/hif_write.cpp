@@ -9,22 +9,103 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <iostream>
+#include <mutex>
+#include <numeric>
+
+#include "hif_checksum.hpp"
+#include "hif_hash.hpp"
+#include "hif_pack.hpp"
+#include "hif_scan.hpp"
+
+// Chunk count of every writer sharing a directory. The last writer to go away
+// renames the thread writer chunks to their final numbers.
+struct Hif_write::Shared_dir {
+  std::string           dname;
+  std::string           pack;  // single file HIF built from dname at the end
+  uint32_t              pack_first = UINT32_MAX;  // open_append: first chunk in dname
+  std::mutex            mtx;
+  std::vector<uint32_t> slot_chunks{0};  // slot 0 is the creating writer
+  uint32_t              open_writers = 1;  // the last one to close calls finish
+
+  // Numbers the thread writer chunks after the slot 0 ones and builds the pack
+  bool finish() {
+    static constexpr const char *exts[] = {".st", ".id", ".ix", ".nx", ".ck"};
+
+    bool     ok   = true;
+    uint32_t next = slot_chunks[0];
+    for (auto slot = 1u; slot < slot_chunks.size(); ++slot) {
+      for (auto m = 0u; m < slot_chunks[slot]; ++m) {
+        auto base = dname + "/t" + std::to_string(slot) + "_" + std::to_string(m);
+
+        struct stat sb;
+        bool        empty = stat((base + ".st").c_str(), &sb) != 0 || sb.st_size == 0;
+        for (auto ext : exts) {
+          auto from = base + ext;
+          if (empty) {
+            remove(from.c_str());  // thread writer without statements
+          } else if (access(from.c_str(), F_OK) == 0) {
+            auto to = dname + "/" + std::to_string(next) + ext;
+            if (rename(from.c_str(), to.c_str()) != 0) {
+              std::cerr << "Hif_write could not rename " << from << " to " << to << "\n";
+              ok = false;
+            }
+          }
+        }
+        if (!empty)
+          ++next;
+      }
+    }
+
+    if (!ok) {
+      return false;  // a pack would miss chunks, keep dname
+    }
+    if (!pack.empty() && pack_first == UINT32_MAX) {
+      ok = Hif_pack::pack(dname, pack, true);
+    } else if (!pack.empty()) {
+      ok = Hif_pack::append(dname, pack, pack_first, true);
+    }
+    if (!ok) {
+      std::cerr << "Hif_write could not create " << pack << "\n";
+    }
+    return ok;
+  }
+};
 
 std::shared_ptr<Hif_write> Hif_write::create(std::string_view fname,
                                              std::string_view tool,
                                              std::string_view version) {
-  auto ptr = std::make_shared<Hif_write>(fname, tool, version);
+  return create(fname, tool, version, Options());
+}
+
+std::shared_ptr<Hif_write> Hif_write::create(std::string_view fname,
+                                             std::string_view tool,
+                                             std::string_view version,
+                                             const Options   &opt) {
+  auto ptr = std::make_shared<Hif_write>(fname, tool, version, opt);
 
   return ptr->is_ok() ? ptr : nullptr;
 }
 
 Hif_write::Hif_write(std::string_view fname, std::string_view tool,
-                     std::string_view version) {
+                     std::string_view version)
+    : Hif_write(fname, tool, version, Options()) {}
+
+Hif_write::Hif_write(std::string_view fname, std::string_view tool,
+                     std::string_view version, const Options &_opt)
+    : opt(_opt), index(_opt.index_stride) {
   std::string sname(fname.data(), fname.size());
 
+  // Packs are written as a directory next to them and packed by the last writer
+  std::string pack;
+  if (is_pack_name(sname)) {
+    pack = sname;
+    sname += ".tmp";
+  }
+
   const char *path = sname.c_str();
 
   DIR *dir = opendir(path);
@@ -35,22 +116,15 @@ Hif_write::Hif_write(std::string_view fname, std::string_view tool,
       std::string_view sv(dirp->d_name, strlen(dirp->d_name));
       if (sv == ".." || sv == ".")
         continue;
-      if (sv == "0.st" || sv == "0.id")
-        continue;
 
-      bool unexpected_file = !std::isdigit(sv[0]) || sv.size() < 4;
-      if (!unexpected_file) {
-        auto end_sv     = sv.substr(sv.size() - 3);
-        unexpected_file = (end_sv != ".st" && end_sv != ".id");
-      }
-
-      if (unexpected_file) {
+      if (!is_chunk_file(sv) && !is_thread_chunk_file(sv)) {
         std::cerr << "Hif_write::create directory " << fname << " has extra files like "
                   << sv << " (aborting)\n";
+        closedir(dir);
         return;
       }
 
-      remove(dirp->d_name);
+      remove((sname + "/" + std::string(sv)).c_str());
     }
     closedir(dir);
   } else {
@@ -60,17 +134,594 @@ Hif_write::Hif_write(std::string_view fname, std::string_view tool,
     }
   }
 
-  stbuff = File_write::create(sname + "/" + "0.st");
-  idbuff = File_write::create(sname + "/" + "0.id");
+  dname         = sname;
+  shared        = std::make_shared<Shared_dir>();
+  shared->dname = sname;
+  shared->pack  = pack;
+  if (!open_chunk()) {
+    return;
+  }
+
+  add_hif_header(tool, version);
+}
+
+std::shared_ptr<Hif_write> Hif_write::create_stream(int fd, std::string_view tool,
+                                                    std::string_view version) {
+  return create_stream(fd, tool, version, Options());
+}
+
+std::shared_ptr<Hif_write> Hif_write::create_stream(int fd, std::string_view tool,
+                                                    std::string_view version,
+                                                    const Options   &opt) {
+  auto ptr = std::make_shared<Hif_write>(fd, tool, version, opt);
+
+  return ptr->is_ok() ? ptr : nullptr;
+}
+
+Hif_write::Hif_write(int fd, std::string_view tool, std::string_view version,
+                     const Options &_opt)
+    : opt(_opt), index(0) {
+  opt.rank_short_refs = false;  // statements go out as they are added
+  opt.index_stride    = 0;
+
+  int sfd = dup(fd);  // File_write closes its fd
+  if (sfd < 0) {
+    std::cerr << "Hif_write::create_stream invalid file descriptor " << fd << "\n";
+    return;
+  }
+
+  File_write::Options fopt;
+  fopt.buffer_size = opt.io_buffer_size;
+  fopt.async       = opt.async_io;
+
+  stream = std::make_shared<File_write>(sfd, fopt);
+  for (auto c : stream_magic) {
+    stream->add8(c);
+  }
+
+  if (!open_chunk()) {
+    return;
+  }
+
+  add_hif_header(tool, version);
+}
+
+// Module hash contribution of a statement, from the ID text and not the positions.
+// Entries are hashed as they read back (a rhs without lhs is a lhs, no rhs category,
+// attrs without input), so load_chunk gets the same hash from the files.
+template <typename S>
+static uint64_t stmt_hash(const S &stmt) {
+  uint64_t h = Hif_hash::hash64(stmt.instance, (stmt.sclass << 12) | stmt.type);
+
+  auto add = [&h](bool input, std::string_view lhs, std::string_view rhs, int lhs_cat,
+                  int rhs_cat) {
+    if (lhs.empty()) {
+      std::swap(lhs, rhs);
+      std::swap(lhs_cat, rhs_cat);
+    }
+    int cats = (lhs_cat << 1) | (rhs.empty() ? 0 : rhs_cat << 4);
+    h        = Hif_hash::combine(h, (input ? 1 : 0) | cats);
+    h = Hif_hash::hash64(lhs, h);
+    h = Hif_hash::hash64(rhs, h);
+  };
+  for (const auto &ent : stmt.io) {
+    add(ent.input, ent.lhs, ent.rhs, ent.lhs_cat, ent.rhs_cat);
+  }
+  h = Hif_hash::combine(h, 0xFF);  // end of ios
+  for (const auto &ent : stmt.attr) {
+    add(false, ent.lhs, ent.rhs, ent.lhs_cat, ent.rhs_cat);
+  }
+
+  return h;
+}
+
+template <typename S>
+void Hif_write::track_stmt(const S &stmt, uint64_t pos) {
+  index.add_stmt(pos);
+  if (stmt.is_open_def() || stmt.is_closed_def()) {
+    std::vector<Hif_index::Port> ports;
+    for (const auto &ent : stmt.io) {
+      std::string_view name = ent.lhs.empty() ? ent.rhs : ent.lhs;
+      ports.emplace_back(Hif_index::Port{std::string(name), ent.input});
+    }
+    index.add_module(stmt.instance, std::move(ports));
+  }
+  if (is_scope_begin(stmt.sclass))
+    index.open_scope(pos);
+
+  if (index.in_module())
+    index.add_hash(stmt_hash(stmt));
+}
+
+std::shared_ptr<Hif_write> Hif_write::open_append(std::string_view fname) {
+  return open_append(fname, Options());
+}
+
+std::shared_ptr<Hif_write> Hif_write::open_append(std::string_view fname,
+                                                  const Options   &opt) {
+  std::string sname(fname.data(), fname.size());
+
+  // Packs: only the last chunk, and the one before for its N.ix, go to fname.tmp.
+  // The chunks from the last one are replaced in the pack at the end.
+  std::string pack;
+  uint32_t    last = 0;
+  struct stat sb;
+  if (stat(sname.c_str(), &sb) == 0 && S_ISREG(sb.st_mode)) {
+    pack    = sname;
+    sname  += ".tmp";
+    auto pk = Hif_pack::open(pack);
+    if (pk == nullptr) {
+      std::cerr << "Hif_write::open_append " << pack << " is not a HIF pack\n";
+      return nullptr;
+    }
+    for (const auto &f : pk->get_files()) {
+      if (f.name.size() > 3 && f.name.substr(f.name.size() - 3) == ".st")
+        last = std::max<uint32_t>(last, std::stoul(std::string(f.name)));
+    }
+    pk = nullptr;
+    if (!Hif_pack::unpack(pack, sname, last ? last - 1 : 0))
+      return nullptr;
+  }
+
+  std::shared_ptr<Hif_write> ptr(new Hif_write(opt));
+  if (!ptr->append_dir(sname, pack, pack.empty() ? UINT32_MAX : last)) {
+    return nullptr;
+  }
+
+  return ptr;
+}
+
+bool Hif_write::append_dir(const std::string &sname, const std::string &pack,
+                           uint32_t pack_first) {
+  DIR *dir = opendir(sname.c_str());
+  if (dir == nullptr) {
+    std::cerr << "Hif_write::open_append could not open " << sname << "\n";
+    return false;
+  }
+
+  int64_t        last = -1;
+  bool           ok   = true;
+  struct dirent *dirp;
+  while ((dirp = readdir(dir)) != NULL) {
+    std::string_view sv(dirp->d_name, strlen(dirp->d_name));
+    if (is_thread_chunk_file(sv)) {
+      ok = false;  // a writer did not finish
+    } else if (is_chunk_file(sv) && sv.substr(sv.size() - 3) == ".st") {
+      last = std::max<int64_t>(last, std::stoll(std::string(sv)));
+    }
+  }
+  closedir(dir);
+
+  if (!ok || last < 0) {
+    std::cerr << "Hif_write::open_append " << sname << " is not a complete HIF\n";
+    return false;
+  }
+
+  dname              = sname;
+  shared             = std::make_shared<Shared_dir>();
+  shared->dname      = sname;
+  shared->pack       = pack;
+  shared->pack_first = pack_first;
+  chunk_num          = last;
+
+  auto base = chunk_base();
+  if (!opt.rank_short_refs && !opt.codec && load_chunk(base)) {
+    File_write::Options fopt;
+    fopt.buffer_size = opt.io_buffer_size;
+    fopt.async       = opt.async_io;
+    fopt.crc_block   = opt.checksum_block;
+
+    stbuff = File_write::append(base + ".st", fopt);
+    idbuff = File_write::append(base + ".id", fopt);
+    remove((base + ".nx").c_str());  // stale, Hif_read builds it again
+    remove((base + ".ck").c_str());  // written again by close_chunk if enabled
+
+    if (stbuff == nullptr || idbuff == nullptr) {
+      stbuff = nullptr;
+      idbuff = nullptr;
+      return false;
+    }
+    return true;
+  }
+
+  Hif_index prev;  // the new chunk continues the scopes open after the last one
+  if (prev.read(base + ".ix"))
+    index.continue_from(prev);
+  ++chunk_num;
+  return open_chunk();
+}
+
+// Same state as if this writer had written the chunk: id2pos from N.id, and
+// chunk_stmts plus the index from walking the N.st statements
+bool Hif_write::load_chunk(const std::string &base) {
+  auto map = [](const std::string &fname) -> std::tuple<uint8_t *, size_t> {
+    int fd = ::open(fname.c_str(), O_RDONLY);
+    if (fd < 0)
+      return {nullptr, 0};
+    struct stat sb;
+    void       *ptr = MAP_FAILED;
+    if (fstat(fd, &sb) == 0 && sb.st_size > 0) {
+      ptr = mmap(0, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    ::close(fd);
+    if (ptr == MAP_FAILED)
+      return {nullptr, 0};
+    return {static_cast<uint8_t *>(ptr), sb.st_size};
+  };
+
+  auto [st, st_sz] = map(base + ".st");
+  auto [id, id_sz] = map(base + ".id");
+
+  bool ok = st && !Hif_codec::is_compressed(st, st_sz)
+            && (id == nullptr || !Hif_codec::is_compressed(id, id_sz));
+
+  struct Name {
+    std::string_view txt;
+    ID_cat           cat;
+  };
+  std::vector<Name> names;
+  for (const uint8_t *ptr = id, *end = id + id_sz; ok && ptr < end;) {
+    uint8_t  ttt   = *ptr & 0x07;
+    bool     small = (*ptr & 0x08) != 0;
+    uint32_t sz    = (*ptr) >> 4;
+    if (!small && ptr + 3 <= end) {
+      sz |= (ptr[1] | (ptr[2] << 8)) << 4;
+    }
+    ptr += small ? 1 : 3;
+    if (ptr + sz > end) {
+      ok = false;
+      break;
+    }
+
+    std::string_view txt(reinterpret_cast<const char *>(ptr), sz);
+    id2pos[std::string(txt)] = id_entry{static_cast<ID_cat>(ttt),
+                                        static_cast<uint32_t>(names.size())};
+    names.emplace_back(Name{txt, static_cast<ID_cat>(ttt)});
+    ptr += sz;
+  }
+
+  auto get_ref = [&names](const uint8_t *&ptr, uint32_t &pos) {
+    pos = *ptr >> 3;
+    if (*ptr & 1) {
+      ptr += 1;
+    } else {
+      pos |= (ptr[1] | (ptr[2] << 8)) << 5;
+      ptr += 3;
+    }
+    return pos < names.size();
+  };
+
+  // Entries as Hif_read decodes them (a single ID is a lhs)
+  auto get_list = [&](const uint8_t *&ptr, std::vector<Tuple_view> &list) {
+    int64_t  lhs = -1;
+    uint32_t pos;
+    while (*ptr != 0xFF) {
+      bool input = (*ptr >> 1) & 1;
+      bool last  = (*ptr >> 2) & 1;
+      if (!get_ref(ptr, pos))
+        return false;
+      if (!last) {
+        lhs = pos;
+      } else if (lhs >= 0) {
+        list.emplace_back(input, names[lhs].txt, names[pos].txt, names[lhs].cat,
+                          names[pos].cat);
+        lhs = -1;
+      } else {
+        list.emplace_back(input, names[pos].txt, "", names[pos].cat, String_cat);
+      }
+    }
+    ++ptr;
+    return lhs < 0;
+  };
+
+  // Scopes and defs still open after the previous chunk (its N.ix OPEN section)
+  index.clear();
+  Hif_index prev;
+  if (chunk_num && prev.read(dname + "/" + std::to_string(chunk_num - 1) + ".ix"))
+    index.continue_from(prev);
+  chunk_stmts = 0;
+
+  Statement_view stmt;
+  for (const uint8_t *ptr = st, *end = st + st_sz; ok && ptr < end; ++chunk_stmts) {
+    auto *next = Hif_scan::stmt_end(ptr, end);
+    if (next == nullptr) {
+      ok = false;
+      break;
+    }
+
+    stmt.clear();
+    stmt.sclass = static_cast<Statement_class>(*ptr >> 4);
+    stmt.type   = (*ptr & 0xF) | (ptr[1] << 4);
+
+    // Only defs and module bodies need the IDs (ports and module hash)
+    if (stmt.is_open_def() || stmt.is_closed_def() || index.in_module()) {
+      const uint8_t *p = ptr + 2;
+      uint32_t       pos;
+      if (*p == 0xFF) {
+        ++p;
+      } else if (get_ref(p, pos)) {
+        stmt.instance = names[pos].txt;
+      } else {
+        ok = false;
+      }
+      ok = ok && get_list(p, stmt.io) && get_list(p, stmt.attr);
+    }
+
+    track_stmt(stmt, ptr - st);
+    if (stmt.is_end())
+      index.close_scope(next - st);
+
+    ptr = next;
+  }
+
+  if (st)
+    munmap(st, st_sz);
+  if (id)
+    munmap(id, id_sz);
+
+  if (!ok) {
+    id2pos.clear();
+    index.clear();
+    chunk_stmts = 0;
+  }
+  return ok;
+}
+
+void Hif_write::add_hif_header(std::string_view tool, std::string_view version) {
+  auto conf_stmt = Hif_write::create_attr();
+  conf_stmt.add_attr("HIF", hif_version);
+  conf_stmt.add_attr("tool", tool);
+  conf_stmt.add_attr("version", version);
+
+  add(conf_stmt);
+}
+
+Hif_write::Hif_write(std::shared_ptr<Shared_dir> _dir, uint32_t _slot,
+                     const Options &_opt)
+    : opt(_opt), dname(_dir->dname), shared(_dir), slot(_slot), index(_opt.index_stride) {
+  open_chunk();  // no HIF header, only chunk 0 has it
+}
+
+Hif_write::~Hif_write() { close(); }
+
+bool Hif_write::close() {
+  if (closed)
+    return !failed;
+  closed = true;
+
+  if (is_ok() && !close_chunk())
+    failed = true;
+  if (stream && !stream->flush_all())
+    failed = true;
+  stream = nullptr;
+
+  if (shared) {
+    bool last;
+    {
+      std::lock_guard<std::mutex> lock(shared->mtx);
+      shared->slot_chunks[slot] = chunk_num;
+      last                      = --shared->open_writers == 0;
+    }
+    if (last && !shared->finish())
+      failed = true;
+    shared = nullptr;
+  }
+
+  return !failed;
+}
+
+std::shared_ptr<Hif_write> Hif_write::thread_writer() {
+  if (!is_ok() || stream)
+    return nullptr;
 
+  uint32_t new_slot;
   {
-    auto conf_stmt = Hif_write::create_attr();
-    conf_stmt.add_attr("HIF", hif_version);
-    conf_stmt.add_attr("tool", tool);
-    conf_stmt.add_attr("version", version);
+    std::lock_guard<std::mutex> lock(shared->mtx);
+    new_slot = shared->slot_chunks.size();
+    shared->slot_chunks.emplace_back(0);
+    ++shared->open_writers;
+  }
+
+  std::shared_ptr<Hif_write> ptr(new Hif_write(shared, new_slot, opt));
+
+  return ptr->is_ok() ? ptr : nullptr;
+}
+
+std::string Hif_write::chunk_base() const {
+  if (slot == 0)
+    return dname + "/" + std::to_string(chunk_num);
+
+  return dname + "/t" + std::to_string(slot) + "_" + std::to_string(chunk_num);
+}
+
+bool Hif_write::is_pack_name(const std::string &fname) {
+  struct stat sb;
+  if (stat(fname.c_str(), &sb) == 0)
+    return S_ISREG(sb.st_mode) && Hif_pack::is_pack(fname);
+
+  return fname.size() > 4 && fname.compare(fname.size() - 4, 4, ".hif") == 0;
+}
+
+bool Hif_write::is_thread_chunk_file(std::string_view name) {
+  if (name.size() < 2 || name[0] != 't')
+    return false;
+
+  auto pos = name.find('_');
+  return pos != std::string_view::npos && is_chunk_file(name.substr(pos + 1));
+}
+
+std::shared_ptr<File_write> Hif_write::create_file(const std::string &fname) const {
+  File_write::Options fopt;
+  fopt.buffer_size = opt.codec ? opt.codec_block : opt.io_buffer_size;
+  fopt.async       = opt.async_io;
+  fopt.codec       = opt.codec;
+  fopt.crc_block   = opt.checksum_block;
+
+  return File_write::create(fname, fopt);
+}
+
+bool Hif_write::open_chunk() {
+  chunk_stmts = 0;
 
-    add(conf_stmt);
+  // rank_short_refs: final positions are only known at close_chunk
+  // stream: flush_stream frames each statement
+  if (opt.rank_short_refs || stream) {
+    stbuff = File_write::create_memory();
+    idbuff = File_write::create_memory();
+    return true;
   }
+
+  auto base = chunk_base();
+
+  stbuff = create_file(base + ".st");
+  idbuff = create_file(base + ".id");
+
+  if (stbuff == nullptr || idbuff == nullptr) {
+    stbuff = nullptr;
+    idbuff = nullptr;
+    return false;
+  }
+
+  return true;
+}
+
+bool Hif_write::close_chunk() {
+  bool ok = true;
+  if (opt.rank_short_refs) {
+    ok = write_ranked_chunk();
+  }
+  if (stream) {
+    stream->add8(stream_reset);
+  } else {
+    if (opt.index_stride && !index.write(chunk_base() + ".ix")) {
+      std::cerr << "Hif_write could not write " << chunk_base() << ".ix\n";
+      ok = false;
+    }
+    if (opt.checksum_block && !opt.rank_short_refs)  // ranked ones are not in stbuff
+      ok = write_checksums(*stbuff, *idbuff) && ok;
+    ok = stbuff->flush_all() && idbuff->flush_all() && ok;
+  }
+  index.next_chunk();  // defs can end in a later chunk (XMOD in its N.ix)
+
+  stbuff = nullptr;
+  idbuff = nullptr;
+
+  id2pos.clear();
+  id_refs.clear();
+  id_recs.clear();
+  id_bytes = 0;
+
+  ++chunk_num;
+
+  return ok;
+}
+
+static size_t recode_ref(const std::vector<uint8_t> &st, size_t i,
+                         const std::vector<uint32_t> &old2new, File_write *out) {
+  uint32_t ref = st[i] | (st[i + 1] << 8) | (st[i + 2] << 16);  // always long in memory
+  uint32_t pos = old2new[ref >> 3];
+
+  ref = (pos << 3) | (ref & 0x6);
+  if (pos < 31) {
+    out->add8(ref | 1);
+  } else {
+    out->add8(ref);
+    out->add16(ref >> 8);
+  }
+
+  return i + 3;
+}
+
+bool Hif_write::write_ranked_chunk() {
+  auto &st  = stbuff->get_memory();
+  auto &ids = idbuff->get_memory();
+
+  // Hottest IDs take the short reference slots, the rest keep their first use order
+  // (so lazy readers still find IDs close to where they are used)
+  auto                  n = id_refs.size();
+  std::vector<uint32_t> order(n);
+  std::iota(order.begin(), order.end(), 0);
+
+  auto nshort = std::min<size_t>(n, 31);
+  std::partial_sort(order.begin(),
+                    order.begin() + nshort,
+                    order.end(),
+                    [this](uint32_t a, uint32_t b) {
+                      return id_refs[a] > id_refs[b]
+                             || (id_refs[a] == id_refs[b] && a < b);
+                    });
+  std::sort(order.begin() + nshort, order.end());
+
+  std::vector<uint32_t> old2new(n);
+  for (auto i = 0u; i < n; ++i) {
+    old2new[order[i]] = i;
+  }
+
+  auto base = chunk_base();
+  auto stf  = create_file(base + ".st");
+  auto idf  = create_file(base + ".id");
+  if (stf == nullptr || idf == nullptr) {
+    std::cerr << "Hif_write could not create chunk " << base << "\n";
+    return false;
+  }
+
+  id_recs.emplace_back(id_bytes);
+  for (auto old : order) {
+    idf->add(std::string_view(reinterpret_cast<const char *>(ids.data()) + id_recs[old],
+                              id_recs[old + 1] - id_recs[old]));
+  }
+
+  index.restart_chunk();  // same scopes, the offsets change with the short references
+
+  size_t i = 0;
+  while (i < st.size()) {
+    index.add_stmt(stf->get_pos());
+
+    auto sclass = static_cast<Statement_class>(st[i] >> 4);
+    if (is_scope_begin(sclass))
+      index.open_scope(stf->get_pos());
+
+    stf->add8(st[i]);  // cccc + type
+    stf->add8(st[i + 1]);
+    i += 2;
+
+    if (st[i] == 0xFF) {  // no instance
+      stf->add8(0xFF);
+      ++i;
+    } else {
+      i = recode_ref(st, i, old2new, stf.get());
+    }
+
+    for (auto seq = 0; seq < 2; ++seq) {  // ios and attrs
+      while (st[i] != 0xFF) {
+        i = recode_ref(st, i, old2new, stf.get());
+      }
+      stf->add8(0xFF);
+      ++i;
+    }
+
+    if (sclass == Statement_class::End)
+      index.close_scope(stf->get_pos());
+  }
+
+  bool ok = !opt.checksum_block || write_checksums(*stf, *idf);
+
+  return stf->flush_all() && idf->flush_all() && ok;
+}
+
+bool Hif_write::write_checksums(File_write &st, File_write &id) {
+  Hif_checksum ck;
+  ck.block   = opt.checksum_block;
+  ck.st.crcs = st.get_crcs();
+  ck.st.size = st.get_file_size();
+  ck.id.crcs = id.get_crcs();
+  ck.id.size = id.get_file_size();
+
+  if (!ck.write(chunk_base() + ".ck")) {
+    std::cerr << "Hif_write could not write " << chunk_base() << ".ck\n";
+    return false;
+  }
+  return true;
 }
 
 void Hif_write::write_idref(uint8_t ee, Hif_base::ID_cat ttt, std::string_view txt_) {
@@ -94,6 +745,12 @@ void Hif_write::write_idref(uint8_t ee, Hif_base::ID_cat ttt, std::string_view t
   }
 
   uint32_t ref = (pos << 3) | (ee << 1);
+  if (opt.rank_short_refs) {  // provisional position, recoded by write_ranked_chunk
+    ++id_refs[pos];
+    stbuff->add8(ref);
+    stbuff->add16(ref >> 8);
+    return;
+  }
   if (pos < 31) {           // WARNING: if 31 is allowed it aliases with 0xFF end
     stbuff->add8(ref | 1);  // small
   } else {
@@ -103,6 +760,14 @@ void Hif_write::write_idref(uint8_t ee, Hif_base::ID_cat ttt, std::string_view t
 }
 
 void Hif_write::write_id(Hif_base::ID_cat ttt, std::string_view txt) {
+  assert(txt.size() <= Hif_base::max_id_size);  // add_stmt drops the statement
+
+  if (opt.rank_short_refs) {
+    id_refs.emplace_back(0);
+    id_recs.emplace_back(id_bytes);
+    id_bytes += (txt.size() < 16 ? 1 : 3) + txt.size();
+  }
+
   uint16_t x = txt.size() << 4;
   if (txt.size() < 16) {
     idbuff->add8(x | ttt | 0x08);  // 0x8==small
@@ -114,7 +779,8 @@ void Hif_write::write_id(Hif_base::ID_cat ttt, std::string_view txt) {
   idbuff->add(txt);
 }
 
-void Hif_write::add_io(const Hif_base::Tuple_entry &ent) {
+template <typename T>
+void Hif_write::add_io(const T &ent) {
   uint8_t ee = ent.input ? 1 : 0;  // input or output port id
 
   if (!ent.lhs.empty()) {
@@ -128,7 +794,8 @@ void Hif_write::add_io(const Hif_base::Tuple_entry &ent) {
   }
 }
 
-void Hif_write::add_attr(const Hif_base::Tuple_entry &ent) {
+template <typename T>
+void Hif_write::add_attr(const T &ent) {
   assert(!ent.lhs.empty());  // attr must have lhs AND rhs
   // NOTE: Empty stringS are valid
   // assert(!ent.rhs.empty());  // attr must have lhs AND rhs
@@ -140,13 +807,49 @@ void Hif_write::add_attr(const Hif_base::Tuple_entry &ent) {
   write_idref(rhs_ee, ent.rhs_cat, ent.rhs);
 }
 
-void Hif_write::add(const Statement &stmt) {
+template <typename S>
+void Hif_write::add_stmt(const S &stmt) {
   assert((stmt.type >> 12) == 0);  // max 12 bit type identifer
+  if (!is_ok()) {
+    failed = true;
+    return;
+  }
+
+  // the .id size field is 20 bits, a longer ID would be cut
+  auto too_long = [](std::string_view txt) { return txt.size() > Hif_base::max_id_size; };
+  bool fits     = !too_long(stmt.instance);
+  for (const auto &ent : stmt.io) {
+    fits = fits && !too_long(ent.lhs) && !too_long(ent.rhs);
+  }
+  for (const auto &ent : stmt.attr) {
+    fits = fits && !too_long(ent.lhs) && !too_long(ent.rhs);
+  }
+  if (!fits) {
+    std::cerr << "Hif_write::add statement with an ID of " << (Hif_base::max_id_size + 1)
+              << " bytes or more in " << dname << " not written\n";
+    failed = true;
+    return;
+  }
 
-  // worst case. Time to create new 0/1 id file
-  if ((2 * stmt.io.size() + 2 * stmt.attr.size() + id2pos.size()) > (1 << 20)) {
-    assert(false);  // FIXME: create new ID file
+  // worst case new IDs: instance + lhs/rhs per entry. Start N+1.st/N+1.id if it does
+  // not fit, so every chunk is closed at a statement boundary.
+  size_t max_new_ids = 1 + 2 * stmt.io.size() + 2 * stmt.attr.size();
+  if (chunk_stmts >= opt.max_chunk_stmts
+      || (id2pos.size() + max_new_ids) > opt.max_chunk_ids) {
+    assert(max_new_ids <= opt.max_chunk_ids);  // statement too large for any chunk
+
+    if (!close_chunk())
+      failed = true;
+    if (!open_chunk()) {
+      std::cerr << "Hif_write::add could not create chunk " << chunk_num << " in "
+                << dname << "\n";
+      failed = true;
+      return;
+    }
   }
+  ++chunk_stmts;
+
+  track_stmt(stmt, stbuff->get_pos());
 
   stbuff->add8((stmt.type & 0xF) | ((stmt.sclass) << 4));
   stbuff->add8(stmt.type >> 4);
@@ -165,4 +868,45 @@ void Hif_write::add(const Statement &stmt) {
     add_attr(ent);
   }
   stbuff->add8(0xFF);  // END OF ATTRs
+
+  if (stmt.sclass == Statement_class::End)
+    index.close_scope(stbuff->get_pos());
+
+  if (stream)
+    flush_stream();
+}
+
+void Hif_write::flush_stream() {
+  auto &ids = idbuff->get_memory();
+  if (!ids.empty()) {  // declared before the statement that uses them
+    stream->add8(stream_ids);
+    stream->add32(ids.size());
+    stream->add(std::string_view(reinterpret_cast<const char *>(ids.data()), ids.size()));
+    ids.clear();
+  }
+
+  auto &st = stbuff->get_memory();
+  stream->add(std::string_view(reinterpret_cast<const char *>(st.data()), st.size()));
+  st.clear();
+}
+
+void Hif_write::add(const Statement &stmt) { add_stmt(stmt); }
+
+void Hif_write::add(const Statement_view &stmt) { add_stmt(stmt); }
+
+const Hif_base::Statement_view &Hif_write::Statement_builder::get_view() {
+  view.clear();
+
+  view.sclass   = sclass;
+  view.type     = type;
+  view.instance = txt(instance);
+
+  for (const auto &e : io) {
+    view.io.emplace_back(e.input, txt(e.lhs), txt(e.rhs), e.lhs_cat, e.rhs_cat);
+  }
+  for (const auto &e : attr) {
+    view.attr.emplace_back(e.input, txt(e.lhs), txt(e.rhs), e.lhs_cat, e.rhs_cat);
+  }
+
+  return view;
 }
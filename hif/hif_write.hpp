@@ -4,6 +4,7 @@
 
 #include <cstdint>
 #include <memory>
+#include <string>
 #include <tuple>
 #include <vector>
 
@@ -17,38 +18,255 @@
 
 #include "file_write.hpp"
 #include "hif_base.hpp"
+#include "hif_codec.hpp"
+#include "hif_index.hpp"
 
 class Hif_write : public Hif_base {
 public:
+  struct Options {
+    // A chunk (N.st/N.id pair) is closed and N+1 started before crossing any limit
+    uint32_t max_chunk_ids   = 1 << 20;  // 20 bit ID references
+    uint32_t max_chunk_stmts = 1 << 20;
+
+    // Buffer each chunk and give the 1 byte short references to the most referenced
+    // IDs instead of to the first declared ones
+    bool rank_short_refs = false;
+
+    // N.ix sidecar with a statement offset every index_stride statements (0 disables)
+    uint32_t index_stride = 1024;
+
+    // .st/.id buffer size and background writer thread (see File_write::Options)
+    size_t io_buffer_size = 8192;
+    bool   async_io       = false;
+
+    // Compressed .st/.id files (e.g. Hif_codec::lz()) in independent blocks of
+    // codec_block bytes. Hif_read decompresses them transparently.
+    const Hif_codec *codec       = nullptr;
+    size_t           codec_block = 1 << 18;
+
+    // N.ck sidecar with a CRC32C of every checksum_block bytes of N.st/N.id, computed
+    // while writing (see Hif_read::verify). 0 disables it.
+    uint32_t checksum_block = 1 << 20;
+  };
+
+  // fname is a directory of chunks, or a single file pack (see Hif_pack) if it is an
+  // existing pack or a new name ending in .hif. Packs are built when the writer (and
+  // its thread writers) are destroyed.
   static std::shared_ptr<Hif_write> create(std::string_view fname, std::string_view tool,
                                            std::string_view version);
+  static std::shared_ptr<Hif_write> create(std::string_view fname, std::string_view tool,
+                                           std::string_view version, const Options &opt);
   static std::shared_ptr<Hif_write> create(const std::string &fname,
                                            std::string_view   tool,
                                            std::string_view   version) {
     return create(std::string_view(fname.data(), fname.size()), tool, version);
   }
 
+  // Adds statements to an existing HIF (directory or pack) without rewriting it. The
+  // last chunk IDs, statement count and index are reloaded, and its .st/.id files
+  // continue, so the cost is the new statements plus one chunk. A compressed last
+  // chunk or rank_short_refs start a new chunk instead. No HIF header is added.
+  // Packs get the last chunk unpacked to fname.tmp, and the chunks from it replaced
+  // in the pack when the writer is destroyed (in place, see Hif_pack::append).
+  static std::shared_ptr<Hif_write> open_append(std::string_view fname);
+  static std::shared_ptr<Hif_write> open_append(std::string_view fname,
+                                                const Options   &opt);
+
+  // Single stream HIF written to fd (pipe, socket or file, it is not closed) as the
+  // statements are added. Read it with Hif_stream_read. rank_short_refs, index_stride
+  // and codec do not apply, chunks only bound the ID dictionary of the reader.
+  static std::shared_ptr<Hif_write> create_stream(int fd, std::string_view tool,
+                                                  std::string_view version);
+  static std::shared_ptr<Hif_write> create_stream(int fd, std::string_view tool,
+                                                  std::string_view version,
+                                                  const Options   &opt);
+
+  // Statement with the strings copied to a reusable arena instead of std::string.
+  // Once the arena and entry vectors reach their peak size, building a statement
+  // does not allocate.
+  class Statement_builder {
+  public:
+    void reset(Statement_class c = Statement_class::Node) {
+      sclass = c;
+      type   = 0;
+      arena.clear();  // keeps the capacity
+      instance = Ref{0, 0};
+      io.clear();
+      attr.clear();
+    }
+
+    Statement_class sclass = Statement_class::Node;
+    uint16_t        type   = 0;  // 12 bit type
+
+    void set_instance(std::string_view txt) { instance = copy(txt); }
+
+    void add_io(bool input, std::string_view l, std::string_view r, ID_cat lc,
+                ID_cat rc) {
+      io.emplace_back(Entry{input, copy(l), copy(r), lc, rc});
+    }
+    void add_input(std::string_view l) { add_io(true, l, "", String_cat, String_cat); }
+    void add_input(std::string_view l, std::string_view r) {
+      add_io(true, l, r, String_cat, String_cat);
+    }
+    void add_input(std::string_view l, const int64_t &v) {
+      add_io(true, l, int64_sv(v), String_cat, Base2_cat);
+    }
+    void add_output(std::string_view l) { add_io(false, l, "", String_cat, String_cat); }
+    void add_output(std::string_view l, std::string_view r) {
+      add_io(false, l, r, String_cat, String_cat);
+    }
+    void add_output(std::string_view l, const int64_t &v) {
+      add_io(false, l, int64_sv(v), String_cat, Base2_cat);
+    }
+
+    void add_attr(std::string_view l, std::string_view r, ID_cat lc, ID_cat rc) {
+      attr.emplace_back(Entry{true, copy(l), copy(r), lc, rc});
+    }
+    void add_attr(std::string_view l) { add_attr(l, "", String_cat, String_cat); }
+    void add_attr(std::string_view l, std::string_view r) {
+      add_attr(l, r, String_cat, String_cat);
+    }
+    void add_attr(std::string_view l, const int64_t &v) {
+      add_attr(l, int64_sv(v), String_cat, Base2_cat);
+    }
+
+    // Views in the arena, valid until the next reset
+    const Statement_view &get_view();
+
+  private:
+    struct Ref {
+      uint32_t off;
+      uint32_t sz;
+    };
+    struct Entry {
+      bool   input;
+      Ref    lhs;
+      Ref    rhs;
+      ID_cat lhs_cat;
+      ID_cat rhs_cat;
+    };
+
+    static std::string_view int64_sv(const int64_t &v) {
+      return std::string_view(reinterpret_cast<const char *>(&v), sizeof(int64_t));
+    }
+    // Offsets, not views, because the arena can grow while building
+    Ref copy(std::string_view txt) {
+      Ref r{static_cast<uint32_t>(arena.size()), static_cast<uint32_t>(txt.size())};
+      arena.append(txt);
+      return r;
+    }
+    std::string_view txt(Ref r) const {
+      return std::string_view(arena).substr(r.off, r.sz);
+    }
+
+    std::string        arena;
+    Ref                instance{0, 0};
+    std::vector<Entry> io;
+    std::vector<Entry> attr;
+    Statement_view     view;
+  };
+
   void add(const Statement &stmt);
+  // Same encoding, without copying the strings (e.g. from Hif_read or Hif_design)
+  void add(const Statement_view &stmt);
+
+  // The writer builder, reset to an empty sclass statement. add(builder) encodes it
+  // and resets it again.
+  Statement_builder &builder(Statement_class sclass = Statement_class::Node) {
+    bld.reset(sclass);
+    return bld;
+  }
+  void add(Statement_builder &stmt) {
+    add(stmt.get_view());
+    stmt.reset();
+  }
+
+  // Writer for another thread, with its own chunks and ID dictionary. Once every
+  // writer of the directory is destroyed, its chunks are numbered after the ones of
+  // this writer and of the thread writers created before it (creation order, not
+  // timing, decides the final order).
+  std::shared_ptr<Hif_write> thread_writer();
+
+  // Writes the open chunk, and for the last writer of the directory to close, numbers
+  // the thread writer chunks and builds the pack. False if a file was not written
+  // (the destructor calls it and only reports to std::cerr). No add after close.
+  bool close();
 
   Hif_write(std::string_view sname, std::string_view tool, std::string_view version);
+  Hif_write(std::string_view sname, std::string_view tool, std::string_view version,
+            const Options &opt);
+  Hif_write(int fd, std::string_view tool, std::string_view version, const Options &opt);
+  ~Hif_write();
 
 protected:
+  struct Shared_dir;
+
+  Hif_write(std::shared_ptr<Shared_dir> _dir, uint32_t _slot, const Options &_opt);
+  explicit Hif_write(const Options &_opt) : opt(_opt), index(_opt.index_stride) {}
+
   bool is_ok() const { return stbuff != nullptr; }
 
+  // "t<slot>_<num>" until Shared_dir renames it, "<num>" for slot 0
+  std::string chunk_base() const;
+  static bool is_thread_chunk_file(std::string_view name);
+  // An existing pack, or a new fname ending in .hif
+  static bool is_pack_name(const std::string &fname);
+
+  void add_hif_header(std::string_view tool, std::string_view version);
+  // open_append: continue the last chunk of dname (or start the next one). dname has
+  // the chunks of pack from pack_first.
+  bool append_dir(const std::string &sname, const std::string &pack,
+                  uint32_t pack_first);
+  bool load_chunk(const std::string &base);
+
+  bool open_chunk();
+  bool close_chunk();
+  bool write_ranked_chunk();
+  bool write_checksums(File_write &st, File_write &id);
+  void flush_stream();
+
   // add_* adds data structure and likely to fbuff too
   // write_* adds to fbuff only
   // track_* adds to data structures only
 
+  // S/T is Statement/Tuple_entry or Statement_view/Tuple_view (only used in the .cpp)
+  template <typename S>
+  void add_stmt(const S &stmt);
+  // N.ix entries (checkpoint, module, scope, module hash) of a statement at pos
+  template <typename S>
+  void track_stmt(const S &stmt, uint64_t pos);
   void add_declare(const Hif_base::Tuple_entry &ent);
-  void add_io(const Hif_base::Tuple_entry &ent);
-  void add_attr(const Hif_base::Tuple_entry &ent);
+  template <typename T>
+  void add_io(const T &ent);
+  template <typename T>
+  void add_attr(const T &ent);
 
   void write_id(const Hif_base::ID_cat, std::string_view txt);
   void write_idref(uint8_t ee, Hif_base::ID_cat ttt, std::string_view txt);
   void write_st(const Hif_base::Tuple_entry &ent);
 
+  std::shared_ptr<File_write> create_file(const std::string &fname) const;
+
+  Options                     opt;
+  std::string                 dname;
+  std::shared_ptr<Shared_dir> shared;
+  uint32_t                    slot        = 0;  // 0 is the writer that created dname
+  uint32_t                    chunk_num   = 0;
+  uint32_t                    chunk_stmts = 0;
+  bool                        closed      = false;
+  bool                        failed      = false;  // a file or statement not written
+
+  Statement_builder bld;
+
   std::shared_ptr<File_write> stbuff;
   std::shared_ptr<File_write> idbuff;
+  std::shared_ptr<File_write> stream;  // create_stream, stbuff/idbuff are in memory
+  Hif_index                   index;
+
+  // rank_short_refs: per ID reference count and .id record offset (in memory buffers)
+  std::vector<uint32_t> id_refs;
+  std::vector<uint32_t> id_recs;
+  uint32_t              id_bytes = 0;
 
   struct id_entry {
     Hif_base::ID_cat ttt;
@@ -0,0 +1,150 @@
+//  This file is distributed under the BSD 3-Clause License. See LICENSE for details.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Runs fn(task, tid) for every task in [0, n) on nthreads threads (the caller is tid 0).
+//
+// Each thread starts with a contiguous range of tasks and takes them from the front.
+// Once its range is empty, it steals the back half of the largest remaining range, so
+// uneven tasks (e.g. chunks of very different size) keep every thread busy.
+//
+// A run called from inside another run (e.g. Hif_codec::decompress_file from a
+// parallel_each worker) stays on the calling thread, so the threads do not multiply.
+class Thread_pool {
+public:
+  static unsigned default_threads() {
+    auto n = std::thread::hardware_concurrency();
+    return n ? n : 1;
+  }
+
+  template <typename F>
+  static void run(size_t n, unsigned nthreads, F &&fn) {
+    if (n == 0)
+      return;
+    if (nthreads == 0)
+      nthreads = default_threads();
+    if (nthreads > n)
+      nthreads = n;
+
+    if (nthreads <= 1 || in_worker) {
+      for (size_t i = 0; i < n; ++i) {
+        fn(i, 0u);
+      }
+      return;
+    }
+
+    std::unique_ptr<Range[]> ranges(new Range[nthreads]);
+    for (auto t = 0u; t < nthreads; ++t) {
+      ranges[t].set(n * t / nthreads, n * (t + 1) / nthreads);
+    }
+
+    auto worker = [&](unsigned tid) {
+      Worker_scope scope;
+      while (true) {
+        size_t task;
+        while (ranges[tid].pop_front(task)) {
+          fn(task, tid);
+        }
+        if (!steal(ranges.get(), nthreads, tid))
+          return;
+      }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(nthreads - 1);
+    for (auto t = 1u; t < nthreads; ++t) {
+      threads.emplace_back(worker, t);
+    }
+    worker(0);
+    for (auto &t : threads) {
+      t.join();
+    }
+  }
+
+  // True on the threads of a run with more than one thread (the caller included)
+  static bool is_worker() { return in_worker; }
+
+protected:
+  static inline thread_local bool in_worker = false;
+
+  struct Worker_scope {
+    bool prev;
+    Worker_scope() : prev(in_worker) { in_worker = true; }
+    ~Worker_scope() { in_worker = prev; }
+  };
+
+  // [begin, end) packed in one word so that owner and thieves race with a single CAS
+  struct alignas(64) Range {
+    std::atomic<uint64_t> be{0};
+
+    static uint64_t pack(uint64_t b, uint64_t e) { return (b << 32) | e; }
+
+    void set(size_t b, size_t e) { be.store(pack(b, e)); }
+
+    size_t size() const {
+      auto v = be.load();
+      auto b = v >> 32;
+      auto e = v & 0xFFFFFFFF;
+      return e > b ? e - b : 0;
+    }
+
+    bool pop_front(size_t &task) {
+      auto v = be.load();
+      while (true) {
+        auto b = v >> 32;
+        auto e = v & 0xFFFFFFFF;
+        if (b >= e)
+          return false;
+        if (be.compare_exchange_weak(v, pack(b + 1, e))) {
+          task = b;
+          return true;
+        }
+      }
+    }
+
+    bool steal_back(size_t &b_out, size_t &e_out) {
+      auto v = be.load();
+      while (true) {
+        auto b = v >> 32;
+        auto e = v & 0xFFFFFFFF;
+        if (e <= b + 1)  // leave the last task to the owner
+          return false;
+        auto half = (e - b) / 2;
+        if (be.compare_exchange_weak(v, pack(b, e - half))) {
+          b_out = e - half;
+          e_out = e;
+          return true;
+        }
+      }
+    }
+  };
+
+  static bool steal(Range *ranges, unsigned nthreads, unsigned tid) {
+    while (true) {
+      unsigned victim = nthreads;
+      size_t   best   = 1;
+      for (auto t = 0u; t < nthreads; ++t) {
+        auto sz = ranges[t].size();
+        if (t != tid && sz > best) {
+          best   = sz;
+          victim = t;
+        }
+      }
+      if (victim == nthreads)
+        return false;  // nothing left worth stealing
+
+      size_t b, e;
+      if (ranges[victim].steal_back(b, e)) {
+        ranges[tid].set(b, e);  // own range is empty, thieves can not CAS it
+        return true;
+      }
+    }
+  }
+};
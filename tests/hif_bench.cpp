@@ -1,9 +1,20 @@
 //  This file is distributed under the BSD 3-Clause License. See LICENSE for details.
 
+#include <sys/mman.h>
+#include <unistd.h>
+
 #include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <span>
 #include <string>
 
 #include "benchmark/benchmark.h"
+#include "hif/file_write.hpp"
+#include "hif/hif_codec.hpp"
+#include "hif/hif_design.hpp"
 #include "hif/hif_read.hpp"
 #include "hif/hif_write.hpp"
 
@@ -120,6 +131,23 @@ void hif_get_current_stmt() {
   benchmark::DoNotOptimize(conta);
 }
 
+void hif_write_test_n(const std::string& fname, int n,
+                      const Hif_write::Options& opt = Hif_write::Options()) {
+  auto wr = Hif_write::create(fname, "hif_bench", "0.xxx", opt);
+
+  for (auto i = 0; i < n; ++i) {
+    auto stmt = Hif_write::create_node();
+
+    stmt.instance = "inst" + std::to_string(i & 0xFFF);
+    stmt.add_input("A", "net" + std::to_string(i & 0x3FF));
+    stmt.add_input("B", "net" + std::to_string((i + 1) & 0x3FF));
+    stmt.add_output("Z", "net" + std::to_string((i + 2) & 0x3FF));
+    stmt.add_attr("loc", (int64_t)i);
+
+    wr->add(stmt);
+  }
+}
+
 static void BM_hif_stmt(benchmark::State& state) {
   // Perform setup here
   for (auto _ : state) {
@@ -161,11 +189,206 @@ static void BM_hif_get_current_stmt_1000(benchmark::State& state) {
   }
 }
 
+// Three ways to visit the same statements: std::function, inlined template, batches
+static void BM_hif_each_function(benchmark::State& state) {
+  hif_write_test_n("hif_test_bench_each", state.range(0));
+
+  for (auto _ : state) {
+    auto rd = Hif_read::open(std::string("hif_test_bench_each"));
+
+    size_t                                                conta = 0;
+    std::function<void(const Hif_base::Statement_view&)> fn
+        = [&conta](const Hif_base::Statement_view& stmt) { conta += stmt.io.size(); };
+    rd->each(fn);
+
+    benchmark::DoNotOptimize(conta);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+static void BM_hif_each_template(benchmark::State& state) {
+  hif_write_test_n("hif_test_bench_each", state.range(0));
+
+  for (auto _ : state) {
+    auto rd = Hif_read::open(std::string("hif_test_bench_each"));
+
+    size_t conta = 0;
+    rd->each([&conta](const Hif_base::Statement_view& stmt) { conta += stmt.io.size(); });
+
+    benchmark::DoNotOptimize(conta);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+static void BM_hif_each_batch(benchmark::State& state) {
+  hif_write_test_n("hif_test_bench_each", state.range(0));
+
+  for (auto _ : state) {
+    auto rd = Hif_read::open(std::string("hif_test_bench_each"));
+
+    size_t conta = 0;
+    rd->each_batch(256, [&conta](std::span<const Hif_base::Statement_view> batch) {
+      for (const auto& stmt : batch) {
+        conta += stmt.io.size();
+      }
+    });
+
+    benchmark::DoNotOptimize(conta);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// Writes range(0) MB with the encoder-like pattern of small adds
+static void file_write_mb(benchmark::State& state, const File_write::Options& opt) {
+  const size_t total = static_cast<size_t>(state.range(0)) << 20;
+
+  std::string txt("net_name_with_some_length");
+  for (auto _ : state) {
+    auto fw = File_write::create(std::string_view("hif_test_bench_file_write"), opt);
+
+    size_t sz = 0;
+    while (sz < total) {
+      fw->add8(0x42);
+      fw->add16(0x1234);
+      fw->add(txt);
+      sz += 3 + txt.size();
+    }
+    fw = nullptr;  // flush and close inside the timed loop
+  }
+  unlink("hif_test_bench_file_write");
+
+  state.SetBytesProcessed(state.iterations() * total);
+}
+
+static void BM_file_write_sync(benchmark::State& state) {
+  File_write::Options opt;
+  file_write_mb(state, opt);
+}
+
+static void BM_file_write_async(benchmark::State& state) {
+  File_write::Options opt;
+  opt.async       = true;
+  opt.buffer_size = 1 << 20;
+  file_write_mb(state, opt);
+}
+
+// Same statements as hif_write_test_n, encoded from a Statement or from the builder
+static void write_stmts(benchmark::State& state, bool use_builder) {
+  const int n = state.range(0);
+
+  for (auto _ : state) {
+    auto wr = Hif_write::create(std::string("hif_test_bench"), "hif_bench", "0.xxx");
+
+    for (auto i = 0; i < n; ++i) {
+      char inst[16], a[16], b[16], z[16];
+      snprintf(inst, sizeof(inst), "inst%d", i & 0xFFF);
+      snprintf(a, sizeof(a), "net%d", i & 0x3FF);
+      snprintf(b, sizeof(b), "net%d", (i + 1) & 0x3FF);
+      snprintf(z, sizeof(z), "net%d", (i + 2) & 0x3FF);
+
+      if (use_builder) {
+        auto& stmt = wr->builder();
+        stmt.set_instance(inst);
+        stmt.add_input("A", a);
+        stmt.add_input("B", b);
+        stmt.add_output("Z", z);
+        wr->add(stmt);
+      } else {
+        auto stmt     = Hif_write::create_node();
+        stmt.instance = inst;
+        stmt.add_input("A", a);
+        stmt.add_input("B", b);
+        stmt.add_output("Z", z);
+        wr->add(stmt);
+      }
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+
+static void BM_hif_write_statement(benchmark::State& state) { write_stmts(state, false); }
+
+static void BM_hif_write_builder(benchmark::State& state) { write_stmts(state, true); }
+
+static void BM_hif_design_traverse(benchmark::State& state) {
+  hif_write_test_n("hif_test_bench_design", state.range(0));
+
+  auto design = Hif_design::open("hif_test_bench_design");
+  for (auto _ : state) {
+    size_t conta = 0;
+    for (auto stmt : *design) {
+      for (const auto& e : stmt.get_io()) {
+        conta += e.rhs;
+      }
+    }
+    benchmark::DoNotOptimize(conta);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  state.counters["bytes_per_stmt"]
+      = static_cast<double>(design->memory_bytes()) / state.range(0);
+}
+
+// Counting statements by decoding them (next_stmt) or with the structural scanner
+static void BM_hif_count_decode(benchmark::State& state) {
+  hif_write_test_n("hif_test_bench_count", state.range(0));
+
+  for (auto _ : state) {
+    auto   rd    = Hif_read::open("hif_test_bench_count");
+    size_t conta = 0;
+    while (rd->next_stmt()) {
+      ++conta;
+    }
+    benchmark::DoNotOptimize(conta);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+static void BM_hif_count_scan(benchmark::State& state) {
+  hif_write_test_n("hif_test_bench_count", state.range(0));
+
+  for (auto _ : state) {
+    auto rd = Hif_read::open("hif_test_bench_count");
+    benchmark::DoNotOptimize(rd->count_statements());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+static void BM_hif_lz_decode(benchmark::State& state) {
+  Hif_write::Options opt;
+  opt.codec = Hif_codec::lz();
+  hif_write_test_n("hif_test_bench_lz", state.range(0), opt);
+
+  std::ifstream        fs("hif_test_bench_lz/0.st", std::ios::binary);
+  std::vector<uint8_t> data((std::istreambuf_iterator<char>(fs)),
+                            std::istreambuf_iterator<char>());
+
+  size_t raw_sz = 0;
+  for (auto _ : state) {
+    auto [raw, sz] = Hif_codec::decompress_file(data.data(), data.size());
+    benchmark::DoNotOptimize(raw);
+    munmap(raw, sz);
+    raw_sz = sz;
+  }
+  state.SetBytesProcessed(state.iterations() * raw_sz);
+  state.counters["ratio"] = static_cast<double>(raw_sz) / data.size();
+}
+
 BENCHMARK(BM_hif_stmt);
 BENCHMARK(BM_hif_write_1);
 BENCHMARK(BM_hif_write_1000);
 BENCHMARK(BM_hif_rdwr_1000);
 BENCHMARK(BM_hif_get_current_stmt_1000);
+BENCHMARK(BM_hif_each_function)->Arg(100000);
+BENCHMARK(BM_hif_each_template)->Arg(100000);
+BENCHMARK(BM_hif_each_batch)->Arg(100000);
+BENCHMARK(BM_hif_design_traverse)->Arg(100000);
+BENCHMARK(BM_hif_write_statement)->Arg(100000);
+BENCHMARK(BM_hif_write_builder)->Arg(100000);
+BENCHMARK(BM_file_write_sync)->Arg(1024)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_file_write_async)->Arg(1024)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_hif_count_decode)->Arg(1000000);
+BENCHMARK(BM_hif_count_scan)->Arg(1000000);
+BENCHMARK(BM_hif_lz_decode)->Arg(4000000)->Unit(benchmark::kMillisecond);
 
 // Run the benchmark
 BENCHMARK_MAIN();
@@ -1,20 +1,70 @@
 //  This file is distributed under the BSD 3-Clause License. See LICENSE for details.
 
-#include <chrono>
+#include <unistd.h>
+
 #include <iostream>
 #include <string>
 
+#include "hif/file_write.hpp"
 #include "hif/hif_read.hpp"
-#include "hif/hif_write.hpp"
+#include "hif/hif_stream_read.hpp"
+#include "hif/hif_text.hpp"
 
 int main(int argc, char **argv) {
-  if (argc != 2) {
+  auto        style    = Hif_text::Style::Dump;
+  unsigned    nthreads = 0;
+  std::string fname;
+
+  for (auto i = 1; i < argc; ++i) {
+    std::string arg(argv[i]);
+    if (arg == "-t") {
+      style = Hif_text::Style::Text;
+    } else if (arg == "-j" && i + 1 < argc) {
+      nthreads = std::stoul(argv[++i]);
+    } else if (fname.empty()) {
+      fname = arg;
+    } else {
+      fname.clear();
+      break;
+    }
+  }
+
+  if (fname.empty()) {
     std::cerr << "Usage:\n";
-    std::cerr << "\thif_cat <filename>\n";
+    std::cerr << "\thif_cat [-t] [-j threads] <filename>\n";
+    std::cerr << "\thif_cat [-t] -      (HIF stream from stdin)\n";
+    std::cerr << "-t prints the text grammar (hif_from_text reads it back) instead of\n";
+    std::cerr << "the dump style\n";
     exit(-3);
   }
 
-  std::string fname(argv[1]);
+  if (fname == "-") {
+    auto rd = Hif_stream_read::open(STDIN_FILENO);
+    if (rd == nullptr) {
+      std::cerr << "could not read stdin as HIF stream\n";
+      exit(-3);
+    }
+
+    File_write::Options fopt;
+    fopt.buffer_size = 1 << 16;
+    File_write out(dup(STDOUT_FILENO), fopt);
+
+    std::string buf;
+    Hif_text::format_header(buf, rd->get_tool(), rd->get_version(), style);
+    rd->each([&](const Hif_base::Statement_view &stmt) {
+      Hif_text::format(buf, stmt, style);
+      if (buf.size() >= 1 << 16) {
+        out.add(buf);
+        buf.clear();
+      }
+    });
+    out.add(buf);
+    if (!out.flush_all()) {
+      std::cerr << "could not write to stdout\n";
+      return -1;
+    }
+    return 0;
+  }
 
   auto rd = Hif_read::open(fname);
   if (rd == nullptr) {
@@ -22,16 +72,5 @@ int main(int argc, char **argv) {
     exit(-3);
   }
 
-  std::cout << "HIF version:" << hif_version;
-  std::cout << " tool:" << rd->get_tool() << " version:" << rd->get_version() << "\n";
-
-  bool first = false;
-  rd->each([&first](const Hif_base::Statement &stmt) {
-    if (first && stmt.sclass != Hif_base::Statement_class::Attr) {
-      std::cerr << "not standard HIF. First entry must be attr\n";
-      first = false;
-    }
-
-    stmt.dump();
-  });
+  return Hif_text::write(*rd, STDOUT_FILENO, style, nthreads) ? 0 : -1;
 }
@@ -0,0 +1,17 @@
+//  This file is distributed under the BSD 3-Clause License. See LICENSE for details.
+
+#include <iostream>
+
+#include "hif/hif_delta.hpp"
+
+int main(int argc, char **argv) {
+  if (argc != 3 && argc != 4) {
+    std::cerr << "Usage:\n";
+    std::cerr << "\thif_compact <delta> <output> [base]\n";
+    std::cerr << "Writes the base design with the delta applied. The output is a\n";
+    std::cerr << "directory, or a pack if it ends in .hif\n";
+    exit(-3);
+  }
+
+  return Hif_delta::compact(argv[1], argv[2], argc == 4 ? argv[3] : "") ? 0 : -1;
+}
@@ -0,0 +1,57 @@
+//  This file is distributed under the BSD 3-Clause License. See LICENSE for details.
+
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+#include "hif/hif_text.hpp"
+
+int main(int argc, char **argv) {
+  Hif_text::Options opt;
+  std::string       in;
+  std::string       out;
+
+  for (auto i = 1; i < argc; ++i) {
+    std::string arg(argv[i]);
+    if (arg == "-j" && i + 1 < argc) {
+      opt.nthreads = std::stoul(argv[++i]);
+    } else if (arg == "-t" && i + 1 < argc) {
+      std::string t(argv[++i]);
+      auto        eq = t.find('=');
+      if (eq == std::string::npos) {
+        std::cerr << "-t expects name=number, not " << t << "\n";
+        exit(-3);
+      }
+      opt.types[t.substr(0, eq)] = std::stoul(t.substr(eq + 1));
+    } else if (in.empty()) {
+      in = arg;
+    } else if (out.empty()) {
+      out = arg;
+    } else {
+      in.clear();
+      break;
+    }
+  }
+
+  if (in.empty() || out.empty()) {
+    std::cerr << "Usage:\n";
+    std::cerr << "\thif_from_text [-j threads] [-t type=number]... <text> <output>\n";
+    std::cerr << "Converts a text HIF to binary. The output is a directory, or a pack\n";
+    std::cerr << "if it ends in .hif\n";
+    exit(-3);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  bool ok    = Hif_text::parse_file(in, out, opt);
+
+  std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+  if (!ok)
+    return -1;
+
+  auto bytes = std::filesystem::file_size(in);
+  std::cout << bytes << " bytes in " << secs.count() << "s ("
+            << bytes / secs.count() / 1e6 << " MB/s)\n";
+
+  return 0;
+}
@@ -0,0 +1,25 @@
+//  This file is distributed under the BSD 3-Clause License. See LICENSE for details.
+
+#include <cstring>
+#include <iostream>
+
+#include "hif/hif_pack.hpp"
+
+int main(int argc, char **argv) {
+  bool unpack = argc == 4 && strcmp(argv[1], "-u") == 0;
+  if (argc != 3 && !unpack) {
+    std::cerr << "Usage:\n";
+    std::cerr << "\thif_pack <directory> <file.hif>\n";
+    std::cerr << "\thif_pack -u <file.hif> <directory>\n";
+    exit(-3);
+  }
+
+  bool ok;
+  if (unpack) {
+    ok = Hif_pack::unpack(argv[2], argv[3]);
+  } else {
+    ok = Hif_pack::pack(argv[1], argv[2]);
+  }
+
+  return ok ? 0 : -1;
+}
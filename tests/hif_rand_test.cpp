@@ -28,6 +28,16 @@ std::string gen_str(const uint32_t len) {
   return str;
 }
 
+std::uintmax_t chunk_bytes(const std::string &dname, std::string_view ext) {
+  std::uintmax_t sz = 0;
+  for (const auto &e : fs::directory_iterator(dname)) {
+    if (e.path().extension() == ext) {
+      sz += e.file_size();
+    }
+  }
+  return sz;
+}
+
 int main(int argc, char *argv[]) {
   if (argc < 3) {
     std::cout << "hif_read_test [number of unique strings] [number of statements]";
@@ -53,6 +63,7 @@ int main(int argc, char *argv[]) {
   t_start = high_resolution_clock::now();
 
   auto writer = Hif_write::create(std::string("hif_rand_test"), "test", "1.0");
+  srand(1);
   for (uint32_t i = 0; i < n_stmts; ++i) {
     auto n     = Hif_write::create_assign();
     auto name  = names[rand() % n_strs];
@@ -86,10 +97,42 @@ int main(int argc, char *argv[]) {
   std::cout << "read time = " << time_span.count() << " s" << std::endl;
 
   std::uintmax_t file_size
-      = fs::file_size("hif_rand_test/0.id") + fs::file_size("hif_rand_test/0.st");
+      = chunk_bytes("hif_rand_test", ".id") + chunk_bytes("hif_rand_test", ".st");
   std::cout << "file size = " << (double)file_size / 1024 / 1024 << " MB" << std::endl;
 
+  // Same statements with frequency ranked short references
+  t_start = high_resolution_clock::now();
+
+  Hif_write::Options opt;
+  opt.rank_short_refs = true;
+
+  writer = Hif_write::create(std::string("hif_rand_test_ranked"), "test", "1.0", opt);
+  srand(1);
+  for (uint32_t i = 0; i < n_stmts; ++i) {
+    auto n     = Hif_write::create_assign();
+    auto name  = names[rand() % n_strs];
+    n.instance = name;
+    n.add_attr(name, name);
+    n.add_input(name, name);
+    n.add_output(name, name);
+    writer->add(n);
+  }
+
+  writer = nullptr;
+
+  t_end     = high_resolution_clock::now();
+  time_span = duration_cast<duration<double>>(t_end - t_start);
+  std::cout << "ranked write time = " << time_span.count() << " s" << std::endl;
+
+  auto st_size        = chunk_bytes("hif_rand_test", ".st");
+  auto ranked_st_size = chunk_bytes("hif_rand_test_ranked", ".st");
+  std::cout << ".st size = " << (double)st_size / 1024 / 1024 << " MB, ranked "
+            << (double)ranked_st_size / 1024 / 1024 << " MB ("
+            << 100.0 * (1.0 - (double)ranked_st_size / st_size) << "% smaller)"
+            << std::endl;
+
   fs::remove_all("hif_rand_test");
+  fs::remove_all("hif_rand_test_ranked");
 
   return 0;
 }
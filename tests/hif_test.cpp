@@ -1,11 +1,51 @@
 //  This file is distributed under the BSD 3-Clause License. See LICENSE for details.
 
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <array>
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <new>
 #include <string>
+#include <thread>
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "hif/hif_codec.hpp"
+#include "hif/hif_const.hpp"
+#include "hif/hif_crc.hpp"
+#include "hif/hif_delta_read.hpp"
+#include "hif/hif_design.hpp"
+#include "hif/hif_pack.hpp"
 #include "hif/hif_read.hpp"
+#include "hif/hif_scan.hpp"
+#include "hif/hif_stream_read.hpp"
+#include "hif/hif_text.hpp"
 #include "hif/hif_write.hpp"
+#include "hif/thread_pool.hpp"
+
+// Heap allocations of the calling thread (every operator new goes through this
+// binary). Not inlined, or gcc reports the malloc/free pair as a new/delete mismatch.
+static thread_local size_t num_allocs = 0;
+
+__attribute__((noinline)) void *operator new(size_t sz) {
+  ++num_allocs;
+  if (void *ptr = std::malloc(sz ? sz : 1))
+    return ptr;
+  throw std::bad_alloc();
+}
+__attribute__((noinline)) void operator delete(void *ptr) noexcept { std::free(ptr); }
+__attribute__((noinline)) void operator delete(void *ptr, size_t) noexcept {
+  std::free(ptr);
+}
 
 class Hif_test : public ::testing::Test {
 protected:
@@ -36,6 +76,14 @@ TEST_F(Hif_test, Trivial_test1) {
 
   wr->add(stmt);
 
+  // IDs longer than the 20 bit size are not written
+  auto big     = Hif_write::create_assign();
+  big.instance = std::string(Hif_base::max_id_size + 1, 'a');
+  wr->add(big);
+  big.instance = "b";
+  big.add_input("A", std::string(Hif_base::max_id_size + 1, 'b'));
+  wr->add(big);
+
   wr = nullptr;  // close
 
   auto rd = Hif_read::open(fname);
@@ -262,3 +310,1902 @@ TEST_F(Hif_test, strings_match) {
     EXPECT_EQ(conta, out_vector.size());
   }
 }
+
+TEST_F(Hif_test, statement_view) {
+  std::string fname("hif_test_statement_view");
+
+  auto stmt = Hif_write::create_node();
+  stmt.instance = "view_node";
+  stmt.type     = 33;
+  stmt.add_input("a", "foo");
+  stmt.add_input("b", 100);
+  stmt.add_output("y");
+  stmt.add_attr("size", (int64_t)64);
+
+  {
+    auto wr = Hif_write::create(fname, "testtool", "0.0.5");
+    EXPECT_NE(wr, nullptr);
+    for (auto i = 0; i < 16; ++i) {
+      wr->add(stmt);
+    }
+  }
+
+  auto rd = Hif_read::open(fname);
+  EXPECT_NE(rd, nullptr);
+
+  int conta = 0;
+  rd->each([&conta, &stmt](const Hif_base::Statement_view &view) {
+    EXPECT_EQ(view.instance, "view_node");
+    EXPECT_EQ(view.type, 33);
+    EXPECT_EQ(view.io.size(), 3);
+    EXPECT_EQ(view.io[1].get_rhs_int64(), 100);
+    EXPECT_EQ(view.attr[0].get_rhs_int64(), 64);
+    EXPECT_EQ(view.to_statement(), stmt);
+    ++conta;
+  });
+
+  EXPECT_EQ(conta, 16);
+}
+
+TEST_F(Hif_test, chunk_rollover) {
+  std::string fname("hif_test_chunk_rollover");
+
+  Hif_write::Options opt;
+  opt.max_chunk_ids   = 64;
+  opt.max_chunk_stmts = 50;
+
+  {
+    auto wr = Hif_write::create(fname, "testtool", "0.0.6", opt);
+    EXPECT_NE(wr, nullptr);
+
+    for (auto i = 0; i < 1000; ++i) {
+      auto stmt     = Hif_write::create_node();
+      stmt.instance = "n" + std::to_string(i);
+      stmt.add_input("a", "net" + std::to_string(i / 3));
+      stmt.add_output("y", "net" + std::to_string(i));
+      stmt.add_attr("loc", (int64_t)i);
+      wr->add(stmt);
+    }
+  }
+
+  EXPECT_TRUE(access((fname + "/20.st").c_str(), F_OK) == 0);
+  EXPECT_TRUE(access((fname + "/20.id").c_str(), F_OK) == 0);
+
+  auto rd = Hif_read::open(fname);
+  EXPECT_NE(rd, nullptr);
+  EXPECT_EQ(rd->get_tool(), "testtool");
+
+  int conta = 0;
+  rd->each([&conta](const Hif_base::Statement_view &stmt) {
+    EXPECT_EQ(stmt.instance, "n" + std::to_string(conta));
+    EXPECT_EQ(stmt.io[0].rhs, "net" + std::to_string(conta / 3));
+    EXPECT_EQ(stmt.io[1].rhs, "net" + std::to_string(conta));
+    EXPECT_EQ(stmt.attr[0].get_rhs_int64(), conta);
+    ++conta;
+  });
+
+  EXPECT_EQ(conta, 1000);
+}
+
+TEST_F(Hif_test, async_io) {
+  std::string sname("hif_test_async_io_sync");
+  std::string aname("hif_test_async_io");
+
+  Hif_write::Options aopt;
+  aopt.async_io       = true;
+  aopt.io_buffer_size = 256;  // many buffer swaps and large adds
+
+  std::string big(1000, 'x');
+  for (const auto &[fname, opt] : {std::pair(sname, Hif_write::Options()),
+                                   std::pair(aname, aopt)}) {
+    auto wr = Hif_write::create(fname, "testtool", "0.0.8", opt);
+    EXPECT_NE(wr, nullptr);
+
+    for (auto i = 0; i < 2000; ++i) {
+      auto stmt     = Hif_write::create_node();
+      stmt.instance = "n" + std::to_string(i);
+      stmt.add_input("a", "net" + std::to_string(i / 3));
+      stmt.add_output("y", "net" + std::to_string(i));
+      if (i % 100 == 0)
+        stmt.add_attr("big", big + std::to_string(i));
+      wr->add(stmt);
+    }
+  }
+
+  for (auto ext : {"/0.st", "/0.id"}) {
+    EXPECT_EQ(std::filesystem::file_size(sname + ext),
+              std::filesystem::file_size(aname + ext));
+  }
+
+  auto rd = Hif_read::open(aname);
+  EXPECT_NE(rd, nullptr);
+
+  int conta = 0;
+  rd->each([&conta, &big](const Hif_base::Statement_view &stmt) {
+    EXPECT_EQ(stmt.instance, "n" + std::to_string(conta));
+    EXPECT_EQ(stmt.io[1].rhs, "net" + std::to_string(conta));
+    if (conta % 100 == 0) {
+      EXPECT_EQ(stmt.attr[0].rhs, big + std::to_string(conta));
+    }
+    ++conta;
+  });
+
+  EXPECT_EQ(conta, 2000);
+}
+
+TEST_F(Hif_test, lz_codec) {
+  auto *codec = Hif_codec::lz();
+
+  std::vector<uint8_t> raw;
+  for (auto i = 0; i < 20000; ++i) {  // 0xFF runs and repeated references
+    raw.emplace_back(i % 7 == 0 ? 0xFF : (i * 13) & 0x3F);
+    if (i % 100 == 0)
+      raw.insert(raw.end(), 30, 0xFF);
+  }
+  std::vector<uint8_t> noise(5000);
+  for (auto &c : noise) {
+    c = rand();
+  }
+
+  for (const auto *src : {&raw, &noise}) {
+    std::vector<uint8_t> comp;
+    Hif_codec::encode_block(codec, src->data(), src->size(), comp);
+    EXPECT_LE(comp.size(), src->size() + 8);  // stored if it does not compress
+
+    std::vector<uint8_t> out(src->size());
+    if (comp.size() < src->size() + 8) {
+      EXPECT_TRUE(codec->decompress(comp.data() + 8, comp.size() - 8, out.data(),
+                                    out.size()));
+      EXPECT_EQ(out, *src);
+      // truncated input is an error, not a crash
+      EXPECT_FALSE(codec->decompress(comp.data() + 8, comp.size() - 12, out.data(),
+                                     out.size()));
+    }
+  }
+}
+
+TEST_F(Hif_test, compressed_chunks) {
+  std::string pname("hif_test_compressed_plain");
+  std::string cname("hif_test_compressed");
+
+  Hif_write::Options copt;
+  copt.codec       = Hif_codec::lz();
+  copt.codec_block = 16384;  // many blocks, decompressed in parallel
+  copt.async_io    = true;
+
+  for (const auto &[fname, opt] : {std::pair(pname, Hif_write::Options()),
+                                   std::pair(cname, copt)}) {
+    auto wr = Hif_write::create(fname, "testtool", "0.1.0", opt);
+    EXPECT_NE(wr, nullptr);
+
+    for (auto i = 0; i < 20000; ++i) {
+      auto stmt     = Hif_write::create_node();
+      stmt.instance = "n" + std::to_string(i & 0xFF);
+      stmt.add_input("a", "net" + std::to_string(i & 0x3F));
+      stmt.add_output("y", "net" + std::to_string((i + 1) & 0x3F));
+      wr->add(stmt);
+    }
+  }
+
+  EXPECT_LT(std::filesystem::file_size(cname + "/0.st") * 3,
+            std::filesystem::file_size(pname + "/0.st"));
+
+  auto prd = Hif_read::open(pname);
+  auto crd = Hif_read::open(cname);
+  EXPECT_NE(crd, nullptr);
+  EXPECT_EQ(crd->get_tool(), "testtool");
+
+  int conta = 0;
+  while (prd->next_stmt()) {
+    EXPECT_TRUE(crd->next_stmt());
+    EXPECT_EQ(prd->get_current_view(), crd->get_current_view());
+    ++conta;
+  }
+  EXPECT_FALSE(crd->next_stmt());
+  EXPECT_EQ(conta, 20000);
+
+  EXPECT_TRUE(crd->seek(12345));
+  EXPECT_TRUE(crd->next_stmt());
+  EXPECT_EQ(crd->get_current_view().instance, "n" + std::to_string(12345 & 0xFF));
+
+  // Nested runs (decompress_file inside a worker) stay on the worker thread
+  EXPECT_FALSE(Thread_pool::is_worker());
+  std::atomic<int> nested_off{0};
+  Thread_pool::run(4, 4, [&nested_off](size_t, unsigned) {
+    EXPECT_TRUE(Thread_pool::is_worker());
+    auto id = std::this_thread::get_id();
+    Thread_pool::run(64, 0, [&nested_off, id](size_t, unsigned tid) {
+      if (tid != 0 || std::this_thread::get_id() != id)
+        ++nested_off;
+    });
+  });
+  EXPECT_EQ(nested_off, 0);
+  EXPECT_FALSE(Thread_pool::is_worker());
+}
+
+TEST_F(Hif_test, thread_writer) {
+  std::string fname("hif_test_thread_writer");
+
+  Hif_write::Options opt;
+  opt.max_chunk_stmts = 100;
+
+  constexpr int nthreads = 4;
+  constexpr int nstmts   = 250;
+  {
+    auto wr = Hif_write::create(fname, "testtool", "0.0.9", opt);
+    EXPECT_NE(wr, nullptr);
+
+    std::vector<std::shared_ptr<Hif_write>> writers;
+    for (auto t = 0; t < nthreads; ++t) {
+      writers.emplace_back(wr->thread_writer());
+      EXPECT_NE(writers.back(), nullptr);
+    }
+    auto unused = wr->thread_writer();  // no statements, no chunk
+
+    std::vector<std::thread> threads;
+    for (auto t = nthreads - 1; t >= 0; --t) {
+      threads.emplace_back([t, wr = writers[t]]() {
+        for (auto i = 0; i < nstmts; ++i) {
+          auto stmt     = Hif_write::create_node();
+          stmt.instance = "t" + std::to_string(t) + "_" + std::to_string(i);
+          stmt.add_input("a", "net" + std::to_string(i));
+          wr->add(stmt);
+        }
+      });
+    }
+    for (auto i = 0; i < 10; ++i) {  // the creating writer goes first
+      auto stmt     = Hif_write::create_node();
+      stmt.instance = "root_" + std::to_string(i);
+      wr->add(stmt);
+    }
+    for (auto &th : threads) {
+      th.join();
+    }
+  }
+
+  EXPECT_TRUE(access((fname + "/12.st").c_str(), F_OK) == 0);
+  EXPECT_FALSE(access((fname + "/13.st").c_str(), F_OK) == 0);
+  EXPECT_FALSE(access((fname + "/t1_0.st").c_str(), F_OK) == 0);
+
+  auto rd = Hif_read::open(fname);
+  EXPECT_NE(rd, nullptr);
+  EXPECT_EQ(rd->get_tool(), "testtool");
+
+  std::vector<std::string> names;
+  rd->each([&names](const Hif_base::Statement_view &stmt) {
+    names.emplace_back(stmt.instance);
+  });
+
+  ASSERT_EQ(names.size(), 10 + nthreads * nstmts);
+  EXPECT_EQ(names[0], "root_0");
+  for (auto t = 0; t < nthreads; ++t) {
+    for (auto i = 0; i < nstmts; ++i) {
+      auto name = "t" + std::to_string(t) + "_" + std::to_string(i);
+      EXPECT_EQ(names[10 + t * nstmts + i], name);
+    }
+  }
+}
+
+TEST_F(Hif_test, parallel_each) {
+  std::string fname("hif_test_parallel_each");
+
+  Hif_write::Options opt;
+  opt.max_chunk_stmts = 100;
+
+  {
+    auto wr = Hif_write::create(fname, "testtool", "0.0.7", opt);
+    EXPECT_NE(wr, nullptr);
+
+    for (auto i = 0; i < 5000; ++i) {
+      auto stmt = Hif_write::create_node();
+      stmt.add_input("a", "net" + std::to_string(i % 17));
+      stmt.add_attr("loc", (int64_t)i);
+      wr->add(stmt);
+    }
+  }
+
+  auto rd = Hif_read::open(fname);
+  EXPECT_NE(rd, nullptr);
+  EXPECT_EQ(rd->get_num_chunks(), 51);
+
+  std::vector<std::atomic<int>> seen(5000);
+  using Batch = std::span<const Hif_base::Statement_view>;
+
+  rd->parallel_each(8, [&seen](size_t chunk, Batch batch) {
+    for (const auto &stmt : batch) {
+      auto loc = stmt.attr[0].get_rhs_int64();
+      EXPECT_EQ(chunk, (loc + 1) / 100);  // header is the first statement in chunk 0
+      EXPECT_EQ(stmt.io[0].rhs, "net" + std::to_string(loc % 17));
+      seen[loc]++;
+    }
+  });
+  for (const auto &v : seen) {
+    EXPECT_EQ(v, 1);
+  }
+
+  int64_t next = 0;
+  rd->parallel_each_ordered(8, [&next](size_t, Batch batch) {
+    EXPECT_TRUE(Thread_pool::is_worker());  // the codec does not start more threads
+    for (const auto &stmt : batch) {
+      EXPECT_EQ(stmt.attr[0].get_rhs_int64(), next);
+      ++next;
+    }
+  });
+  EXPECT_EQ(next, 5000);
+  EXPECT_FALSE(Thread_pool::is_worker());
+}
+
+static std::string slurp(const std::string &fname) {
+  std::ifstream f(fname, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(f), {});
+}
+
+static size_t st_bytes(const std::string &dname) {
+  size_t sz = 0;
+  for (auto i = 0; access((dname + "/" + std::to_string(i) + ".st").c_str(), F_OK) == 0;
+       ++i) {
+    sz += std::filesystem::file_size(dname + "/" + std::to_string(i) + ".st");
+  }
+  return sz;
+}
+
+TEST_F(Hif_test, rank_short_refs) {
+  std::string fname1("hif_test_rank_short_refs1");
+  std::string fname2("hif_test_rank_short_refs2");
+
+  Hif_write::Options opt;
+  opt.max_chunk_stmts = 700;
+
+  std::vector<Hif_base::Statement> stmts;
+  for (auto i = 0; i < 2000; ++i) {
+    auto stmt = Hif_write::create_node();
+    // 64 cold IDs first, then clock/reset in every statement
+    stmt.add_input("a", "cold" + std::to_string(i % 64));
+    stmt.add_input("clock");
+    stmt.add_input("reset");
+    stmt.add_output("y", "tmp" + std::to_string(i));
+    stmts.emplace_back(stmt);
+  }
+
+  {
+    auto wr1 = Hif_write::create(fname1, "testtool", "0.0.8", opt);
+    opt.rank_short_refs = true;
+    auto wr2            = Hif_write::create(fname2, "testtool", "0.0.8", opt);
+    for (const auto &stmt : stmts) {
+      wr1->add(stmt);
+      wr2->add(stmt);
+    }
+  }
+
+  EXPECT_LT(st_bytes(fname2), st_bytes(fname1));
+
+  auto rd = Hif_read::open(fname2);
+  EXPECT_NE(rd, nullptr);
+  EXPECT_EQ(rd->get_tool(), "testtool");
+
+  size_t conta = 0;
+  rd->each([&conta, &stmts](const Hif_base::Statement &stmt) {
+    EXPECT_EQ(stmt, stmts[conta]);
+    ++conta;
+  });
+  EXPECT_EQ(conta, stmts.size());
+}
+
+TEST_F(Hif_test, seek_index) {
+  for (auto stride : {0, 16}) {
+    std::string fname("hif_test_seek_index" + std::to_string(stride));
+
+    Hif_write::Options opt;
+    opt.max_chunk_stmts = 7000;
+    opt.index_stride    = stride;
+
+    {
+      auto wr = Hif_write::create(fname, "testtool", "0.0.9", opt);
+      EXPECT_NE(wr, nullptr);
+
+      for (auto i = 0; i < 20000; ++i) {
+        auto stmt = Hif_write::create_node();
+        stmt.add_input("a", "net" + std::to_string(i % 101));
+        stmt.add_attr("loc", (int64_t)i);
+        wr->add(stmt);
+      }
+    }
+    EXPECT_EQ(access((fname + "/0.ix").c_str(), F_OK) == 0, stride != 0);
+
+    auto rd = Hif_read::open(fname);
+    EXPECT_NE(rd, nullptr);
+    EXPECT_EQ(rd->statement_count(), 20000);
+
+    for (auto pos : {0, 1, 15, 16, 17, 6998, 6999, 7000, 13998, 19999, 12345, 3}) {
+      EXPECT_TRUE(rd->seek(pos));
+      EXPECT_TRUE(rd->next_stmt());
+      EXPECT_EQ(rd->get_current_view().attr[0].get_rhs_int64(), pos);
+      EXPECT_EQ(rd->next_stmt(), pos + 1 < 20000);
+      if (pos + 1 < 20000) {
+        EXPECT_EQ(rd->get_current_view().attr[0].get_rhs_int64(), pos + 1);
+      }
+    }
+    EXPECT_TRUE(rd->seek(20000));
+    EXPECT_FALSE(rd->next_stmt());
+    EXPECT_FALSE(rd->seek(20001));
+
+    int64_t next = 0;
+    rd->parallel_each_ordered(4, [&next](size_t, auto batch) {
+      for (const auto &stmt : batch) {
+        EXPECT_EQ(stmt.attr[0].get_rhs_int64(), next);
+        ++next;
+      }
+    });
+    EXPECT_EQ(next, 20000);
+  }
+}
+
+TEST_F(Hif_test, skip_scope) {
+  std::string fname("hif_test_skip_scope");
+
+  Hif_write::Options no_ix;
+  no_ix.index_stride = 0;  // decodes the bodies
+  Hif_write::Options ranked;
+  ranked.rank_short_refs = true;
+  Hif_write::Options split;
+  split.max_chunk_stmts = 64;  // some scopes end in the next chunk
+
+  for (const auto &opt : {Hif_write::Options(), no_ix, ranked, split}) {
+    {
+      auto wr = Hif_write::create(fname, "testtool", "0.1.1", opt);
+
+      for (auto m = 0; m < 20; ++m) {
+        auto def     = Hif_write::create_closed_def();
+        def.instance = "mod" + std::to_string(m);
+        def.add_input("a", "");
+        wr->add(def);
+        for (auto i = 0; i < m; ++i) {
+          auto call     = Hif_write::create_open_call();
+          call.instance = "if" + std::to_string(i);
+          wr->add(call);
+          auto node     = Hif_write::create_node();
+          node.instance = "body" + std::to_string(i);
+          wr->add(node);
+          wr->add(Hif_write::create_end());
+        }
+        wr->add(Hif_write::create_end());
+
+        auto top     = Hif_write::create_node();
+        top.instance = "top" + std::to_string(m);
+        wr->add(top);
+      }
+    }
+
+    auto rd = Hif_read::open(fname);
+    EXPECT_NE(rd, nullptr);
+
+    std::vector<std::string> seen;
+    while (rd->next_stmt()) {
+      const auto &stmt = rd->get_current_view();
+      seen.emplace_back(stmt.instance);
+      if (stmt.is_closed_def()) {
+        auto name = std::string(stmt.instance);
+        EXPECT_TRUE(rd->skip_scope());
+        // the same current statement, with or without N.ix
+        EXPECT_EQ(rd->get_current_view().instance, name);
+        EXPECT_TRUE(rd->get_current_view().is_closed_def());
+        EXPECT_FALSE(rd->skip_scope());
+      } else {
+        EXPECT_FALSE(rd->skip_scope());
+      }
+    }
+
+    ASSERT_EQ(seen.size(), 40);
+    for (auto m = 0; m < 20; ++m) {
+      EXPECT_EQ(seen[2 * m], "mod" + std::to_string(m));
+      EXPECT_EQ(seen[2 * m + 1], "top" + std::to_string(m));
+    }
+  }
+}
+
+TEST_F(Hif_test, open_module) {
+  std::string fname("hif_test_open_module");
+
+  Hif_write::Options ranked;
+  ranked.rank_short_refs = true;
+  ranked.max_chunk_stmts = 200;
+  Hif_write::Options small;  // every module spans 3 or 4 chunks
+  small.max_chunk_stmts = 5;
+
+  for (const auto &opt : {Hif_write::Options(), ranked, small}) {
+    {
+      auto wr = Hif_write::create(fname, "testtool", "0.1.2", opt);
+
+      for (auto m = 0; m < 30; ++m) {
+        auto def     = Hif_write::create_closed_def();
+        def.instance = "mod" + std::to_string(m);
+        def.add_input("a", "");
+        def.add_output("z" + std::to_string(m), "");
+        wr->add(def);
+        for (auto i = 0; i < 10; ++i) {
+          auto node     = Hif_write::create_node();
+          node.instance = "cell" + std::to_string(i);
+          node.add_input("A", "net" + std::to_string(m));
+          wr->add(node);
+        }
+        wr->add(Hif_write::create_end());
+      }
+    }
+
+    auto rd = Hif_read::open(fname);
+    EXPECT_NE(rd, nullptr);
+
+    std::vector<std::string> names;
+    rd->each_module([&names](size_t, const Hif_index::Module &m) {
+      ASSERT_EQ(m.ports.size(), 2);
+      EXPECT_EQ(m.ports[0].name, "a");
+      EXPECT_TRUE(m.ports[0].input);
+      EXPECT_EQ(m.ports[1].name, "z" + m.name.substr(3));
+      EXPECT_FALSE(m.ports[1].input);
+      names.emplace_back(m.name);
+    });
+    ASSERT_EQ(names.size(), 30);  // listed in the chunk of their end
+    for (auto m = 0; m < 30; ++m) {
+      EXPECT_EQ(names[m], "mod" + std::to_string(m));
+    }
+
+    EXPECT_FALSE(rd->open_module("mod_missing"));
+    for (auto m = 0; m < 30; ++m) {
+      ASSERT_TRUE(rd->open_module("mod" + std::to_string(m)));
+
+      std::vector<Hif_base::Statement> body;
+      while (rd->next_stmt()) {
+        body.emplace_back(rd->get_current_stmt());
+      }
+      ASSERT_EQ(body.size(), 12);
+      EXPECT_EQ(body[0].instance, "mod" + std::to_string(m));
+      EXPECT_EQ(body[3].io[0].rhs, "net" + std::to_string(m));
+      EXPECT_TRUE(body[11].is_end());
+    }
+
+    EXPECT_TRUE(rd->seek(0));  // back to the whole design
+    int conta = 0;
+    while (rd->next_stmt()) {
+      ++conta;
+    }
+    EXPECT_EQ(conta, 30 * 12);
+  }
+}
+
+TEST_F(Hif_test, net_index) {
+  std::string fname("hif_test_net_index");
+
+  Hif_write::Options opt;
+  opt.max_chunk_stmts = 100;  // nets in several chunks
+
+  {
+    auto wr = Hif_write::create(fname, "testtool", "0.1.3", opt);
+
+    for (auto i = 0; i < 1000; ++i) {  // chain: cell i reads net i-1, drives net i
+      auto stmt     = Hif_write::create_node();
+      stmt.instance = "cell" + std::to_string(i);
+      stmt.add_input("A", "net" + std::to_string(i > 0 ? i - 1 : 0));
+      stmt.add_input("B", "clk");
+      stmt.add_output("Z", "net" + std::to_string(i));
+      stmt.add_attr("net5", "attr_is_not_a_net");
+      wr->add(stmt);
+    }
+  }
+
+  for (auto mode : {0, 1, 2}) {  // in memory, N.nx, N.nx without the ID table
+    auto rd = Hif_read::open(fname);
+    EXPECT_NE(rd, nullptr);
+    if (mode) {
+      EXPECT_TRUE(rd->build_net_index(2));
+      EXPECT_TRUE(access((fname + "/9.nx").c_str(), F_OK) == 0);
+    }
+    if (mode == 2) {
+      for (auto i = 0; i < 10; ++i) {
+        auto nx  = fname + "/" + std::to_string(i) + ".nx";
+        auto hdr = slurp(nx);
+        ASSERT_GT(hdr.size(), 16);
+        uint32_t n[3];
+        memcpy(n, hdr.data() + 4, sizeof(n));
+        std::filesystem::resize_file(nx, 16 + 4 * (2 * (n[0] + 1) + n[1] + n[2]));
+      }
+    }
+    if (mode) {
+      rd = Hif_read::open(fname);  // from the N.nx files
+    }
+
+    std::vector<uint64_t> drv, rds;
+    rd->each_driver("net5", [&drv](uint64_t stmt) { drv.emplace_back(stmt); });
+    rd->each_reader("net5", [&rds](uint64_t stmt) { rds.emplace_back(stmt); });
+    EXPECT_EQ(drv, std::vector<uint64_t>({5}));
+    EXPECT_EQ(rds, std::vector<uint64_t>({6}));
+
+    size_t clk = 0;
+    rd->each_reader("clk", [&clk, &rd](uint64_t stmt) {
+      EXPECT_TRUE(rd->seek(stmt));
+      EXPECT_TRUE(rd->next_stmt());
+      EXPECT_EQ(rd->get_current_view().instance, "cell" + std::to_string(clk));
+      ++clk;
+    });
+    EXPECT_EQ(clk, 1000);
+
+    size_t none = 0;
+    rd->each_driver("clk", [&none](uint64_t) { ++none; });
+    rd->each_driver("missing", [&none](uint64_t) { ++none; });
+    EXPECT_EQ(none, 0);
+  }
+}
+
+TEST_F(Hif_test, design) {
+  std::string fname("hif_test_design");
+  std::string cname("hif_test_design_copy");
+
+  Hif_write::Options opt;
+  opt.max_chunk_stmts = 300;  // the same IDs in several chunks
+
+  {
+    auto wr = Hif_write::create(fname, "testtool", "0.1.4", opt);
+    for (auto i = 0; i < 2000; ++i) {
+      auto stmt     = i % 10 ? Hif_write::create_node() : Hif_write::create_assign();
+      stmt.type     = i & 0xFFF;
+      stmt.instance = i % 3 ? "cell" + std::to_string(i) : "";
+      stmt.add_input("A", "net" + std::to_string(i & 0x3F));
+      stmt.add_output("Z", "net" + std::to_string((i + 1) & 0x3F));
+      stmt.add_input("C");
+      stmt.add_attr("loc", (int64_t)i);
+      stmt.add_attr("empty", "");
+      wr->add(stmt);
+    }
+  }
+
+  auto design = Hif_design::open(fname);
+  ASSERT_NE(design, nullptr);
+  EXPECT_EQ(design->size(), 2000);
+  EXPECT_EQ(design->get_tool(), "testtool");
+  EXPECT_EQ(design->get_num_ids(), 2000 + 1333 + 64 + 6);  // one per text, all chunks
+
+  int nets = 0;
+  for (auto stmt : *design) {
+    auto io = stmt.get_io();
+    ASSERT_EQ(io.size(), 3);
+    EXPECT_TRUE(stmt.is_input(0));
+    EXPECT_FALSE(stmt.is_input(1));
+    EXPECT_EQ(io[2].rhs, Hif_design::no_id);
+    EXPECT_EQ(design->get_id(io[0].lhs), "A");
+    nets += design->get_id(io[1].rhs) == "net1";
+  }
+  EXPECT_EQ(nets, 2000 / 64 + 1);
+
+  EXPECT_TRUE(design->write(cname));
+
+  auto rd1 = Hif_read::open(fname);
+  auto rd2 = Hif_read::open(cname);
+  int  conta = 0;
+  while (rd1->next_stmt()) {
+    EXPECT_TRUE(rd2->next_stmt());
+    EXPECT_EQ(rd1->get_current_view(), rd2->get_current_view());
+    ++conta;
+  }
+  EXPECT_FALSE(rd2->next_stmt());
+  EXPECT_EQ(conta, 2000);
+
+  // Write errors are returned (file size limit)
+  {
+    struct rlimit old_lim;
+    ASSERT_EQ(getrlimit(RLIMIT_FSIZE, &old_lim), 0);
+    auto old_sig = signal(SIGXFSZ, SIG_IGN);
+    auto lim     = old_lim;
+    lim.rlim_cur = 4 << 10;
+    ASSERT_EQ(setrlimit(RLIMIT_FSIZE, &lim), 0);
+    std::filesystem::remove_all(cname + "_err");
+    bool ok = design->write(cname + "_err");
+    setrlimit(RLIMIT_FSIZE, &old_lim);
+    signal(SIGXFSZ, old_sig);
+    EXPECT_FALSE(ok);
+  }
+
+  // 3 io + 2 attr per statement, far below a vector<Statement> (without its strings)
+  EXPECT_LT(design->memory_bytes() * 3, 2000 * 5 * sizeof(Hif_base::Tuple_entry));
+}
+
+TEST_F(Hif_test, statement_builder) {
+  std::string sname("hif_test_builder_stmt");
+  std::string bname("hif_test_builder");
+
+  {
+    auto ws = Hif_write::create(sname, "testtool", "0.1.5");
+    auto wb = Hif_write::create(bname, "testtool", "0.1.5");
+
+    std::string big(300, 'x');  // grows the arena while building
+    for (auto i = 0; i < 500; ++i) {
+      auto stmt     = Hif_write::create_node();
+      stmt.type     = i & 0xFFF;
+      stmt.instance = "cell" + std::to_string(i);
+      stmt.add_input("A", "net" + std::to_string(i & 0x3F));
+      stmt.add_output("Z", big + std::to_string(i));
+      stmt.add_input("C");
+      stmt.add_attr("loc", (int64_t)i);
+      stmt.add_attr("empty", "");
+      ws->add(stmt);
+
+      auto &b = wb->builder(Hif_base::Statement_class::Node);
+      b.type  = i & 0xFFF;
+      b.set_instance("cell" + std::to_string(i));
+      b.add_input("A", "net" + std::to_string(i & 0x3F));
+      b.add_output("Z", big + std::to_string(i));
+      b.add_input("C");
+      b.add_attr("loc", (int64_t)i);
+      b.add_attr("empty", "");
+      wb->add(b);
+    }
+  }
+
+  for (auto ext : {"/0.st", "/0.id"}) {
+    EXPECT_EQ(std::filesystem::file_size(sname + ext),
+              std::filesystem::file_size(bname + ext));
+  }
+
+  auto rd1 = Hif_read::open(sname);
+  auto rd2 = Hif_read::open(bname);
+  int  conta = 0;
+  while (rd1->next_stmt()) {
+    EXPECT_TRUE(rd2->next_stmt());
+    EXPECT_EQ(rd1->get_current_view(), rd2->get_current_view());
+    ++conta;
+  }
+  EXPECT_EQ(conta, 500);
+
+  // Once the IDs are known and the arena is at its peak, building and adding a
+  // statement does not allocate
+  auto wr  = Hif_write::create(bname, "testtool", "0.1.5");
+  auto add = [&wr](int i) {
+    char inst[16], a[16], z[16];
+    snprintf(inst, sizeof(inst), "inst%d", i & 0xFF);
+    snprintf(a, sizeof(a), "net%d", i & 0x3F);
+    snprintf(z, sizeof(z), "net%d", (i + 1) & 0x3F);
+    auto &b = wr->builder();
+    b.set_instance(inst);
+    b.add_input("A", a);
+    b.add_output("Z", z);
+    wr->add(b);
+  };
+  for (auto i = 0; i < 256; ++i) {
+    add(i);
+  }
+  auto start = num_allocs;
+  for (auto i = 0; i < 10000; ++i) {
+    add(i);
+  }
+  EXPECT_LE(num_allocs - start, 10000 / 100) << "allocations per statement";
+}
+
+TEST_F(Hif_test, scan) {
+  // Random reference lists, every implementation finds the same structural bytes
+  std::vector<uint8_t> buf(4096);
+  uint32_t             seed = 1;
+  for (auto &b : buf) {
+    seed = seed * 1103515245 + 12345;
+    b    = (seed >> 16) & 0xFF;
+    if ((seed >> 8) & 0x7)
+      b |= 1;  // mostly short references
+  }
+  const auto *end = buf.data() + buf.size();
+  for (size_t i = 0; i < buf.size(); i += 7) {
+    auto scalar = Hif_scan::find_structural(Hif_scan::Impl::Scalar, &buf[i], end);
+    for (auto impl : {Hif_scan::Impl::Sse2, Hif_scan::Impl::Avx2}) {
+      EXPECT_EQ(Hif_scan::find_structural(impl, &buf[i], end), scalar);
+    }
+  }
+
+  std::string fname("hif_test_scan");
+
+  Hif_write::Options opt;
+  opt.max_chunk_stmts = 3000;
+  opt.index_stride    = 0;  // statement_count scans too
+
+  std::array<uint64_t, 16> expected{};
+  {
+    auto wr = Hif_write::create(fname, "testtool", "0.1.6", opt);
+
+    for (auto i = 0; i < 10000; ++i) {
+      auto stmt = Hif_write::create_node();
+      if (i % 13 == 0) {
+        stmt = Hif_write::create_assign();
+      } else if (i % 17 == 0) {
+        stmt = Hif_write::create_attr();
+      }
+      stmt.type = i & 0xFFF;  // 0xFF type bytes
+      if (i & 1)
+        stmt.instance = "i" + std::to_string(i % 300);  // long references
+      for (auto j = 0; j < i % 5; ++j) {
+        stmt.add_input("p" + std::to_string(j), "net" + std::to_string((i + j) % 700));
+      }
+      stmt.add_attr("loc", (int64_t)i);
+      ++expected[stmt.sclass];
+      wr->add(stmt);
+    }
+  }
+
+  auto rd = Hif_read::open(fname);
+  EXPECT_NE(rd, nullptr);
+
+  std::array<uint64_t, 16> count{};
+  EXPECT_EQ(rd->count_statements(count.data()), 10000);
+  EXPECT_EQ(count, expected);
+  EXPECT_EQ(rd->statement_count(), 10000);
+
+  EXPECT_EQ(rd->skip(0), 0);
+  EXPECT_TRUE(rd->next_stmt());
+  EXPECT_EQ(rd->get_current_view().attr[0].get_rhs_int64(), 0);
+
+  int64_t pos = 0;
+  for (auto n : {1, 2, 100, 2998, 3000, 1, 0, 3000}) {
+    EXPECT_EQ(rd->skip(n), n);
+    pos += n + 1;
+    EXPECT_TRUE(rd->next_stmt());
+    EXPECT_EQ(rd->get_current_view().attr[0].get_rhs_int64(), pos);
+  }
+  EXPECT_EQ(rd->skip(10000), 10000 - pos - 1);
+  EXPECT_FALSE(rd->next_stmt());
+}
+
+TEST_F(Hif_test, stream) {
+  std::string fname("hif_test_stream");
+
+  Hif_write::Options opt;
+  opt.max_chunk_stmts = 500;  // dictionary resets
+
+  std::string big(5000, 'b');  // larger than the reader buffer
+  auto        add_stmts = [&big](Hif_write &wr) {
+    for (auto i = 0; i < 2000; ++i) {
+      auto stmt     = Hif_write::create_node();
+      stmt.type     = i & 0xFFF;
+      stmt.instance = "inst" + std::to_string(i % 300);
+      stmt.add_input("A", "net" + std::to_string(i % 97));
+      stmt.add_output("Z", i % 500 == 7 ? big + std::to_string(i) : "z");
+      stmt.add_attr("loc", (int64_t)i);
+      wr.add(stmt);
+    }
+  };
+
+  {
+    auto wr = Hif_write::create(fname, "testtool", "0.1.7", opt);
+    add_stmts(*wr);
+  }
+
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+
+  std::thread producer([&]() {
+    auto wr = Hif_write::create_stream(fds[1], "testtool", "0.1.7", opt);
+    EXPECT_NE(wr, nullptr);
+    add_stmts(*wr);
+    wr = nullptr;
+    close(fds[1]);
+  });
+
+  auto srd = Hif_stream_read::open(fds[0], 64);  // most statements straddle reads
+  ASSERT_NE(srd, nullptr);
+  EXPECT_EQ(srd->get_tool(), "testtool");
+  EXPECT_EQ(srd->get_version(), "0.1.7");
+
+  auto rd    = Hif_read::open(fname);
+  int  conta = 0;
+  srd->each([&](const Hif_base::Statement_view &stmt) {
+    EXPECT_TRUE(rd->next_stmt());
+    EXPECT_EQ(stmt, rd->get_current_view());
+    ++conta;
+  });
+  EXPECT_EQ(conta, 2000);
+  EXPECT_FALSE(rd->next_stmt());
+
+  producer.join();
+  close(fds[0]);
+
+  // Also a regular file, then truncated through a pipe
+  auto sname = fname + ".stream";
+  int  fd    = ::open(sname.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  {
+    auto wr = Hif_write::create_stream(fd, "testtool", "0.1.7");
+    add_stmts(*wr);
+  }
+  lseek(fd, 0, SEEK_SET);
+  srd   = Hif_stream_read::open(fd);
+  conta = 0;
+  srd->each([&conta](const Hif_base::Statement_view &) { ++conta; });
+  EXPECT_EQ(conta, 2000);
+
+  std::vector<char> bytes(3000);
+  EXPECT_EQ(pread(fd, bytes.data(), bytes.size(), 0), (ssize_t)bytes.size());
+  close(fd);
+
+  ASSERT_EQ(pipe(fds), 0);
+  EXPECT_EQ(write(fds[1], bytes.data(), bytes.size()), (ssize_t)bytes.size());
+  close(fds[1]);
+  srd = Hif_stream_read::open(fds[0]);
+  ASSERT_NE(srd, nullptr);
+  conta = 0;
+  srd->each([&conta](const Hif_base::Statement_view &) { ++conta; });
+  EXPECT_EQ(conta, 7);  // stops in the ID frame of the 5000 byte ID
+  close(fds[0]);
+
+  EXPECT_EQ(Hif_stream_read::open(-1), nullptr);
+}
+
+TEST_F(Hif_test, pack) {
+  std::string dname("hif_test_pack_dir");
+  std::string pname("hif_test_pack.hif");
+
+  Hif_write::Options opt;
+  opt.max_chunk_stmts = 1000;
+  opt.index_stride    = 64;
+
+  auto add_stmts = [](Hif_write &wr, int begin, int end) {
+    for (auto i = begin; i < end; ++i) {
+      auto stmt     = Hif_write::create_node();
+      stmt.instance = "i" + std::to_string(i);
+      stmt.add_input("A", "net" + std::to_string(i % 50));
+      stmt.add_output("Z", "out" + std::to_string(i));
+      stmt.add_attr("loc", (int64_t)i);
+      wr.add(stmt);
+    }
+  };
+
+  for (const auto &name : {dname, pname}) {
+    auto wr = Hif_write::create(name, "testtool", "0.1.8", opt);
+    ASSERT_NE(wr, nullptr);
+    add_stmts(*wr, 0, 2500);
+    auto tw = wr->thread_writer();
+    add_stmts(*tw, 2500, 4000);
+  }
+
+  EXPECT_TRUE(std::filesystem::is_regular_file(pname));
+  EXPECT_FALSE(std::filesystem::exists(pname + ".tmp"));
+
+  auto pk = Hif_pack::open(pname);
+  ASSERT_NE(pk, nullptr);
+  for (const auto &f : pk->get_files()) {
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(f.data) % 4096, 0);
+    EXPECT_EQ(f.size, std::filesystem::file_size(dname + "/" + std::string(f.name)));
+  }
+  EXPECT_EQ(pk->find("0.st")->size, std::filesystem::file_size(dname + "/0.st"));
+  EXPECT_EQ(pk->find("9.st"), nullptr);
+
+  auto rd1 = Hif_read::open(dname);
+  auto rd2 = Hif_read::open(pname);
+  ASSERT_NE(rd2, nullptr);
+  EXPECT_EQ(rd2->get_tool(), "testtool");
+  EXPECT_EQ(rd2->get_num_chunks(), rd1->get_num_chunks());
+  EXPECT_EQ(pk->get_files().size(), 4 * rd1->get_num_chunks());  // st, id, ix and ck
+  int conta = 0;
+  while (rd1->next_stmt()) {
+    EXPECT_TRUE(rd2->next_stmt());
+    EXPECT_EQ(rd1->get_current_view(), rd2->get_current_view());
+    ++conta;
+  }
+  EXPECT_FALSE(rd2->next_stmt());
+  EXPECT_EQ(conta, 4000);
+
+  EXPECT_EQ(rd2->statement_count(), 4000);
+  EXPECT_TRUE(rd2->seek(3210));
+  EXPECT_TRUE(rd2->next_stmt());
+  EXPECT_EQ(rd2->get_current_view().attr[0].get_rhs_int64(), 3210);
+
+  EXPECT_TRUE(rd2->build_net_index());  // in memory
+  std::vector<uint64_t> readers;
+  rd2->each_reader("net7", [&readers](uint64_t stmt) { readers.emplace_back(stmt); });
+  EXPECT_EQ(readers.size(), 4000 / 50);
+
+  // Converters, same bytes both ways
+  std::string uname("hif_test_pack_unpacked");
+  std::filesystem::remove_all(uname);
+  EXPECT_TRUE(Hif_pack::unpack(pname, uname));
+  EXPECT_TRUE(Hif_pack::pack(uname, "hif_test_pack2.hif"));
+  EXPECT_EQ(std::filesystem::file_size(pname),
+            std::filesystem::file_size("hif_test_pack2.hif"));
+  for (const auto &f : pk->get_files()) {
+    auto path = uname + "/" + std::string(f.name);
+    EXPECT_EQ(f.size, std::filesystem::file_size(path));
+  }
+  EXPECT_FALSE(Hif_pack::is_pack(uname + "/0.st"));
+  EXPECT_TRUE(Hif_pack::is_pack("hif_test_pack2.hif"));
+
+  // A failed write keeps the directory and leaves no pack (file size limit)
+  {
+    struct rlimit old_lim;
+    ASSERT_EQ(getrlimit(RLIMIT_FSIZE, &old_lim), 0);
+    auto old_sig = signal(SIGXFSZ, SIG_IGN);
+    auto lim     = old_lim;
+    lim.rlim_cur = 64 << 10;
+    ASSERT_EQ(setrlimit(RLIMIT_FSIZE, &lim), 0);
+    std::filesystem::remove("hif_test_pack4.hif");
+    bool ok = Hif_pack::pack(uname, "hif_test_pack4.hif", true);
+    setrlimit(RLIMIT_FSIZE, &old_lim);
+    signal(SIGXFSZ, old_sig);
+    EXPECT_FALSE(ok);
+    EXPECT_TRUE(std::filesystem::exists(uname + "/0.st"));
+    EXPECT_FALSE(std::filesystem::exists("hif_test_pack4.hif"));
+    EXPECT_FALSE(std::filesystem::exists("hif_test_pack4.hif.part"));
+  }
+
+  // Entry names that are not chunk files are rejected, not parsed
+  std::filesystem::copy_file(pname,
+                             "hif_test_pack_bad.hif",
+                             std::filesystem::copy_options::overwrite_existing);
+  {
+    std::fstream f("hif_test_pack_bad.hif",
+                   std::ios::in | std::ios::out | std::ios::binary);
+    f.seekp(16 + 32);  // second entry name
+    f.write("zz.st", 6);
+  }
+  EXPECT_EQ(Hif_pack::open("hif_test_pack_bad.hif"), nullptr);
+  EXPECT_EQ(Hif_read::open("hif_test_pack_bad.hif"), nullptr);
+  EXPECT_FALSE(Hif_pack::unpack("hif_test_pack_bad.hif", "hif_test_pack_bad"));
+
+  // An existing pack is rewritten as a pack, even without .hif
+  std::filesystem::copy_file(pname,
+                             "hif_test_pack3",
+                             std::filesystem::copy_options::overwrite_existing);
+  {
+    auto wr = Hif_write::create(std::string("hif_test_pack3"), "testtool", "0.1.9");
+    add_stmts(*wr, 0, 10);
+  }
+  auto rd3 = Hif_read::open("hif_test_pack3");
+  ASSERT_NE(rd3, nullptr);
+  EXPECT_EQ(rd3->get_version(), "0.1.9");
+  EXPECT_EQ(rd3->statement_count(), 10);
+}
+
+TEST_F(Hif_test, open_append) {
+  std::vector<Hif_write::Statement> stmts;
+  {
+    auto stmt     = Hif_write::create_open_def();
+    stmt.instance = "top";
+    stmt.add_input("a");
+    stmt.add_output("z");
+    stmts.emplace_back(stmt);
+  }
+  for (auto i = 0; i < 300; ++i) {
+    auto stmt     = Hif_write::create_node();
+    stmt.instance = "i" + std::to_string(i);
+    stmt.add_input("A", "net" + std::to_string(i % 40));
+    stmt.add_output("Z", "out" + std::to_string(i));
+    stmts.emplace_back(stmt);
+  }
+  stmts.emplace_back(Hif_write::create_end());
+  for (auto i = 0; i < 50; ++i) {
+    auto stmt = Hif_write::create_attr();
+    stmt.add_attr("slack", "out" + std::to_string(i));
+    stmts.emplace_back(stmt);
+  }
+
+  // Appending (split inside the module scope) writes the same bytes as one writer
+  for (uint32_t max_stmts : {100u, 1u << 20}) {
+    Hif_write::Options opt;
+    opt.index_stride    = 16;
+    opt.max_chunk_stmts = max_stmts;
+
+    {
+      auto wr = Hif_write::create(std::string("hif_test_append_one"), "t", "1", opt);
+      for (const auto &stmt : stmts) {
+        wr->add(stmt);
+      }
+    }
+    auto split = 150u;
+    {
+      auto wr = Hif_write::create(std::string("hif_test_append"), "t", "1", opt);
+      for (auto i = 0u; i < split; ++i) {
+        wr->add(stmts[i]);
+      }
+    }
+    {
+      auto wr = Hif_write::open_append("hif_test_append", opt);
+      ASSERT_NE(wr, nullptr);
+      for (auto i = split; i < stmts.size(); ++i) {
+        wr->add(stmts[i]);
+      }
+    }
+
+    int nfiles = 0;
+    for (const auto &ent : std::filesystem::directory_iterator("hif_test_append_one")) {
+      auto name = ent.path().filename().string();
+      EXPECT_EQ(slurp(ent.path().string()), slurp("hif_test_append/" + name)) << name;
+      ++nfiles;
+    }
+    EXPECT_EQ(nfiles, 4 * ((stmts.size() + max_stmts) / max_stmts));  // st, id, ix and ck
+  }
+
+  auto rd = Hif_read::open("hif_test_append");
+  ASSERT_NE(rd, nullptr);
+  EXPECT_EQ(rd->statement_count(), stmts.size());
+  EXPECT_TRUE(rd->open_module("top"));
+
+  // New chunk when the last one can not continue, thread writers go after it
+  {
+    Hif_write::Options opt;
+    opt.rank_short_refs = true;
+    auto wr             = Hif_write::open_append("hif_test_append", opt);
+    ASSERT_NE(wr, nullptr);
+    wr->add(stmts[5]);
+    auto tw = wr->thread_writer();
+    tw->add(stmts[6]);
+  }
+  rd = Hif_read::open("hif_test_append");
+  EXPECT_EQ(rd->get_num_chunks(), 3);
+  EXPECT_TRUE(rd->seek(stmts.size() + 1));
+  EXPECT_TRUE(rd->next_stmt());
+  EXPECT_EQ(rd->get_current_view().instance, stmts[6].instance);
+
+  // Packs
+  Hif_pack::pack("hif_test_append_one", "hif_test_append.hif");
+  {
+    auto wr = Hif_write::open_append("hif_test_append.hif");
+    ASSERT_NE(wr, nullptr);
+    wr->add(stmts[7]);
+  }
+  EXPECT_TRUE(std::filesystem::is_regular_file("hif_test_append.hif"));
+  rd = Hif_read::open("hif_test_append.hif");
+  ASSERT_NE(rd, nullptr);
+  EXPECT_EQ(rd->statement_count(), stmts.size() + 1);
+
+  // Packs with more chunks are appended in place, and get the same files as packing
+  // the appended directory
+  {
+    Hif_write::Options opt;
+    opt.max_chunk_stmts = 100;
+    for (auto name : {"hif_test_append_pk", "hif_test_append_pk.hif"}) {
+      auto wr = Hif_write::create(std::string(name), "t", "1", opt);
+      for (auto i = 0u; i < 150; ++i) {
+        wr->add(stmts[i]);
+      }
+    }
+    struct stat before, after;
+    ASSERT_EQ(stat("hif_test_append_pk.hif", &before), 0);
+    for (auto name : {"hif_test_append_pk", "hif_test_append_pk.hif"}) {
+      auto wr = Hif_write::open_append(name, opt);
+      ASSERT_NE(wr, nullptr);
+      for (auto i = 150u; i < stmts.size(); ++i) {
+        wr->add(stmts[i]);
+      }
+    }
+    ASSERT_EQ(stat("hif_test_append_pk.hif", &after), 0);
+    EXPECT_EQ(before.st_ino, after.st_ino);
+    EXPECT_FALSE(std::filesystem::exists("hif_test_append_pk.hif.tmp"));
+
+    ASSERT_TRUE(Hif_pack::pack("hif_test_append_pk", "hif_test_append_pk2.hif"));
+    auto pk  = Hif_pack::open("hif_test_append_pk.hif");
+    auto pk2 = Hif_pack::open("hif_test_append_pk2.hif");
+    ASSERT_NE(pk, nullptr);
+    ASSERT_NE(pk2, nullptr);
+    ASSERT_EQ(pk->get_files().size(), pk2->get_files().size());
+    for (auto i = 0u; i < pk->get_files().size(); ++i) {
+      const auto &f  = pk->get_files()[i];
+      const auto &f2 = pk2->get_files()[i];
+      EXPECT_EQ(f.name, f2.name);
+      EXPECT_EQ(std::string_view(reinterpret_cast<const char *>(f.data), f.size),
+                std::string_view(reinterpret_cast<const char *>(f2.data), f2.size));
+    }
+    EXPECT_LE(slurp("hif_test_append_pk.hif").size(),
+              2 * slurp("hif_test_append_pk2.hif").size());
+    rd = Hif_read::open("hif_test_append_pk.hif");
+    ASSERT_NE(rd, nullptr);
+    EXPECT_EQ(rd->statement_count(), stmts.size());
+    EXPECT_TRUE(rd->verify());
+  }
+
+  EXPECT_EQ(Hif_write::open_append("hif_test_append_missing"), nullptr);
+}
+
+TEST_F(Hif_test, delta) {
+  auto node = [](const std::string &name) {
+    auto stmt     = Hif_write::create_node();
+    stmt.instance = name;
+    stmt.add_input("A", "n" + name);
+    stmt.add_output("Z", "o" + name);
+    return stmt;
+  };
+
+  std::vector<std::string> expected;
+  {
+    Hif_write::Options opt;
+    opt.max_chunk_stmts = 300;
+    opt.index_stride    = 32;
+    auto wr = Hif_write::create(std::string("hif_test_delta_base"), "base", "1", opt);
+    for (auto i = 0; i < 1000; ++i) {
+      expected.emplace_back("b" + std::to_string(i));
+      wr->add(node(expected.back()));
+    }
+  }
+
+  {
+    auto dt = Hif_delta::create("hif_test_delta", "hif_test_delta_base", "eco", "2");
+    ASSERT_NE(dt, nullptr);
+    EXPECT_TRUE(dt->insert(0, node("x0")));
+    EXPECT_TRUE(dt->insert(0, node("x1")));
+    EXPECT_TRUE(dt->replace(10, node("r10")));
+    EXPECT_TRUE(dt->erase(100, 150));
+    EXPECT_TRUE(dt->replace(400, node("r400")));
+    EXPECT_TRUE(dt->insert(401, node("x401")));
+    EXPECT_TRUE(dt->insert(1000, node("x1000")));
+    EXPECT_FALSE(dt->insert(500, node("late")));  // goes back
+    EXPECT_FALSE(dt->erase(1000, 1001));          // past the base
+  }
+  expected.insert(expected.end(), "x1000");
+  expected.insert(expected.begin() + 401, "x401");
+  expected[400] = "r400";
+  expected.erase(expected.begin() + 100, expected.begin() + 150);
+  expected[10] = "r10";
+  expected.insert(expected.begin(), {"x0", "x1"});
+
+  Hif_delta::Ops ops;
+  EXPECT_TRUE(Hif_delta::read_ops("hif_test_delta", ops));
+  EXPECT_EQ(ops.ops.size(), 5);  // replace 400 and insert 401 are one op
+  EXPECT_NE(ops.base_stamp, 0);
+  EXPECT_EQ(ops.base_stamp, Hif_read::open("hif_test_delta_base")->file_stamp());
+  EXPECT_FALSE(Hif_delta::read_ops("hif_test_delta_base", ops));
+
+  auto rd = Hif_delta_read::open("hif_test_delta");
+  ASSERT_NE(rd, nullptr);
+  EXPECT_EQ(rd->get_tool(), "eco");
+  EXPECT_EQ(rd->statement_count(), expected.size());
+
+  std::vector<std::string> patched;
+  rd->each([&patched](const Hif_base::Statement_view &stmt) {
+    patched.emplace_back(stmt.instance);
+  });
+  EXPECT_EQ(patched, expected);
+
+  for (auto i = 0u; i < expected.size(); i += 7) {
+    EXPECT_TRUE(rd->seek(i));
+    EXPECT_TRUE(rd->next_stmt());
+    EXPECT_EQ(rd->get_current_view().instance, expected[i]) << i;
+  }
+  EXPECT_TRUE(rd->seek(expected.size() - 1));
+  EXPECT_TRUE(rd->next_stmt());
+  EXPECT_FALSE(rd->next_stmt());
+
+  // Compaction, to a directory and to a pack
+  for (std::string out : {"hif_test_delta_full", "hif_test_delta_full.hif"}) {
+    EXPECT_TRUE(Hif_delta::compact("hif_test_delta", out));
+    auto full = Hif_read::open(out);
+    ASSERT_NE(full, nullptr);
+    patched.clear();
+    full->each([&patched](const Hif_base::Statement_view &stmt) {
+      patched.emplace_back(stmt.instance);
+    });
+    EXPECT_EQ(patched, expected);
+  }
+
+  // The delta only works on the same base
+  std::filesystem::remove_all("hif_test_delta_base2");
+  std::filesystem::copy("hif_test_delta_base", "hif_test_delta_base2");
+  EXPECT_NE(Hif_read::open("hif_test_delta_base2")->file_stamp(), ops.base_stamp);
+  EXPECT_NE(Hif_delta_read::open("hif_test_delta", "hif_test_delta_base2"), nullptr);
+
+  // Until the copy changes
+  {
+    auto wr = Hif_write::open_append("hif_test_delta_base2");
+    wr->add(node("more"));
+  }
+  EXPECT_EQ(Hif_delta_read::open("hif_test_delta", "hif_test_delta_base2"), nullptr);
+
+  // Write errors are returned (file size limit)
+  {
+    std::filesystem::remove_all("hif_test_delta_err");
+    std::filesystem::remove_all("hif_test_delta_err2");
+    auto dt = Hif_delta::create("hif_test_delta_err2", "hif_test_delta_base", "eco", "2");
+    ASSERT_NE(dt, nullptr);
+    for (auto i = 0; i < 1000; ++i) {
+      dt->insert(0, node("e" + std::to_string(i)));
+    }
+
+    struct rlimit old_lim;
+    ASSERT_EQ(getrlimit(RLIMIT_FSIZE, &old_lim), 0);
+    auto old_sig = signal(SIGXFSZ, SIG_IGN);
+    auto lim     = old_lim;
+    lim.rlim_cur = 4 << 10;
+    ASSERT_EQ(setrlimit(RLIMIT_FSIZE, &lim), 0);
+    bool compacted = Hif_delta::compact("hif_test_delta", "hif_test_delta_err");
+    bool closed    = dt->close();
+    setrlimit(RLIMIT_FSIZE, &old_lim);
+    signal(SIGXFSZ, old_sig);
+    EXPECT_FALSE(compacted);
+    EXPECT_FALSE(closed);
+    EXPECT_FALSE(std::filesystem::exists("hif_test_delta_err2/0.dx"));
+  }
+}
+
+TEST_F(Hif_test, module_hash) {
+  auto add_module = [](Hif_write &wr, const std::string &name, int ninst, int skew) {
+    auto def     = Hif_write::create_closed_def();
+    def.instance = name;
+    def.add_input("a");
+    def.add_output("z");
+    wr.add(def);
+    for (auto i = 0; i < ninst; ++i) {
+      auto stmt     = Hif_write::create_node();
+      stmt.type     = 7;
+      stmt.instance = "u" + std::to_string(i);
+      stmt.add_input("A", "w" + std::to_string(i + skew));
+      stmt.add_output("Z", "w" + std::to_string(i + 1));
+      stmt.add_attr("loc", (int64_t)i);
+      wr.add(stmt);
+    }
+    wr.add(Hif_write::create_end());
+  };
+
+  // Different ID positions: other modules first, ranked short references
+  Hif_write::Options ranked;
+  ranked.rank_short_refs = true;
+  {
+    auto wr = Hif_write::create(std::string("hif_test_mhash1"), "t", "1");
+    add_module(*wr, "adder", 100, 0);
+    add_module(*wr, "mult", 50, 0);
+  }
+  {
+    auto wr = Hif_write::create(std::string("hif_test_mhash2"), "t", "1", ranked);
+    add_module(*wr, "other", 300, 3);
+    add_module(*wr, "mult", 50, 0);
+    add_module(*wr, "adder", 100, 0);
+  }
+  {
+    auto wr = Hif_write::create(std::string("hif_test_mhash3"), "t", "1");
+    add_module(*wr, "adder", 100, 1);  // one net changed in the first node
+  }
+
+  auto rd1 = Hif_read::open("hif_test_mhash1");
+  auto rd2 = Hif_read::open("hif_test_mhash2");
+  auto rd3 = Hif_read::open("hif_test_mhash3");
+
+  EXPECT_NE(rd1->get_module_hash("adder"), 0);
+  EXPECT_EQ(rd1->get_module_hash("adder"), rd2->get_module_hash("adder"));
+  EXPECT_EQ(rd1->get_module_hash("mult"), rd2->get_module_hash("mult"));
+  EXPECT_NE(rd1->get_module_hash("adder"), rd1->get_module_hash("mult"));
+  EXPECT_NE(rd1->get_module_hash("adder"), rd3->get_module_hash("adder"));
+  EXPECT_EQ(rd1->get_module_hash("missing"), 0);
+
+  rd1->each_module([&rd2](size_t, const Hif_index::Module &m) {
+    EXPECT_EQ(m.hash, rd2->get_module_hash(m.name));
+  });
+
+  // Modules larger than a chunk keep their hash, also when appended mid module
+  Hif_write::Options small;
+  small.max_chunk_stmts = 16;
+
+  auto ranked_small            = small;
+  ranked_small.rank_short_refs = true;
+  for (const auto &opt : {small, ranked_small}) {
+    {
+      auto wr = Hif_write::create(std::string("hif_test_mhash4"), "t", "1", opt);
+      add_module(*wr, "mult", 50, 0);
+      add_module(*wr, "adder", 100, 0);
+    }
+    auto rd4 = Hif_read::open("hif_test_mhash4");
+    ASSERT_NE(rd4, nullptr);
+    EXPECT_GT(rd4->get_num_chunks(), 9);
+    EXPECT_EQ(rd4->get_module_hash("adder"), rd1->get_module_hash("adder"));
+    EXPECT_EQ(rd4->get_module_hash("mult"), rd1->get_module_hash("mult"));
+  }
+  {
+    auto wr      = Hif_write::create(std::string("hif_test_mhash5"), "t", "1", small);
+    auto def     = Hif_write::create_closed_def();
+    def.instance = "adder";
+    def.add_input("a");
+    def.add_output("z");
+    wr->add(def);
+  }
+  {
+    auto wr = Hif_write::open_append("hif_test_mhash5", small);
+    ASSERT_NE(wr, nullptr);
+    for (auto i = 0; i < 100; ++i) {
+      auto stmt     = Hif_write::create_node();
+      stmt.type     = 7;
+      stmt.instance = "u" + std::to_string(i);
+      stmt.add_input("A", "w" + std::to_string(i));
+      stmt.add_output("Z", "w" + std::to_string(i + 1));
+      stmt.add_attr("loc", (int64_t)i);
+      wr->add(stmt);
+    }
+    wr->add(Hif_write::create_end());
+  }
+  auto rd5 = Hif_read::open("hif_test_mhash5");
+  ASSERT_NE(rd5, nullptr);
+  EXPECT_EQ(rd5->get_module_hash("adder"), rd1->get_module_hash("adder"));
+}
+
+TEST_F(Hif_test, each_batch) {
+  std::string fname("hif_test_each_batch");
+
+  Hif_write::Options opt;
+  opt.max_chunk_stmts = 300;
+
+  {
+    auto wr = Hif_write::create(fname, "testtool", "0.1.0", opt);
+    for (auto i = 0; i < 1000; ++i) {
+      auto stmt = Hif_write::create_node();
+      stmt.add_attr("loc", (int64_t)i);
+      wr->add(stmt);
+    }
+  }
+
+  int64_t next = 0;
+  auto    rd   = Hif_read::open(fname);
+  rd->each_batch(64, [&next](std::span<const Hif_base::Statement_view> batch) {
+    EXPECT_LE(batch.size(), 64);
+    for (const auto &stmt : batch) {
+      EXPECT_EQ(stmt.attr[0].get_rhs_int64(), next);
+      ++next;
+    }
+  });
+  EXPECT_EQ(next, 1000);
+
+  next = 0;
+  rd   = Hif_read::open(fname);
+  rd->each([&next](const auto &stmt) {  // generic lambdas get the zero-copy view
+    EXPECT_EQ(stmt.attr[0].get_rhs_int64(), next);
+    ++next;
+  });
+  EXPECT_EQ(next, 1000);
+}
+
+TEST_F(Hif_test, crc32c) {
+  EXPECT_EQ(Hif_crc::crc32c("123456789", 9), 0xE3069283);  // check value
+  EXPECT_EQ(Hif_crc::crc32c("", 0), 0);
+
+  std::vector<uint8_t> data(100000);
+  for (auto &c : data) {
+    c = rand();
+  }
+  // lengths around the interleaved stream sizes
+  for (size_t sz : {0, 7, 255, 768, 769, 8191, 24576, 24583, 30000, 100000}) {
+    auto crc = Hif_crc::crc32c(Hif_crc::Impl::Table, data.data(), sz);
+    EXPECT_EQ(Hif_crc::crc32c(Hif_crc::Impl::Sse42, data.data(), sz), crc) << sz;
+    auto part = Hif_crc::crc32c(data.data(), sz / 3);
+    EXPECT_EQ(Hif_crc::crc32c(data.data() + sz / 3, sz - sz / 3, part), crc) << sz;
+  }
+}
+
+TEST_F(Hif_test, verify) {
+  std::string dname("hif_test_verify");
+  std::string cname("hif_test_verify_lz");
+  std::string pname("hif_test_verify.hif");
+
+  Hif_write::Options opt;
+  opt.checksum_block  = 4096;
+  opt.max_chunk_stmts = 3000;
+  opt.async_io        = true;
+  auto copt           = opt;
+  copt.codec          = Hif_codec::lz();
+
+  for (const auto &[fname, o] : {std::pair(dname, opt), std::pair(cname, copt),
+                                 std::pair(pname, opt)}) {
+    auto wr = Hif_write::create(fname, "testtool", "0.1.0", o);
+    ASSERT_NE(wr, nullptr);
+    for (auto i = 0; i < 10000; ++i) {
+      auto stmt     = Hif_write::create_node();
+      stmt.instance = "n" + std::to_string(i);
+      stmt.add_input("a", "net" + std::to_string(i & 0x3F));
+      stmt.add_output("y", "net" + std::to_string((i + 1) & 0x3F));
+      wr->add(stmt);
+    }
+  }
+
+  for (const auto &fname : {dname, cname, pname}) {
+    auto rd = Hif_read::open(fname);
+    ASSERT_NE(rd, nullptr);
+    uint64_t bytes = 0;
+    EXPECT_TRUE(rd->verify(4, &bytes)) << fname;
+    EXPECT_GT(bytes, 0);
+  }
+
+  // One flipped bit, in a copy so the original stays valid
+  std::filesystem::remove_all(dname + "_bad");
+  std::filesystem::copy(dname, dname + "_bad");
+  {
+    std::fstream f(dname + "_bad/1.st", std::ios::in | std::ios::out | std::ios::binary);
+    f.seekg(5000);
+    char c = f.get();
+    f.seekp(5000);
+    f.put(c ^ 0x10);
+  }
+  auto rd = Hif_read::open(dname + "_bad");
+  ASSERT_NE(rd, nullptr);
+  EXPECT_FALSE(rd->verify());
+
+  Hif_read::Options ropt;
+  ropt.verify = true;
+  EXPECT_EQ(Hif_read::open(dname + "_bad", ropt), nullptr);
+  EXPECT_NE(Hif_read::open(dname, ropt), nullptr);
+
+  // A truncated chunk fails verify and stops next_stmt at the damage, no crash
+  std::filesystem::resize_file(dname + "_bad/1.st", 4100);  // inside a statement
+  rd = Hif_read::open(dname + "_bad");
+  ASSERT_NE(rd, nullptr);
+  EXPECT_FALSE(rd->verify());
+  uint64_t conta = 0;
+  while (rd->next_stmt()) {
+    ++conta;
+  }
+  EXPECT_LT(conta, 6000);  // stops in chunk 1, chunk 2 is not read
+  EXPECT_TRUE(rd->has_error());
+  EXPECT_FALSE(rd->next_stmt());
+
+  rd = Hif_read::open(dname + "_bad");
+  ASSERT_NE(rd, nullptr);
+  uint64_t ordered = 0;
+  rd->parallel_each_ordered(4, [&](size_t, std::span<const Hif_base::Statement_view> b) {
+    ordered += b.size();
+  });
+  EXPECT_EQ(ordered, conta);
+  EXPECT_TRUE(rd->has_error());
+
+  rd = Hif_read::open(dname);
+  ASSERT_NE(rd, nullptr);
+  while (rd->next_stmt()) {
+  }
+  EXPECT_FALSE(rd->has_error());
+
+  // A missing N.ck fails, unless the caller allows it
+  std::filesystem::remove_all(dname + "_nock");
+  std::filesystem::copy(dname, dname + "_nock");
+  std::filesystem::remove(dname + "_nock/2.ck");
+  rd = Hif_read::open(dname + "_nock");
+  ASSERT_NE(rd, nullptr);
+  EXPECT_FALSE(rd->verify());
+  EXPECT_TRUE(rd->verify(0, nullptr, true));
+  EXPECT_EQ(Hif_read::open(dname + "_nock", ropt), nullptr);
+  ropt.allow_missing_ck = true;
+  EXPECT_NE(Hif_read::open(dname + "_nock", ropt), nullptr);
+
+  // Same when the HIF was written without checksums
+  opt.checksum_block = 0;
+  {
+    auto wr = Hif_write::create(dname + "_nock", "testtool", "0.1.0", opt);
+    ASSERT_NE(wr, nullptr);
+    wr->add(Hif_write::create_node());
+  }
+  rd = Hif_read::open(dname + "_nock");
+  ASSERT_NE(rd, nullptr);
+  EXPECT_FALSE(rd->verify());
+  EXPECT_TRUE(rd->verify(0, nullptr, true));
+}
+
+TEST_F(Hif_test, text_parse) {
+  std::string txt = R"(attr @(tool=testtool, version=0.1.8)
+use
+  @(file=foo.v)
+closed_def 3 inner
+   (input z, output a, input y, output h)
+  @(loc=2)
+  node add
+     (output a, input y, input z)
+    @(loc=-3, mask=0x0102, x=0x0f:base4, txt=some comment\, and another)
+  node 7 "u 1" (output Z=a, input "A,B"="0012") @(empty="", bits=\x00\n)
+end
+  @(loc=5)
+)";
+
+  Hif_text::Options opt;
+  opt.types["add"] = 12;
+  ASSERT_TRUE(Hif_text::parse(txt, "hif_test_text", opt));
+
+  auto rd = Hif_read::open("hif_test_text");
+  ASSERT_NE(rd, nullptr);
+  EXPECT_EQ(rd->get_tool(), "testtool");
+  EXPECT_EQ(rd->get_version(), "0.1.8");
+
+  std::vector<Hif_base::Statement> stmts;
+  rd->each([&stmts](const Hif_base::Statement &stmt) { stmts.emplace_back(stmt); });
+  ASSERT_EQ(stmts.size(), 5);
+
+  EXPECT_TRUE(stmts[0].is_use());
+  EXPECT_EQ(stmts[0].attr[0].rhs, "foo.v");
+
+  EXPECT_TRUE(stmts[1].is_closed_def());
+  EXPECT_EQ(stmts[1].type, 3);
+  EXPECT_EQ(stmts[1].instance, "inner");
+  ASSERT_EQ(stmts[1].io.size(), 4);
+  EXPECT_FALSE(stmts[1].io[1].input);
+  EXPECT_EQ(stmts[1].io[1].lhs, "a");
+  EXPECT_EQ(stmts[1].attr[0].get_rhs_int64(), 2);
+
+  EXPECT_EQ(stmts[2].type, 12);
+  EXPECT_TRUE(stmts[2].instance.empty());
+  EXPECT_EQ(stmts[2].attr[0].get_rhs_int64(), -3);
+  EXPECT_EQ(stmts[2].attr[1].rhs, std::string("\x02\x01"));
+  EXPECT_TRUE(stmts[2].attr[1].is_rhs_base2());
+  EXPECT_EQ(stmts[2].attr[2].rhs_cat, Hif_base::Base4_cat);
+  EXPECT_EQ(stmts[2].attr[3].rhs, "some comment, and another");
+
+  EXPECT_EQ(stmts[3].instance, "u 1");
+  EXPECT_EQ(stmts[3].io[1].lhs, "A,B");
+  EXPECT_EQ(stmts[3].io[1].rhs, "0012");
+  EXPECT_TRUE(stmts[3].io[1].is_rhs_string());
+  EXPECT_EQ(stmts[3].attr[0].rhs, "");
+  EXPECT_EQ(stmts[3].attr[1].rhs, std::string("\0\n", 2));
+
+  EXPECT_TRUE(stmts[4].is_end());
+
+  // Without the type name, a single ID is the instance
+  ASSERT_TRUE(Hif_text::parse(txt, "hif_test_text_err"));
+  rd = Hif_read::open("hif_test_text_err");
+  ASSERT_TRUE(rd->seek(2));
+  ASSERT_TRUE(rd->next_stmt());
+  EXPECT_EQ(rd->get_current_view().instance, "add");
+
+  EXPECT_FALSE(Hif_text::parse("attr @(tool=t, version=1)\nnode 1 a (inout x)\n",
+                               "hif_test_text_err"));
+  EXPECT_FALSE(Hif_text::parse("node 1\n", "hif_test_text_err"));
+
+  // Parallel pieces, including a line that looks like a statement but is not
+  std::string big = "attr @(tool=t, version=1)\n";
+  for (auto i = 0; i < 20000; ++i) {
+    big += "node 5 n" + std::to_string(i) + " (output y=w" + std::to_string(i)
+           + ", input a=w" + std::to_string(i / 2) + ")\n";
+    big += i % 1000 == 7 ? std::string("  @(loc=\nend , k=1)\n")
+                         : "  @(loc=" + std::to_string(i) + ")\n";
+  }
+
+  Hif_text::Options popt;
+  popt.nthreads   = 4;
+  popt.piece_size = 4096;
+  for (auto bad : {false, true}) {
+    if (bad)  // the first piece after the header starts at the fake statement
+      big.insert(big.find("@(loc=\nend"), std::string(big.size() / 4, ' '));
+    ASSERT_TRUE(Hif_text::parse(big, "hif_test_text_big", popt));
+
+    rd = Hif_read::open("hif_test_text_big");
+    ASSERT_NE(rd, nullptr);
+    EXPECT_GT(rd->get_num_chunks(), 1);
+    int64_t next = 0;
+    rd->each([&next](const Hif_base::Statement_view &stmt) {
+      EXPECT_EQ(stmt.instance, "n" + std::to_string(next));
+      EXPECT_EQ(stmt.attr[0].lhs, "loc");
+      ++next;
+    });
+    EXPECT_EQ(next, 20000);
+  }
+}
+
+TEST_F(Hif_test, text_format) {
+  std::vector<Hif_base::Statement> stmts;
+  for (auto i = 0; i < 30000; ++i) {
+    auto stmt     = Hif_write::create_node();
+    stmt.type     = i % 9;
+    stmt.instance = i % 5 == 0 ? "" : "u" + std::to_string(i);
+    stmt.add_input("A", "net" + std::to_string(i / 2));
+    stmt.add_output("Z", "net" + std::to_string(i));
+    stmt.add_attr("loc", (int64_t)(i - 100));
+    if (i % 1000 == 3) {  // IDs that need quotes or escapes
+      stmt.instance = i % 2000 == 3 ? "42" : "a @(b)";
+      stmt.add_input(" sp ", "x,y=z)");
+      stmt.add_input("12", "\"q\"\\\n\t");
+      stmt.add_attr("h", "0x10");
+      stmt.add_attr("e", std::string("\0\x7f\xff", 3));
+      int64_t b2 = 0x0102;
+      stmt.add_attr(Hif_base::String{{"b2", 2}}, Hif_base::Base2(&b2, 3));
+      stmt.add_attr(Hif_base::String{{"b4", 2}}, Hif_base::Base4{{"\x0f\xf0", 2}});
+    }
+    stmts.emplace_back(stmt);
+  }
+
+  Hif_write::Options opt;
+  opt.max_chunk_stmts = 4000;
+  {
+    auto wr = Hif_write::create("hif_test_text_fmt", "testtool", "1.0", opt);
+    for (const auto &stmt : stmts) {
+      wr->add(stmt);
+    }
+    wr->add(Hif_write::create_end());
+  }
+  stmts.emplace_back(Hif_write::create_end());
+
+  auto rd = Hif_read::open("hif_test_text_fmt");
+  ASSERT_NE(rd, nullptr);
+
+  auto write_text = [&rd](const std::string &fname, Hif_text::Style style, unsigned nt) {
+    int fd = ::open(fname.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    EXPECT_TRUE(Hif_text::write(*rd, fd, style, nt));
+    ::close(fd);
+  };
+  write_text("hif_test_text_fmt.txt", Hif_text::Style::Text, 4);
+  write_text("hif_test_text_fmt1.txt", Hif_text::Style::Text, 1);
+  EXPECT_EQ(slurp("hif_test_text_fmt.txt"), slurp("hif_test_text_fmt1.txt"));
+
+  // Write errors are reported (a read only fd)
+  {
+    int fd = ::open("hif_test_text_fmt1.txt", O_RDONLY);
+    EXPECT_FALSE(Hif_text::write(*rd, fd, Hif_text::Style::Text, 4));
+    ::close(fd);
+  }
+
+  ASSERT_TRUE(Hif_text::parse_file("hif_test_text_fmt.txt", "hif_test_text_fmt2"));
+  auto rd2 = Hif_read::open("hif_test_text_fmt2");
+  ASSERT_NE(rd2, nullptr);
+  EXPECT_EQ(rd2->get_tool(), "testtool");
+  EXPECT_EQ(rd2->get_version(), "1.0");
+  size_t n = 0;
+  rd2->each([&](const Hif_base::Statement &stmt) {
+    ASSERT_LT(n, stmts.size());
+    EXPECT_EQ(stmt, stmts[n]) << n;
+    ++n;
+  });
+  EXPECT_EQ(n, stmts.size());
+
+  // Dump is the Statement::dump layout
+  std::string out;
+  Hif_text::format(out, stmts[1], Hif_text::Style::Dump);
+  EXPECT_EQ(out,
+            "hif.node \"u1\" type(1) {\n"
+            "  io {\n"
+            "    %0.in  (\"A\" = \"net0\") :: str\n"
+            "    %1.out (\"Z\" = \"net1\") :: str\n"
+            "  }\n"
+            "  attributes {\n"
+            "    @.0(\"loc\" = -99) :: i64\n"
+            "  }\n"
+            "}\n");
+  std::string base_out;
+  Hif_base::format_dump(base_out, stmts[1]);
+  EXPECT_EQ(base_out, out);
+  out.clear();
+  Hif_text::format(out, stmts[1], Hif_text::Style::Text);
+  EXPECT_EQ(out, "node 1 u1\n  (input A=net0, output Z=net1)\n  @(loc=-99)\n");
+}
+
+TEST_F(Hif_test, base4_const) {
+  // Every length around the 16 digit blocks, decoded back one bit at a time
+  std::string packed;
+  auto        cat  = Hif_base::String_cat;
+  const char  dg[] = "01xz";
+  unsigned    seed = 7;
+  for (auto len = 1; len <= 100; ++len) {
+    for (auto rep = 0; rep < 4; ++rep) {
+      std::string bits;
+      for (auto i = 0; i < len; ++i) {
+        seed = seed * 1103515245 + 12345;
+        bits.push_back(dg[(seed >> 16) % (rep == 0 ? 2 : (rep == 1 ? 3 : 4))]);
+      }
+      ASSERT_TRUE(Hif_const::from_bits(bits, packed, cat)) << bits;
+      bool has_z = bits.find('z') != std::string::npos;
+      bool has_x = bits.find('x') != std::string::npos;
+      EXPECT_EQ(cat,
+                has_z ? Hif_base::Base4_cat
+                      : (has_x || len % 8 ? Hif_base::Base3_cat : Hif_base::Base2_cat));
+      ASSERT_EQ(Hif_base::const_bits(cat, packed), len);
+      for (auto i = 0; i < len; ++i) {
+        ASSERT_EQ(Hif_base::const_bit(cat, packed, i), bits[len - 1 - i]) << bits;
+      }
+      EXPECT_TRUE(Hif_const::is_canonical(cat, packed));
+      EXPECT_EQ(Hif_const::to_verilog(cat, packed), std::to_string(len) + "'b" + bits);
+    }
+  }
+  std::string bad(40, '1');
+  bad[37] = '2';  // in the SIMD block
+  EXPECT_FALSE(Hif_const::from_bits(bad, packed, cat));
+  EXPECT_FALSE(Hif_const::from_bits("", packed, cat));
+
+  ASSERT_TRUE(Hif_const::from_bits("1_0X?_Z", packed, cat));
+  EXPECT_EQ(Hif_const::to_verilog(cat, packed), "5'b10xxz");
+
+  ASSERT_TRUE(Hif_const::from_verilog("8'b10xz", packed, cat));
+  EXPECT_EQ(cat, Hif_base::Base4_cat);
+  EXPECT_EQ(packed, std::string("\x08\x08\x02\x01", 4));
+  ASSERT_TRUE(Hif_const::from_verilog("4'hx", packed, cat));
+  EXPECT_EQ(cat, Hif_base::Base3_cat);
+  EXPECT_EQ(packed, std::string("\x04\x00\x0f", 3));
+  EXPECT_EQ(Hif_base::const_bits(cat, packed), 4);
+  EXPECT_EQ(Hif_const::to_verilog(cat, packed), "4'bxxxx");
+  ASSERT_TRUE(Hif_const::from_verilog("'o17", packed, cat));
+  EXPECT_EQ(cat, Hif_base::Base3_cat);  // 6 bits, Base2 has no width
+  EXPECT_EQ(packed, std::string("\x06\x0f\x00", 3));
+  ASSERT_TRUE(Hif_const::from_verilog("16'hff", packed, cat));
+  EXPECT_EQ(cat, Hif_base::Base2_cat);
+  EXPECT_EQ(packed, std::string("\xff\x00", 2));
+  ASSERT_TRUE(Hif_const::from_verilog("6'b1", packed, cat));
+  EXPECT_EQ(packed, std::string("\x06\x01\x00", 3));
+  ASSERT_TRUE(Hif_const::from_verilog("2'b1x01", packed, cat));
+  EXPECT_EQ(cat, Hif_base::Base3_cat);
+  EXPECT_EQ(packed, std::string("\x02\x01\x00", 3));
+  ASSERT_TRUE(Hif_const::from_verilog("4'dz", packed, cat));
+  EXPECT_EQ(Hif_const::to_verilog(cat, packed), "4'bzzzz");
+  ASSERT_TRUE(Hif_const::from_verilog("12'sd300", packed, cat));
+  EXPECT_EQ(packed, std::string("\x0c\x2c\x01\x00\x00", 5));
+  ASSERT_TRUE(Hif_const::from_verilog("300'bx", packed, cat));
+  EXPECT_EQ(packed.substr(0, 2), "\xac\x02");  // two byte width
+  EXPECT_EQ(Hif_base::const_bits(cat, packed), 300);
+  EXPECT_EQ(Hif_base::const_bit(cat, packed, 299), 'x');
+  ASSERT_TRUE(Hif_const::from_verilog("8'hz_a", packed, cat));
+  EXPECT_EQ(Hif_const::to_verilog(cat, packed), "8'bzzzz1010");
+  for (auto lit : {"8'b102", "'b", "8b1", "0'b1", "4'q1", "'o8", "'d1x", "x'b1"}) {
+    EXPECT_FALSE(Hif_const::from_verilog(lit, packed, cat)) << lit;
+  }
+  // The widest constants that still fit in an ID (20 bit size)
+  ASSERT_TRUE(Hif_const::from_verilog("4194280'bx", packed, cat));
+  EXPECT_EQ(cat, Hif_base::Base3_cat);
+  EXPECT_LE(packed.size(), Hif_base::max_id_size);
+  EXPECT_FALSE(Hif_const::from_verilog("4194281'bx", packed, cat));
+  EXPECT_FALSE(Hif_const::from_verilog("4194304'bz", packed, cat));
+  EXPECT_FALSE(Hif_const::from_verilog("4194280'bz", packed, cat));
+  ASSERT_TRUE(Hif_const::from_verilog("2796184'bz", packed, cat));
+  EXPECT_EQ(cat, Hif_base::Base4_cat);
+  EXPECT_LE(packed.size(), Hif_base::max_id_size);
+  EXPECT_FALSE(Hif_const::from_verilog("2796192'bz", packed, cat));
+
+  EXPECT_FALSE(Hif_const::is_canonical(Hif_base::Base4_cat, "\x08\x0f\xf0"));
+  EXPECT_EQ(Hif_base::const_bits(Hif_base::Base4_cat, "\x08\x0f\xf0"), 0);
+  auto b3_canonical = [](std::string_view packed) {
+    return Hif_const::is_canonical(Hif_base::Base3_cat, packed);
+  };
+  EXPECT_FALSE(b3_canonical(std::string("\x08\x01\x00", 3)));  // no x, is Base2
+  EXPECT_FALSE(b3_canonical("\x08\x01\x01"));                   // 1 and x
+  EXPECT_FALSE(b3_canonical(std::string("\x04\x10\x01", 3)));   // padding bit
+  EXPECT_FALSE(b3_canonical(std::string("\x84\x00\x00\x01", 4)));  // width 0x84 0x00
+  EXPECT_TRUE(b3_canonical(std::string("\x04\x00\x01", 3)));
+
+  // Accessors on the mapped statements, and the text literal form
+  std::string b3, b4;
+  ASSERT_TRUE(Hif_const::from_verilog("16'h0x0f", b3, cat));
+  ASSERT_EQ(cat, Hif_base::Base3_cat);
+  ASSERT_TRUE(Hif_const::from_verilog("4'b10xz", b4, cat));
+  ASSERT_EQ(cat, Hif_base::Base4_cat);
+
+  auto stmt = Hif_write::create_node();
+  stmt.type = 3;
+  stmt.add_input(Hif_base::String{{"A", 1}}, Hif_base::Base3(b3));
+  stmt.add_input(Hif_base::String{{"B", 1}}, Hif_base::Base4(b4));
+  stmt.add_attr(Hif_base::String{{"init", 4}}, Hif_base::Base4(b4));
+  {
+    auto wr = Hif_write::create(std::string("hif_test_base4"), "testtool", "1.0");
+    wr->add(stmt);
+  }
+
+  auto rd = Hif_read::open("hif_test_base4");
+  ASSERT_NE(rd, nullptr);
+  int conta = 0;
+  rd->each([&](const Hif_base::Statement_view &view) {
+    EXPECT_TRUE(view.io[0].is_rhs_base3());
+    EXPECT_TRUE(view.io[0].is_rhs_const());
+    EXPECT_EQ(view.io[0].get_rhs_bits(), 16);
+    EXPECT_EQ(view.io[0].get_rhs_bit(0), '1');
+    EXPECT_EQ(view.io[0].get_rhs_bit(4), '0');
+    EXPECT_EQ(view.io[0].get_rhs_bit(8), 'x');
+    EXPECT_EQ(view.io[0].get_rhs_bit(11), 'x');
+    EXPECT_EQ(view.io[0].get_rhs_bit(15), '0');
+    EXPECT_TRUE(view.io[1].is_rhs_base4());
+    EXPECT_EQ(view.io[1].get_rhs_bits(), 4);
+    EXPECT_EQ(view.io[1].get_rhs_bit(0), 'z');
+    EXPECT_EQ(view.io[1].get_rhs_bit(1), 'x');
+    EXPECT_EQ(view.io[1].get_rhs_bit(3), '1');
+    EXPECT_EQ(view.to_statement(), stmt);
+    ++conta;
+  });
+  EXPECT_EQ(conta, 1);
+
+  std::string out;
+  Hif_text::format(out, stmt, Hif_text::Style::Text);
+  EXPECT_EQ(out,
+            "node 3\n  (input A=16'b0000xxxx00001111, input B=4'b10xz)\n"
+            "  @(init=4'b10xz)\n");
+
+  std::string txt = "attr @(tool=t, version=1)\n" + out
+                    + "node 4 (input A=4'hz, input B='hf, input C=\"4'b1\", "
+                      "input D=4'b12)\n";
+  ASSERT_TRUE(Hif_text::parse(txt, "hif_test_base4_text"));
+  rd = Hif_read::open("hif_test_base4_text");
+  ASSERT_NE(rd, nullptr);
+  std::vector<Hif_base::Statement> stmts;
+  rd->each([&stmts](const Hif_base::Statement &s) { stmts.emplace_back(s); });
+  ASSERT_EQ(stmts.size(), 2);
+  EXPECT_EQ(stmts[0], stmt);
+  EXPECT_EQ(stmts[1].io[0].rhs_cat, Hif_base::Base4_cat);
+  EXPECT_EQ(stmts[1].io[1].rhs, std::string("\x04\x0f\x00", 3));
+  EXPECT_TRUE(stmts[1].io[2].is_rhs_string());
+  EXPECT_EQ(stmts[1].io[2].rhs, "4'b1");
+  EXPECT_TRUE(stmts[1].io[3].is_rhs_string());
+
+  out.clear();
+  Hif_text::format(out, stmts[1], Hif_text::Style::Text);
+  EXPECT_EQ(out,
+            "node 4\n  (input A=4'bzzzz, input B=4'b1111, input C=\"4'b1\", "
+            "input D=4'b12)\n");
+}
@@ -0,0 +1,42 @@
+//  This file is distributed under the BSD 3-Clause License. See LICENSE for details.
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "hif/hif_read.hpp"
+
+int main(int argc, char **argv) {
+  bool allow_missing = argc > 1 && std::string(argv[1]) == "-m";
+  if (allow_missing) {
+    --argc;
+    ++argv;
+  }
+
+  if (argc != 2 && argc != 3) {
+    std::cerr << "Usage:\n";
+    std::cerr << "\thif_verify [-m] <hif> [threads]\n";
+    std::cerr << "Checks the chunk files against their N.ck checksums\n";
+    std::cerr << "\t-m  chunks without N.ck pass (written with checksum_block 0)\n";
+    exit(-3);
+  }
+
+  auto rd = Hif_read::open(argv[1]);
+  if (rd == nullptr) {
+    std::cerr << "could not open " << argv[1] << "\n";
+    exit(-3);
+  }
+
+  unsigned nthreads = argc == 3 ? std::stoul(argv[2]) : 0;
+
+  uint64_t bytes = 0;
+  auto     start = std::chrono::steady_clock::now();
+  bool     ok    = rd->verify(nthreads, &bytes, allow_missing);
+
+  std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+
+  std::cout << (ok ? "OK" : "FAILED") << " " << bytes << " bytes in " << secs.count()
+            << "s (" << bytes / secs.count() / 1e9 << " GB/s)\n";
+
+  return ok ? 0 : -1;
+}